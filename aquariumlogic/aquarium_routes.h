@@ -0,0 +1,50 @@
+/**
+ * Name: aquarium_routes.h
+ * Desc: Route table between the route anchors, the waypoint cells a fish
+ *       turns at on the shortest way round the decorations
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Note: Made by host/route_gen.cpp from occupancyGrid and routeAnchors,
+ *       do not edit. Read through route_getLength and route_getWaypoint
+**/
+
+#ifndef AQUARIUM_ROUTES_H
+#define AQUARIUM_ROUTES_H
+
+#define ROUTE_NUM_WAYPOINTS 11
+
+// Where each route's waypoints start in routeWaypoints, [from][to]
+const uint8_t routeOffsets[ROUTE_NUM_ANCHORS][ROUTE_NUM_ANCHORS] PROGMEM = {
+  {0, 0, 0, 0, 1, 1}, // From centre
+  {1, 2, 2, 2, 4, 5}, // From hide
+  {5, 5, 5, 5, 5, 5}, // From north east
+  {5, 6, 8, 8, 8, 8}, // From south east
+  {9, 9, 10, 10, 10, 10}, // From south west
+  {10, 10, 10, 10, 11, 11} // From north west
+};
+
+// How many waypoints each route has, [from][to]
+const uint8_t routeLengths[ROUTE_NUM_ANCHORS][ROUTE_NUM_ANCHORS] PROGMEM = {
+  {0, 0, 0, 1, 0, 0}, // From centre
+  {1, 0, 0, 2, 1, 0}, // From hide
+  {0, 0, 0, 0, 0, 0}, // From north east
+  {1, 2, 0, 0, 0, 1}, // From south east
+  {0, 1, 0, 0, 0, 0}, // From south west
+  {0, 0, 0, 1, 0, 0} // From north west
+};
+
+// Waypoint cells, ROUTE_PACK(x, y, z)
+const uint16_t routeWaypoints[ROUTE_NUM_WAYPOINTS > 0 ? ROUTE_NUM_WAYPOINTS : 1] PROGMEM = {
+  ROUTE_PACK(14, 4, 4), // centre to south east
+  ROUTE_PACK(8, 9, 4), // hide to centre
+  ROUTE_PACK(10, 9, 2), // hide to south east
+  ROUTE_PACK(14, 3, 4),
+  ROUTE_PACK(6, 10, 3), // hide to south west
+  ROUTE_PACK(14, 4, 4), // south east to centre
+  ROUTE_PACK(14, 4, 4), // south east to hide
+  ROUTE_PACK(9, 11, 1),
+  ROUTE_PACK(11, 1, 4), // south east to north west
+  ROUTE_PACK(6, 10, 3), // south west to hide
+  ROUTE_PACK(11, 1, 4) // north west to south east
+};
+
+#endif
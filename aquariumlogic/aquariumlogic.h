@@ -34,6 +34,8 @@
 #define MIN_LIGHT_VAL 250
 #define MIN_LIGHT_RECOVERY_VAL 350
 #define PIEZO_MIN_TAP_VAL 50
+#define LS_BASELINE_SAMPLES 8 // Readings averaged for the starting light level
+#define LS_BASELINE_INTERVAL_MS 5 // Samples span two mains flicker periods
 #define NO_TAP -1
 
 // Generic multi-purpose NONE value
@@ -42,22 +44,172 @@
 // Jellyfish behavorial constants
 #define JELLYFISH_RAISED_ANGLE 180
 #define JELLYFISH_LOWERED_ANGLE 0
+#define JELLYFISH_SLEW_RATE 60 // deg / sec
+#define JELLYFISH_FADE_IN_MS 1500
+#define JELLYFISH_FADE_OUT_MS 800
+#define JELLYFISH_GLOW_MIN 90
+#define JELLYFISH_GLOW_MAX 255
+#define JELLYFISH_PRIORITY 2 // Above the fish, it only shows while they hide
+
+// Jellyfish wave, every jellyfish bobs and glows on one shared phase, each
+// a fixed fraction of a wave behind the last so the motion travels along them
+#define JELLYFISH_WAVE_PERIOD_MS 4000
+#define JELLYFISH_WAVE_PHASE_PER_MS (0xFFFFFFFFUL / JELLYFISH_WAVE_PERIOD_MS) // A wave is 2^32
+#define JELLYFISH_WAVE_TABLE_SIZE 64 // Must divide 256
+#define JELLYFISH_WAVE_BOB_ANGLE 20 // deg above JELLYFISH_LOWERED_ANGLE at the crest
+#define JELLYFISH_WAVE_BLEND_MS 500 // Joining the wave after being lowered
+// Uncomment to time jellyfish_stepAll at boot against the number of jellyfish
+// (up to NUM_JELLYFISH, extra ones share jellyfish 0's servo and LED)
+//#define JELLYFISH_BENCHMARK
+#define JELLYFISH_BENCHMARK_TICKS 1000
 
 // Fish behavorial constants
 // NOTE: Location and speed constraints below
 #define FISH_SUB_STEPS_TO_GOAL 1
 #define WIGGLE_AMPLITUDE 10
 #define WIGGLE_SPEED 3.14159 // rad / sec
-#define FISH_OWNER 1
+#define FISH_PRIORITY 1
+
+// Axis ownership, axisOwnerCallbacks is indexed [owner type][owner event]
+#define FISH_OWNER 0
+#define JELLYFISH_OWNER 1
+#define NUM_OWNER_TYPES 2
+#define AXIS_OWNER_GOAL_REACHED 0
+#define AXIS_OWNER_PREEMPTED 1 // Lost the axis to a higher priority
+#define AXIS_OWNER_RETURNED 2 // Got it back after being preempted
+#define AXIS_NUM_OWNER_EVENTS 3
+
+// Limited rotation servo motion constants
+#define LRS_DEFAULT_SLEW_RATE 90 // deg / sec (average, easing peaks at 1.5x)
+#define LRS_EASE_ONE 256 // Fixed point 1.0 for easing progress
+
+// Axis ids are globalServos indices, limited rotation servos first
+#define AXIS_LRS(id) (id)
+#define AXIS_CRS(id) (NUM_LIM_ROT_SERVOS + (id))
+#define AXIS_IS_LRS(axis) ((axis) < NUM_LIM_ROT_SERVOS)
+#define AXIS_SERVO(axis) (AXIS_IS_LRS(axis) ? (axis) : (axis) - NUM_LIM_ROT_SERVOS)
+
+// LED animation constants
+#define LED_ANIM_NONE 0
+#define LED_ANIM_FADE 1
+#define LED_ANIM_PULSE 2
+#define LED_MAX_BRIGHTNESS 255
+#define LED_DIGITAL_THRESHOLD 128 // Brightness at which non-PWM lines turn on
+
+// Bit angle modulation constants (Timer2 at /128, 8us per tick)
+// Uncomment to measure BAM interrupt load at boot instead of running
+//#define BAM_BENCHMARK
+#define BAM_MAX_CHANNELS 16
+#define BAM_MAX_PORTS 4
+#define BAM_BITS 8
+#define BAM_LSB_TICKS 2 // Bit 0 shows for 16us, a full frame takes 4.08ms
+#define BAM_BENCHMARK_MS 1000
+#define BAM_BENCHMARK_LEVEL 0x55 // Every other plane lit
+#define BAM_BENCHMARK_NUM_PINS 6
 
 // Aquarium behavior constants
 #define LONG_TIME_STEP 100
 #define SHORT_TIME_STEP 10
 
+// Aquarium states
+#define AQ_STATE_FISH 0 // Lights on, fish patrolling
+#define AQ_STATE_FLEEING 1 // Lights on, fish running from a tap
+#define AQ_STATE_HIDING 2 // Lights off, fish heading to its hiding place
+#define AQ_STATE_JELLYFISH 3 // Lights off, fish hidden, jellyfish showing
+#define AQ_NUM_STATES 4
+
+// Aquarium events
+#define AQ_EVENT_TAP 0
+#define AQ_EVENT_DARK 1
+#define AQ_EVENT_LIGHT 2
+#define AQ_EVENT_FISH_GOAL 3
+#define AQ_NUM_EVENTS 4
+
+// Aquarium transition actions (index into aquariumActions)
+#define AQ_ACTION_NONE 0
+#define AQ_ACTION_PATROL 1
+#define AQ_ACTION_FLEE 2
+#define AQ_ACTION_HIDE 3
+#define AQ_ACTION_STOP 4
+#define AQ_ACTION_SHOW_FISH 5
+#define AQ_NUM_ACTIONS 6
+
+#define AQ_TRACE_LENGTH 16
+
+// Tap filtering constants
+#define TAP_COALESCE_MS 250 // Taps closer than this to the last accepted one merge into it
+#define FLEE_REVERSE_HOLDOFF_MS 1000 // Minimum flee time before changing corner
+
+// Flight recorder constants
+// Uncomment to run the watchdog, the recorder is dumped after it bites
+//#define FR_WATCHDOG
+#define FR_LENGTH 32 // Records kept, must be a power of two
+#define FR_MAGIC 0xF17E
+#define FR_DUMP_COMMAND 'f' // Serial byte that dumps the recorder
+#define FR_TICK_OVERRUN_MS (2 * LONG_TIME_STEP) // Long steps this late are recorded
+#define FR_NUM_TRACES (2 * NUM_CONT_ROT_SERVOS) // Newest velocity and correction per servo
+#define FR_NO_EVENT 255 // Trace slot with nothing in it yet
+
+// Flight recorder events (id and arg meaning per event)
+#define FR_EVENT_BOOT 0 // arg: MCUSR reset flags
+#define FR_EVENT_TICK 1 // id: aquarium, arg: long step ms (overruns only)
+#define FR_EVENT_TAP 2 // id: aquarium, arg: high level sensor id
+#define FR_EVENT_TAP_DROPPED 3 // id: aquarium, arg: high level sensor id
+#define FR_EVENT_LIGHT 4 // id: aquarium, arg: 1 light, 0 dark
+#define FR_EVENT_TRANSITION 5 // id: aquarium, arg: from << 12 | event << 8 | to
+#define FR_EVENT_GOAL_REACHED 6 // id: aquarium, arg: fish
+#define FR_EVENT_VELOCITY 7 // id: servo, arg: velocity written
+#define FR_EVENT_CORRECTION 8 // id: servo, arg: steps added to position
+#define FR_EVENT_CLOCK_SET 9 // id: address, arg: change in shared time (ms)
+#define FR_EVENT_SCHEDULED_RUN 10 // id: command, arg: lateness (ms)
+#define FR_EVENT_HOMED 11 // id: servo, arg: steps the restored position was off
+#define FR_EVENT_HOMING_FAILED 12 // id: servo, arg: last pot reading
+#define FR_EVENT_PREEMPTED 13 // id: axis, arg: owner type taking it over
+
+// Debug text, silenced once a clock sync master talks to the board
+#define DEBUG_PRINT(value) do { if(!cs_isActive()) Serial.print(value); } while(0)
+
+// Clock sync constants (frames are "@<type><address> <args>\n" in decimal)
+#define CS_FRAME_START '@'
+#define CS_FRAME_END '\n'
+#define CS_FRAME_LENGTH 48
+#define CS_BROADCAST_ADDRESS 255
+#define CS_DEFAULT_ADDRESS 0
+#define CS_ADDRESS_EEPROM_ADDR (CRS_WINDOW_EEPROM_ADDR + NUM_CONT_ROT_SERVOS * sizeof(CrsWindowDto)) // After the trusted windows
+#define CS_MAX_SCHEDULED 4
+#define CS_MAX_SKEW_PPM 1000
+#define CS_MAX_ARGS 4
+
+// Clock sync frame types
+#define CS_FRAME_SYNC 'S' // <seq>, answered with CS_FRAME_REPLY
+#define CS_FRAME_REPLY 'R' // <seq> <local receive us> <local send us>
+#define CS_FRAME_SET_CLOCK 'O' // <local ref us> <offset us> <skew ppm>
+#define CS_FRAME_FISH_GOTO 'G' // <shared us> <x> <y> <z>
+#define CS_FRAME_JELLYFISH 'J' // <shared us> <1 lower, 0 raise>
+#define CS_FRAME_ADDRESS 'A' // <new address>
+
+// Boot tasks (index into bootTasks), at most eight
+#define BOOT_TASK_SERVO_X 0
+#define BOOT_TASK_SERVO_Y 1
+#define BOOT_TASK_SERVO_Z 2
+#define BOOT_TASK_LIGHT 3
+#define BOOT_TASK_FISH 4
+#define BOOT_TASK_AQUARIUM 5
+#define NUM_BOOT_TASKS 6
+#define BOOT_AFTER(task) (1 << (task))
+
+// Flight recorder storage survives resets other than power on
+#if defined(__AVR__)
+#define FR_NOINIT __attribute__((section(".noinit")))
+#else
+#define FR_NOINIT
+#endif
+
 // Calibration constants
 #define PRE_CALIBRATION_ZERO_VAL 1500
 #define PRE_CALIBRATION_POSITION 0
 #define STARTING_TARGET_VELOCITY 100
+#define CRS_MAX_VELOCITY 1000 // steps / sec, about the turn a second such a servo manages
 #define DEFAULT_VELOCITY_SLOPE -1
 #define SIZE_OF_POSITION_VAL 4
 #define CALIBRATION_CAUTIOUS_FACTOR 0.75
@@ -71,6 +223,12 @@
 #define MAX_TRUSTED_VALUE 900
 #define MAX_LOW_VAL 24
 #define MIN_LOW_VAL 0
+#define MIN_LEARNABLE_VALUE 25
+#define MAX_LEARNABLE_VALUE 1000
+#define MAX_LEARN_STEP_DELTA 256
+#define TRUSTED_WINDOW_MARGIN 8
+#define TRUSTED_WINDOW_SAVE_STEP 16
+#define CRS_WINDOW_EEPROM_ADDR (NUM_CONT_ROT_SERVOS * sizeof(CrsDto)) // After the calibration records
 #define SHORT_CALIBRATION_DUR 10
 #define START_CALIBRATION_VEL 10
 
@@ -78,6 +236,11 @@
 #define SLOPE_FINDING_VEL_2 200
 #define SLOPE_FINDING_DUR 500
 
+// Homing constants
+#define HOMING_VELOCITY SLOPE_FINDING_VEL_2 // Calibration relies on it moving the pot
+#define HOMING_SETTLE_MS 20
+#define HOMING_TIMEOUT_MS 4000 // Well over the time to cover the dead zone
+
 // Location and speed constraints
 #define MIN_FISH_SPEED 0
 #define MAX_FISH_SPEED 50
@@ -89,9 +252,38 @@
 #define MAX_Z_VAL 102400
 #define CENTRAL_X_VAL 0
 #define CENTRAL_Y_VAL 0
-#define FISH_HIDE_X 0
-#define FISH_HIDE_Y 0
-#define FISH_HIDE_Z 0
+#define CENTRAL_Z_VAL 0
+#define FISH_HIDE_X 0 // Behind the castle, near the floor
+#define FISH_HIDE_Y 44800
+#define FISH_HIDE_Z -64000
+
+// Occupancy grid of the tank's decorations, over the box above
+#define OG_CELLS_X 16 // At most 16, a row of x is one word
+#define OG_CELLS_Y 16
+#define OG_CELLS_Z 8
+#define OG_CELL_X_STEPS ((MAX_X_VAL - MIN_X_VAL) / OG_CELLS_X)
+#define OG_CELL_Y_STEPS ((MAX_Y_VAL - MIN_Y_VAL) / OG_CELLS_Y)
+#define OG_CELL_Z_STEPS ((MAX_Z_VAL - MIN_Z_VAL) / OG_CELLS_Z)
+#define OG_SUBCELLS 256 // Fixed point positions within a cell, must divide the cell sizes
+#define OG_NUM_DETOUR_DIRECTIONS 6
+#define OG_MAX_DETOUR_CELLS 4 // Furthest a detour waypoint is put from the blocked segment
+#define OG_CELL_OF_X(x) (((x) - MIN_X_VAL) / OG_CELL_X_STEPS)
+#define OG_CELL_OF_Y(y) (((y) - MIN_Y_VAL) / OG_CELL_Y_STEPS)
+#define OG_CELL_OF_Z(z) (((z) - MIN_Z_VAL) / OG_CELL_Z_STEPS)
+
+// Precomputed routes between anchor cells (aquarium_routes.h, made by
+// host/route_gen.cpp, which has to be rerun when the grid or anchors change)
+#define ROUTE_ANCHOR_CENTRE 0
+#define ROUTE_ANCHOR_HIDE 1
+#define ROUTE_ANCHOR_NE 2 // Flee corners
+#define ROUTE_ANCHOR_SE 3
+#define ROUTE_ANCHOR_SW 4
+#define ROUTE_ANCHOR_NW 5
+#define ROUTE_NUM_ANCHORS 6
+#define ROUTE_PACK(cellX, cellY, cellZ) ((cellX) | (cellY) << 4 | (cellZ) << 8) // Waypoint cell in a word
+#define ROUTE_CELL_X(packed) ((packed) & 0xF)
+#define ROUTE_CELL_Y(packed) (((packed) >> 4) & 0xF)
+#define ROUTE_CELL_Z(packed) ((packed) >> 8)
 
 // Piezo sensor ids
 #define NE_SENSOR_ID 0
@@ -108,8 +300,11 @@
 
 #define MS_PER_SEC 1000
 
-#define NUM_STEPS_PER_RAD 0.00306796158
-#define NUM_STEPS_ROT 2048
+// A step is one pot reading. The pot's 1024 readings span about 95% of a
+// turn, the rest of the turn is its dead zone
+#define NUM_STEPS_ROT 1077
+#define NUM_STEPS_PER_RAD (NUM_STEPS_ROT / (2 * M_PI))
+#define CRS_SAVE_STEPS (NUM_STEPS_ROT / 4) // Homing finds the phase within half a turn
 
 #define AQUARIUM_ID 0
 
@@ -119,6 +314,8 @@
 #include <math.h>
 #include <stdarg.h>
 
+#include "pt.h"
+
 // Abstraction for continuous rotation servos
 
 typedef struct
@@ -128,12 +325,72 @@ typedef struct
   double velocitySlope; // From calibration
 } CrsDto;
 
+// Stored apart from CrsDto so boards saved before it existed keep their
+// records where they were, erased EEPROM fails the range check on load
+typedef struct
+{
+  int minTrustedVal; // Learned during operation
+  int maxTrustedVal; // Learned during operation
+} CrsWindowDto;
+
+// State of a calibration thread, allocated only while its servo calibrates
+typedef struct
+{
+  Pt pt;
+  Pt childPt;
+  unsigned long waitStartUS;
+  long lastPos;
+  int currentVel;
+  int numMatchingVals;
+  int lastVal;
+  int potVal1;
+  float raw1;
+  float speed1;
+  float raw2;
+  float speed2;
+  unsigned long sectionWaitStartUS; // Child thread state from here on
+  int sectionVal;
+  int sectionLastVal;
+  int sectionMatchingVals;
+  boolean sectionIncreasing;
+} CrsCalibration;
+
+// State of a homing thread, allocated only while its servo homes
+typedef struct
+{
+  Pt pt;
+  unsigned long startMS;
+  unsigned long waitStartUS;
+  int lastVal;
+  int numMatchingVals;
+  boolean increasing;
+  long travel; // Pot steps covered since homing started
+} CrsHoming;
+
+// Who an axis is reserved by
+typedef struct
+{
+  int type; // *_OWNER or NONE if unowned
+  int id;
+  byte priority;
+} AxisReservation;
+
+typedef struct
+{
+  AxisReservation owner;
+  AxisReservation preempted; // Owner to hand back to on release
+} AxisOwnership;
+
+typedef void (*AxisOwnerCallback)(int ownerID, int axis);
+
 typedef struct
 {
   int controlLine;
   int potLine; 
   int zeroValue; // From calibration
   long position; // Zerored at calibration
+  long positionRemainder; // Thousandths of a step not yet in position
+  long savedPosition; // As last written to EEPROM
   long targetPosition;
   boolean decreasing;
   boolean inTrustedArea;
@@ -141,9 +398,21 @@ typedef struct
   int correctionLastVal;
   int targetVel;
   double velocitySlope; // From calibration
-  int ownerType;
-  int ownerID;
+  AxisOwnership ownership;
   int selfID;
+  int minTrustedVal; // Learned linear section of the pot
+  int maxTrustedVal; // Learned linear section of the pot
+  int learnLastVal;
+  int learnRunMin;
+  int learnRunMax;
+  int learnRunLength;
+  boolean learnIncreasing;
+  int unsavedWindowGrowth;
+  int commandVelocity; // Velocity behind commandRaw
+  int commandRaw; // Last pulse written (us), NONE if it must be rewritten
+  unsigned long numSkippedWrites;
+  CrsCalibration * calibration; // NULL unless calibrating in the background
+  CrsHoming * homing; // NULL unless homing in the background
 } ContinuousRotationServo;
 
 // Continuous rotation servo behavior
@@ -161,21 +430,15 @@ ContinuousRotationServo * crs_getInstance(int id);
  * Para: id, The unique id of the servo to operate on
  *       controlLine, Which line to use for PWM to control the device
  *       potLine, The line where the potentiometer is installed
- *       calibrate, If true, servo's position is reset. If false, loaded from EEPROM
+ *       calibrate, If true, servo's position is reset. If false, loaded from
+ *                  EEPROM and homed on the pot
+ * Note: Calibration and homing run in the background (see
+ *       crs_isCalibrating and crs_isHoming)
 **/
 void crs_init(int id, byte controlLine, byte potLine, boolean callibrate);
 
 void crs_stop(int id);
 
-/**
- * Name: crs_setOwner(int id, int type, int ownerID);
- * Desc: Sets the id of the owner of this servo
- * Para: id, The id of the servo to set the owner of
- *       type, The type of the object that owns this servo
- *       ownerID, The unique numerical id of the object that owns this servo
-**/
-void crs_setOwner(int id, int type, int ownerID);
-
 /**
  * Name: crs_startMovingTo(int id, long targetPosition)
  * Desc: Moves the given servo to the given position
@@ -204,7 +467,8 @@ void crs_step(int id, long ms);
  * Name: crs_setTargetVelocity(int id, int targetVelocity)
  * Desc: Sets the velocity this servo should use to reach its goal point
  * Para: id, The unique numerical id of the servo to operate on
- *       targetVelocity, The velocity this servo should use
+ *       targetVelocity, The velocity this servo should use (steps / sec,
+ *                       at most CRS_MAX_VELOCITY)
 **/
 void crs_setTargetVelocity(int id, int targetVelocity);
 
@@ -235,37 +499,149 @@ long crs_getPos(int id);
 int crs_convertVelocityToRaw_(int id, float vel);
 
 /**
- * Name: crs_loadCalConstants_(int id)
- * Desc: Load position information from EEPROM
+ * Name: crs_loadCalibration_(int id)
+ * Desc: Load position and calibration information from EEPROM
  * Para: id, The id of the servo to operate on
  * Note: Should be treated as private member of ContinuousRotationServo
 **/
-void crs_loadPosition_(int id);
+void crs_loadCalibration_(int id);
 
 /**
- * Name:crsh_save_(int id)
- * Desc: Saves this servo's position information to EEPROM
+ * Name: crs_saveCalibration_(int id)
+ * Desc: Saves this servo's position and calibration information to EEPROM,
+ *       writing only the bytes that changed
  * Para: id, The unique numerical id of the servo to save to mem
  * Note: Should be treated as private member of ContinuousRotationServo
 **/
+void crs_saveCalibration_(int id);
+
+/**
+ * Name: crs_savePosition_(int id)
+ * Desc: Saves just this servo's position to EEPROM, writing only the bytes
+ *       that changed, so homing starts from the turn it came to rest on.
+ *       Skipped while within CRS_SAVE_STEPS of the saved one, as homing
+ *       recovers the phase and every write wears the cells
+ * Para: id, The unique numerical id of the servo to save
+ * Note: Called when the servo stops. Nothing is written while it
+ *       calibrates or homes. Should be treated as private member of
+ *       ContinuousRotationServo
+**/
 void crs_savePosition_(int id);
 
 /**
- * Name: crs_calibrate_(int id)
- * Desc: Generate calibration constants and zero position
+ * Name: crs_calibrateThread_(Pt * pt, int id)
+ * Desc: The calibration routine as a protothread, one step per call
+ * Para: pt, The thread's state (calibration->pt of the servo)
+ *       id, The id of the servo to operate on
+ * Retr: PT_* result of the step
+ * Note: Should be treated as private member of ContinuousRotationServo
+**/
+char crs_calibrateThread_(Pt * pt, int id);
+
+/**
+ * Name: crs_startCalibration(int id)
+ * Desc: Starts calibrating a servo in the background of the tick
+ *       scheduler, the result is saved to EEPROM when done
+ * Para: id, The id of the servo to operate on
+ * Retr: False if the servo is already calibrating or there is no memory
+ *       for the thread's state
+ * Note: Nothing else should command the servo until crs_isCalibrating
+ *       turns false. Servos calibrate side by side, each holding its own
+ *       state on the heap until it finishes
+**/
+boolean crs_startCalibration(int id);
+
+/**
+ * Name: crs_isCalibrating(int id)
+ * Desc: Determines if a background calibration of the servo is running
+ * Para: id, The id of the servo to check
+ * Retr: True until the calibration has been saved
+**/
+boolean crs_isCalibrating(int id);
+
+/**
+ * Name: crs_stepCalibration()
+ * Desc: Advances every background calibration by one step
+**/
+void crs_stepCalibration();
+
+/**
+ * Name: crs_startHoming(int id)
+ * Desc: Starts homing a servo in the background of the tick scheduler.
+ *       The servo creeps to the trusted section of its pot (if not already
+ *       resting in it), reads its phase within the turn there and puts it
+ *       in whichever turn is nearest to the restored position plus the
+ *       distance crept. The result is saved to EEPROM when done
  * Para: id, The id of the servo to operate on
+ * Retr: False if the servo is already homing or calibrating or there is no
+ *       memory for the thread's state
+ * Note: Corrects a restored position that is stale by up to half a turn
+ *       without calibrating. Nothing else should command the servo until
+ *       crs_isHoming turns false
+**/
+boolean crs_startHoming(int id);
+
+/**
+ * Name: crs_isHoming(int id)
+ * Desc: Determines if a background homing of the servo is running
+ * Para: id, The id of the servo to check
+ * Retr: True until the homed position has been saved
+**/
+boolean crs_isHoming(int id);
+
+/**
+ * Name: crs_stepHoming()
+ * Desc: Advances every background homing by one step
+**/
+void crs_stepHoming();
+
+/**
+ * Name: crs_homeThread_(Pt * pt, int id)
+ * Desc: The homing routine as a protothread, one step per call
+ * Para: pt, The thread's state (homing->pt of the servo)
+ *       id, The id of the servo to operate on
+ * Retr: PT_* result of the step, PT_EXITED if the trusted section was not
+ *       reached within HOMING_TIMEOUT_MS (the restored position is kept,
+ *       moved by the travel seen so far)
  * Note: Should be treated as private member of ContinuousRotationServo
 **/
-void crs_calibrate_(int id);
+char crs_homeThread_(Pt * pt, int id);
+
+/**
+ * Name: crs_readyThread_(Pt * pt, int id)
+ * Desc: Boot task that ends once the servo is calibrated or homed
+ * Para: pt, The task's state
+ *       id, The id of the servo to wait on
+ * Retr: PT_* result of the step
+**/
+char crs_readyThread_(Pt * pt, int id);
 
 /**
  * Name: crs_setVelocity_(int id, int velocity)
- * Desc: Sets the actual velocity the servo should use
+ * Desc: Sets the actual velocity the servo should use, skipping the write
+ *       if the servo is already being sent the same pulse
  * Para: id, The id of the servo to set the velocity for
  *       velocity, The velocity to set this servo to use
 **/
 void crs_setVelocity_(int id, int velocity);
 
+/**
+ * Name: crs_invalidateCommand_(int id)
+ * Desc: Forces the next crs_setVelocity_ to write, used when the
+ *       calibration the cached pulse was converted with changes
+ * Para: id, The id of the servo to operate on
+ * Note: Should be treated as private member of ContinuousRotationServo
+**/
+void crs_invalidateCommand_(int id);
+
+/**
+ * Name: crs_getNumSkippedWrites(int id)
+ * Desc: Get how many velocity commands were dropped as repeats
+ * Para: id, The id of the servo to operate on
+ * Retr: The number of skipped servo writes
+**/
+unsigned long crs_getNumSkippedWrites(int id);
+
 /**
  * Name: crs_correctPos_(int id)
  * Desc: Attempts to correct this servo's position using its pot reading
@@ -274,26 +650,73 @@ void crs_setVelocity_(int id, int velocity);
 void crs_correctPos_(int id);
 
 /**
- * Name: crs_goToLinearSection_(int id)
+ * Name: crs_goToTrustedSection_(Pt * pt, int id)
  * Desc: Have the servo rotate out to the trusted linear section on its pot
- * Para: id, The servo to get there
+ * Para: pt, The thread's state
+ *       id, The servo to get there
+ * Retr: PT_* result of the step
+ * Note: Child thread of calibration, keeps its state in the servo's
+ *       calibration
 **/
-void crs_goToTrustedSection_(int id);
+char crs_goToTrustedSection_(Pt * pt, int id);
 
 /**
- * Name: crs_exhaustMatchingSection_(int id, int minVal, int maxVal)
+ * Name: crs_exhaustMatchingSection_(Pt * pt, int id, int minVal, int maxVal)
  * Desc: Wait until the servo's pot registers a value outside of the given range
- * Para: id, The id of the servo to watch
+ * Para: pt, The thread's state
+ *       id, The id of the servo to watch
  *       minVal, The minimum value in the range to exhaust
  *       maxVal, The maximum value in the range to exhaust
+ * Retr: PT_* result of the step
+ * Note: Child thread of calibration, keeps its state in the servo's
+ *       calibration
+**/
+char crs_exhaustMatchingSection_(Pt * pt, int id, int minVal, int maxVal);
+
+/**
+ * Name: crs_learnTrustedWindow_(int id, int potVal)
+ * Desc: Extends this servo's trusted pot window using monotonic runs of
+ *       readings observed while the servo turns
+ * Para: id, The id of the servo the reading came from
+ *       potVal, The latest raw reading of the servo's pot
+ * Retr: True if the trusted window grew and false otherwise
+ * Note: Should be treated as private member of ContinuousRotationServo
 **/
-void crs_exhaustMatchingSection_(int id, int minVal, int maxVal);
+boolean crs_learnTrustedWindow_(int id, int potVal);
+
+/**
+ * Name: crs_restartLearnRun_(int id, boolean increasing)
+ * Desc: Starts an empty run of readings for crs_learnTrustedWindow_
+ * Para: id, The id of the servo to operate on
+ *       increasing, The direction the next run is expected to go
+ * Note: Should be treated as private member of ContinuousRotationServo
+**/
+void crs_restartLearnRun_(int id, boolean increasing);
+
+/**
+ * Name: crs_isTrustedVal_(int id, int potVal)
+ * Desc: Determines if a pot reading lies in this servo's trusted window
+ * Para: id, The id of the servo the reading came from
+ *       potVal, The raw pot reading to check
+ * Retr: True if the reading can be used to correct position
+ * Note: Should be treated as private member of ContinuousRotationServo
+**/
+boolean crs_isTrustedVal_(int id, int potVal);
 
 // Logic for simple limited rotation servos
 
 typedef struct
 {
   byte controlLine;
+  int angle; // Last angle written to the servo
+  int startAngle;
+  int targetAngle;
+  int slewRate; // deg / sec
+  long moveElapsedMS;
+  long moveDurationMS;
+  boolean moving;
+  unsigned long numSkippedWrites;
+  AxisOwnership ownership;
 } LimitedRotationServo;
 
 // Limited rotation servo behavior
@@ -315,10 +738,73 @@ void lrs_init(int id, byte controlLine);
 
 /**
  * Name: lrs_setAngle(int id, int angle)
- * Desc: Makes this servo rotate to the given angle
+ * Desc: Makes this servo rotate to the given angle immediately, cancelling
+ *       any move in progress
+ * Para: id, The id of the servo to operate on
+ *       angle, The angle to rotate to (degrees)
 **/
 void lrs_setAngle(int id, int angle);
 
+/**
+ * Name: lrs_write_(int id, int angle)
+ * Desc: Writes the angle out to the servo unless it was the last one sent
+ * Para: id, The id of the servo to operate on
+ *       angle, The angle to write (degrees)
+ * Note: Should be treated as private member of LimitedRotationServo
+**/
+void lrs_write_(int id, int angle);
+
+/**
+ * Name: lrs_getNumSkippedWrites(int id)
+ * Desc: Get how many angle commands were dropped as repeats
+ * Para: id, The id of the servo to operate on
+ * Retr: The number of skipped servo writes
+**/
+unsigned long lrs_getNumSkippedWrites(int id);
+
+/**
+ * Name: lrs_startMovingTo(int id, int angle)
+ * Desc: Has this servo ease over to the given angle at its slew rate,
+ *       advanced by lrs_step
+ * Para: id, The id of the servo to operate on
+ *       angle, The angle to move to (degrees)
+**/
+void lrs_startMovingTo(int id, int angle);
+
+/**
+ * Name: lrs_stop(int id)
+ * Desc: Cancels any move in progress, holding the angle reached so far
+ * Para: id, The id of the servo to operate on
+**/
+void lrs_stop(int id);
+
+/**
+ * Name: lrs_setSlewRate(int id, int slewRate)
+ * Desc: Sets the average speed used by lrs_startMovingTo
+ * Para: id, The id of the servo to operate on
+ *       slewRate, Average speed in degrees per second, 0 to jump to
+ *                 targets on the next lrs_step without easing
+**/
+void lrs_setSlewRate(int id, int slewRate);
+
+/**
+ * Name: lrs_isMoving(int id)
+ * Desc: Determines if this servo is still easing to its target
+ * Para: id, The id of the servo to check
+ * Retr: True if a move is in progress
+**/
+boolean lrs_isMoving(int id);
+
+/**
+ * Name: lrs_ease_(long elapsedMS, long durationMS)
+ * Desc: Smoothstep easing of a move's progress in fixed point
+ * Para: elapsedMS, Time since the move started
+ *       durationMS, Total time of the move
+ * Retr: Eased progress, 0 to LRS_EASE_ONE
+ * Note: Should be treated as private member of LimitedRotationServo
+**/
+int lrs_ease_(long elapsedMS, long durationMS);
+
 /**
  * Name: lrs_step(int id, long ms)
  * Desc: Has this limited rotation servo update interal state
@@ -327,11 +813,146 @@ void lrs_setAngle(int id, int angle);
 **/
 void lrs_step(int id, long ms);
 
+// Axis abstraction, one interface for commands, state and completion
+// events over both kinds of servo. Dispatch is a compare on the axis id
+// (see AXIS_IS_LRS), so calls cost no more than calling the servo directly
+
+/**
+ * Name: axis_startMovingTo(int axis, long position)
+ * Desc: Has this axis start moving to the given position
+ * Para: axis, The axis to operate on (AXIS_CRS / AXIS_LRS)
+ *       position, Where to go in the servo's own units (steps for
+ *                 continuous, degrees for limited rotation servos)
+**/
+void axis_startMovingTo(int axis, long position);
+
+/**
+ * Name: axis_startMovingToAngle(int axis, double angle)
+ * Desc: Has this axis start moving to a given angle
+ * Para: axis, The axis to operate on
+ *       angle, The angle to move to in radians
+**/
+void axis_startMovingToAngle(int axis, double angle);
+
+/**
+ * Name: axis_track(int axis, long position)
+ * Desc: Has this axis follow a position that changes a little every step,
+ *       without the easing of axis_startMovingTo restarting each time
+ * Para: axis, The axis to operate on
+ *       position, Where the axis should be now, degrees for limited
+ *                 rotation servos (written straight away) and steps for
+ *                 continuous ones (moved to at their speed)
+**/
+void axis_track(int axis, long position);
+
+/**
+ * Name: axis_setSpeed(int axis, int speed)
+ * Desc: Sets the speed later moves of this axis use
+ * Para: axis, The axis to operate on
+ *       speed, Target velocity for continuous, slew rate (deg / sec) for
+ *              limited rotation servos (0 jumps, see lrs_setSlewRate)
+**/
+void axis_setSpeed(int axis, int speed);
+
+/**
+ * Name: axis_stop(int axis)
+ * Desc: Stops this axis where it is
+ * Para: axis, The axis to operate on
+**/
+void axis_stop(int axis);
+
+/**
+ * Name: axis_getPos(int axis)
+ * Desc: Get the current position of this axis in its servo's own units
+ * Para: axis, The axis to query
+ * Retr: Estimated position, or NONE for a limited rotation servo that
+ *       has not been written yet
+**/
+long axis_getPos(int axis);
+
+/**
+ * Name: axis_isMoving(int axis)
+ * Desc: Determines if this axis is being driven
+ * Para: axis, The axis to query
+**/
+boolean axis_isMoving(int axis);
+
+/**
+ * Name: axis_step(int axis, long ms)
+ * Desc: Advances this axis, raising AXIS_OWNER_GOAL_REACHED on arrival
+ * Para: axis, The axis to operate on
+ *       ms, The number of milliseconds since this was last called
+**/
+void axis_step(int axis, long ms);
+
+/**
+ * Name: axis_stepIfOwnedBy(int axis, int type, int ownerID, long ms)
+ * Desc: Advances this axis only if the given object holds it, so an axis
+ *       lent to another owner is stepped once, by that owner
+ * Para: axis, The axis to operate on
+ *       type, The type of the object stepping it (*_OWNER)
+ *       ownerID, The unique numerical id of the object stepping it
+ *       ms, The number of milliseconds since this was last called
+**/
+void axis_stepIfOwnedBy(int axis, int type, int ownerID, long ms);
+
+/**
+ * Name: axis_reserve(int axis, int type, int ownerID, byte priority)
+ * Desc: Reserves this axis for an owner, whose axisOwnerCallbacks then
+ *       receive its events. A higher priority preempts the current
+ *       owner, which is told and gets the axis back when it is released
+ * Para: axis, The axis to reserve
+ *       type, The type of the object reserving it (*_OWNER)
+ *       ownerID, The unique numerical id of the object reserving it
+ *       priority, Priority of the reservation (*_PRIORITY)
+ * Retr: True if the owner now holds the axis, false if someone of equal
+ *       or higher priority does
+ * Note: Preemption stops the axis. Only one preempted owner is kept, so
+ *       preempting twice leaves the first owner waiting for good
+**/
+boolean axis_reserve(int axis, int type, int ownerID, byte priority);
+
+/**
+ * Name: axis_release(int axis, int type, int ownerID)
+ * Desc: Gives up a reservation. Releasing the current owner stops the
+ *       axis and hands it back to the owner it preempted, if any
+ * Para: axis, The axis to release
+ *       type, The type of the releasing object
+ *       ownerID, The unique numerical id of the releasing object
+**/
+void axis_release(int axis, int type, int ownerID);
+
+/**
+ * Name: axis_isOwnedBy(int axis, int type, int ownerID)
+ * Desc: Determines if an object currently holds this axis
+ * Para: axis, The axis to check
+ *       type, The type of the object
+ *       ownerID, The unique numerical id of the object
+**/
+boolean axis_isOwnedBy(int axis, int type, int ownerID);
+
+/**
+ * Name: axis_getOwnership_(int axis)
+ * Desc: Get the reservations kept in this axis' servo
+ * Note: Should be treated as private member of the axis abstraction
+**/
+AxisOwnership * axis_getOwnership_(int axis);
+
+/**
+ * Name: axis_notifyOwner_(AxisReservation owner, byte event, int axis)
+ * Desc: Calls the owner's callback for an event, if it has one
+ * Para: owner, The reservation to notify, nothing happens for NONE
+ *       event, Which callback (AXIS_OWNER_*)
+ *       axis, The axis the event is about
+ * Note: Should be treated as private member of the axis abstraction
+**/
+void axis_notifyOwner_(AxisReservation owner, byte event, int axis);
+
 // Piezo sensor abstraction
 typedef struct
 {
   byte line;
-  int fired;
+  volatile int fired; // May be raised from an interrupt, see piezo_isFired
 } PiezoSensor;
 
 // Piezo sensor behavior
@@ -374,6 +995,10 @@ typedef struct
 {
   byte line;
   boolean isLight;
+  int baseline; // Mean reading at boot
+  long baselineSum; // Baseline thread state from here on
+  byte baselineSamples;
+  unsigned long baselineWaitStartUS;
 } LightSensor;
 
 // Light sensor behavior
@@ -403,11 +1028,33 @@ void ls_init(int id, byte line);
 **/
 boolean ls_isLight(int id);
 
+/**
+ * Name: ls_baselineThread_(Pt * pt, int id)
+ * Desc: Boot task averaging LS_BASELINE_SAMPLES readings into the
+ *       sensor's baseline and starting light / dark state, so one noisy
+ *       reading at power on does not decide it
+ * Para: pt, The task's state
+ *       id, The unique numerical id of the light sensor
+ * Retr: PT_* result of the step
+**/
+char ls_baselineThread_(Pt * pt, int id);
+
 // LED abstraction
 
 typedef struct
 {
   byte line;
+  volatile uint8_t * outReg; // Resolved from line at init (see fastio.h)
+  byte outMask;
+  boolean hasPWM;
+  int bamChannel; // NONE unless dimmed by bit angle modulation
+  int brightness; // Perceptual, before gamma correction
+  int output; // Gamma corrected value last sent to the line
+  byte animation;
+  int animFrom;
+  int animTo;
+  long animElapsedMS;
+  long animDurationMS; // Fade duration or pulse period
 } LEDAbstraction;
 
 // LED abstraction behavior
@@ -444,14 +1091,154 @@ void led_turnOn(int id);
 **/
 void led_turnOff(int id);
 
+/**
+ * Name: led_setBrightness(int id, int brightness)
+ * Desc: Sets the LED's brightness immediately, stopping any animation
+ * Para: id, The unique numerical id of the LED to operate on
+ *       brightness, Perceptual brightness (0 - LED_MAX_BRIGHTNESS)
+**/
+void led_setBrightness(int id, int brightness);
+
+/**
+ * Name: led_fadeTo(int id, int brightness, long durationMS)
+ * Desc: Fades linearly (in perceptual brightness) to the given level
+ * Para: id, The unique numerical id of the LED to operate on
+ *       brightness, The brightness to end at
+ *       durationMS, How long the fade should take
+**/
+void led_fadeTo(int id, int brightness, long durationMS);
+
+/**
+ * Name: led_pulse(int id, int minBrightness, int maxBrightness, long periodMS)
+ * Desc: Has the LED breathe between two levels until told otherwise
+ * Para: id, The unique numerical id of the LED to operate on
+ *       minBrightness, The dimmest level of the pulse
+ *       maxBrightness, The brightest level of the pulse
+ *       periodMS, The time for one full breath
+**/
+void led_pulse(int id, int minBrightness, int maxBrightness, long periodMS);
+
+/**
+ * Name: led_isAnimating(int id)
+ * Desc: Determines if a fade or pulse is in progress
+ * Para: id, The unique numerical id of the LED to check
+ * Retr: True if led_step still has work to do
+**/
+boolean led_isAnimating(int id);
+
+/**
+ * Name: led_step(int id, long ms)
+ * Desc: Advances this LED's animation
+ * Para: id, The unique numerical id of the LED to operate on
+ *       ms, The number of milliseconds since this was last called
+**/
+void led_step(int id, long ms);
+
+/**
+ * Name: led_write_(int id, int brightness)
+ * Desc: Gamma corrects the brightness and sends it to the line if the
+ *       output actually changes
+ * Para: id, The unique numerical id of the LED to operate on
+ *       brightness, Perceptual brightness (0 - LED_MAX_BRIGHTNESS)
+ * Note: Should be treated as private member of LEDAbstraction
+**/
+void led_write_(int id, int brightness);
+
+// Bit angle modulation driver
+//
+// Dims any number of LEDs on lines without hardware PWM. Each LED's level
+// is split into bit planes, one byte per port per plane, and a single
+// Timer2 interrupt writes a whole port per plane, holding plane b for
+// 2^b time units. The interrupt is taken 8 times per frame whatever the
+// LED count, and its cost grows with the number of ports in use, not with
+// the number of LEDs on them.
+
+typedef struct
+{
+  volatile uint8_t * port;
+  byte mask; // Lines on this port owned by the driver
+  byte planes[BAM_BITS];
+} BamPort;
+
+typedef struct
+{
+  byte line;
+  byte portIndex;
+  byte mask;
+  byte level;
+} BamChannel;
+
+/**
+ * Name: bam_init()
+ * Desc: Clears the channel and port tables (the timer starts with the
+ *       first channel)
+**/
+void bam_init();
+
+/**
+ * Name: bam_addChannel(byte line)
+ * Desc: Hands a line over to the driver, starting dark
+ * Para: line, The digital line to dim
+ * Retr: The channel id for bam_setLevel or NONE if the tables are full
+**/
+int bam_addChannel(byte line);
+
+/**
+ * Name: bam_setLevel(int id, byte level)
+ * Desc: Sets the duty of a channel, taking effect from the next plane
+ * Para: id, The channel returned by bam_addChannel
+ *       level, Duty cycle (0 - 255), already gamma corrected
+**/
+void bam_setLevel(int id, byte level);
+
+/**
+ * Name: bam_usesPin(byte line)
+ * Desc: Determines if the given line's hardware PWM shares the BAM timer
+ * Para: line, The line to check
+ * Retr: True if analogWrite on this line would fight the driver
+**/
+boolean bam_usesPin(byte line);
+
+/**
+ * Name: bam_onTimer_()
+ * Desc: Shows the next bit plane on every port and schedules the one after
+ * Note: Called from the Timer2 compare interrupt, should be treated as
+ *       private member of the driver
+**/
+void bam_onTimer_();
+
+/**
+ * Name: bam_startTimer_()
+ * Desc: Puts Timer2 in CTC mode and enables its compare interrupt
+ * Note: Should be treated as private member of the driver
+**/
+void bam_startTimer_();
+
+/**
+ * Name: bam_benchmark()
+ * Desc: Reports over Serial how much CPU the BAM interrupt takes as more
+ *       channels are added, by comparing busy loop throughput with the
+ *       timer off and on
+**/
+void bam_benchmark();
+
 // Jellyfish abstraction
 
 typedef struct
 {
-  int servoNum;
+  int axis;
   int ledNum;
+  boolean lowered;
+  boolean waving; // Settled in view and following the wave
+  byte phaseOffset; // 256ths of a wave behind the shared phase
 } Jellyfish;
 
+typedef struct
+{
+  unsigned long phase; // 2^32 to the wave, wraps
+  int numJellyfish; // Initialized, so stepped by jellyfish_stepAll
+} JellyfishWave;
+
 /**
  * Name: jellyfish_getInstance(int id)
  * Desc: Gets the jellyfish instance corresponding to
@@ -463,30 +1250,42 @@ typedef struct
 Jellyfish * jellyfish_getInstance(int id);
 
 /**
- * Name: jellyfish_init(int id, int servoNum, int ledNum)
+ * Name: jellyfish_init(int id, int axis, int ledNum)
  * Desc: Initalize state of given jellyfish
  * Para: id, The unqiue numerical id of the jellyfish to initalize
- *       servoNum, The unique numerical id of the limited roatation
- *                 servo controlling this jellyfish
+ *       axis, The axis raising and lowering this jellyfish, angles are
+ *             JELLYFISH_*_ANGLE (degrees) so normally AXIS_LRS
  *       ledNum, The unique numerical id of the LED inside of this
  *               jellyfish
 **/
-void jellyfish_init(int id, int servoNum, int ledNum);
+void jellyfish_init(int id, int axis, int ledNum);
 
 /**
  * Name: jellyfish_lower(int id)
- * Desc: Lower this jellyfish into view and turn on its led
+ * Desc: Lower this jellyfish into view and turn on its led. Reserves the
+ *       jellyfish's axis at JELLYFISH_PRIORITY, preempting a fish sharing
+ *       it, until the jellyfish is raised again
  * Para: id, The unique numerical id of the jellyfish to lower
 **/
 void jellyfish_lower(int id);
 
 /**
  * Name: jellyfish_raise(int id)
- * Desc: Raise this jellyfish out of view and turn of its led
+ * Desc: Raise this jellyfish out of view and turn of its led. The axis is
+ *       released once it is up
  * Para: id, The unique numerical id of the jellyfish to raise
 **/
 void jellyfish_raise(int id);
 
+/**
+ * Name: jellyfish_onServoGoalReached(int id, int axis)
+ * Desc: Event handler for when a jellyfish's axis reaches its goal, gives
+ *       the axis up once the jellyfish is out of view
+ * Para: id, The id of the jellyfish whose axis has reached a goal
+ *       axis, The axis that reached its goal
+**/
+void jellyfish_onServoGoalReached(int id, int axis);
+
 /**
  * Name: jellyfish_step(int id, long ms)
  * Desc: Propogate the on step event to this jellyfish and its servos
@@ -495,18 +1294,155 @@ void jellyfish_raise(int id);
 **/
 void jellyfish_step(int id, long ms);
 
+/**
+ * Name: jellyfish_stepAll(long ms)
+ * Desc: Advances the shared wave phase once, then steps every jellyfish
+ * Para: ms, The number of milliseconds since this function was last called
+**/
+void jellyfish_stepAll(long ms);
+
+/**
+ * Name: jellyfish_setPhaseOffset(int id, byte phaseOffset)
+ * Desc: Sets how far behind the shared wave a jellyfish bobs. jellyfish_init
+ *       spreads NUM_JELLYFISH jellyfish evenly over one wave
+ * Para: id, The unique numerical id of the jellyfish to operate on
+ *       phaseOffset, 256ths of a wave
+**/
+void jellyfish_setPhaseOffset(int id, byte phaseOffset);
+
+/**
+ * Name: jellyfish_getWave_(int id, long aheadMS)
+ * Desc: Looks up where in its wave a jellyfish is
+ * Para: id, The unique numerical id of the jellyfish to operate on
+ *       aheadMS, How far in the future to look
+ * Retr: 0 at the trough to 255 at the crest
+ * Note: Should be treated as private member of Jellyfish
+**/
+int jellyfish_getWave_(int id, long aheadMS);
+
+/**
+ * Name: jellyfish_benchmark()
+ * Desc: Reports over Serial the time jellyfish_stepAll takes per step for
+ *       one jellyfish up to NUM_JELLYFISH, all of them waving
+**/
+void jellyfish_benchmark();
+
+// Occupancy grid, where the decorations are in the tank
+
+typedef struct
+{
+  long x;
+  long y;
+  long z;
+} OgPoint;
+
+/**
+ * Name: og_isBlocked(const OgPoint * point)
+ * Desc: Determines if a point is inside a decoration
+ * Para: point, The point (positions outside the tank count as on its wall)
+**/
+boolean og_isBlocked(const OgPoint * point);
+
+/**
+ * Name: og_isSegmentClear(const OgPoint * from, const OgPoint * to)
+ * Desc: Determines if a straight move misses every decoration, walking
+ *       the grid cells the segment passes through in integer math
+ * Para: from, Where the move starts
+ *       to, Where the move ends
+ * Retr: True if no cell on the way is occupied
+ * Note: Visits at most OG_CELLS_X + OG_CELLS_Y + OG_CELLS_Z - 2 cells.
+ *       Ends are rounded to 1 / OG_SUBCELLS of a cell, so a move grazing
+ *       a corner closer than that may go either way
+**/
+boolean og_isSegmentClear(const OgPoint * from, const OgPoint * to);
+
+/**
+ * Name: og_findDetour(const OgPoint * from, const OgPoint * to, OgPoint * waypoint)
+ * Desc: Splits a blocked move in two, looking for a waypoint beside the
+ *       middle of the segment that both halves reach in a straight line
+ * Para: from, Where the move starts
+ *       to, Where the move ends
+ *       waypoint, Set to the waypoint if one is found
+ * Retr: False if no waypoint within OG_MAX_DETOUR_CELLS works
+ * Note: Tries over first, then around, then under, testing at most
+ *       OG_NUM_DETOUR_DIRECTIONS * OG_MAX_DETOUR_CELLS waypoints
+**/
+boolean og_findDetour(const OgPoint * from, const OgPoint * to, OgPoint * waypoint);
+
+/**
+ * Name: og_toGrid_(const OgPoint * point, long * fixed)
+ * Desc: Converts a point to fixed point cell coordinates, clamped to the
+ *       tank
+ * Para: point, The point to convert
+ *       fixed, Set to x, y and z in cells times OG_SUBCELLS
+ * Note: Should be treated as private member of the occupancy grid
+**/
+void og_toGrid_(const OgPoint * point, long * fixed);
+
+/**
+ * Name: og_isCellBlocked_(int cellX, int cellY, int cellZ)
+ * Desc: Reads a cell's bit from occupancyGrid
+ * Note: Should be treated as private member of the occupancy grid
+**/
+boolean og_isCellBlocked_(int cellX, int cellY, int cellZ);
+
+// Route table, collision free paths between anchors worked out off the board
+
+/**
+ * Name: route_getAnchor(int anchor, OgPoint * point)
+ * Desc: Get where an anchor is, the middle of its cell
+ * Para: anchor, ROUTE_ANCHOR_*
+ *       point, Set to the anchor's position
+**/
+void route_getAnchor(int anchor, OgPoint * point);
+
+/**
+ * Name: route_getLength(int fromAnchor, int toAnchor)
+ * Desc: Get how many waypoints there are between two anchors
+ * Para: fromAnchor, ROUTE_ANCHOR_* the route starts at
+ *       toAnchor, ROUTE_ANCHOR_* the route ends at
+ * Retr: Number of waypoints, not counting either anchor. Every leg from
+ *       fromAnchor through the waypoints to toAnchor passes og_isSegmentClear
+**/
+int route_getLength(int fromAnchor, int toAnchor);
+
+/**
+ * Name: route_getWaypoint(int fromAnchor, int toAnchor, int index, OgPoint * point)
+ * Desc: Get one waypoint of a route, in constant time
+ * Para: fromAnchor, ROUTE_ANCHOR_* the route starts at
+ *       toAnchor, ROUTE_ANCHOR_* the route ends at
+ *       index, Which waypoint, less than route_getLength
+ *       point, Set to the middle of the waypoint's cell
+**/
+void route_getWaypoint(int fromAnchor, int toAnchor, int index, OgPoint * point);
+
+/**
+ * Name: route_getCellCentre_(int cellX, int cellY, int cellZ, OgPoint * point)
+ * Desc: Get the middle of a grid cell
+ * Note: Should be treated as private member of the route table
+**/
+void route_getCellCentre_(int cellX, int cellY, int cellZ, OgPoint * point);
+
 // Fish abstraction
 
 typedef struct
 {
-  int xServo;
-  int yServo;
-  int zServo;
-  int thetaServo;
+  int xAxis;
+  int yAxis;
+  int zAxis;
+  int thetaAxis;
   int velocity;
   long targetX;
   long targetY;
   long targetZ;
+  long legX; // Where the axes are headed, a detour waypoint or the target
+  long legY;
+  long legZ;
+  boolean detouring;
+  int anchor; // ROUTE_ANCHOR_* the fish is resting at, NONE if elsewhere
+  int routeFrom; // Route being followed, NONE if planned on the board
+  int routeTo; // Anchor being headed for, NONE if none
+  int routeIndex; // Waypoint being headed for, the route's length for routeTo
   long startX;
   long startY;
   long startZ;
@@ -530,19 +1466,22 @@ typedef struct
 Fish * fish_getInstance(int id);
 
 /**
- * Name: fish_init(int id, int xServoNum, int yServoNum, int zServoNum, int thetaServo, boolean calibrate)
- * Desc: Initalizes the state of a fish
+ * Name: fish_init(int id, int xAxis, int yAxis, int zAxis, int thetaAxis)
+ * Desc: Initalizes the state of a fish, reserving its axes
  * Para: id, The unique numerical id of the instance to initalize
- *       xServoNum, ID of continuous rotation servo on x axis
- *       yServoNum, ID of continuous rotation servo on y axis
- *       zServoNum, ID of continuous rotation servo on z axis
- *       thetaServo, ID of the servo rotating this fish
+ *       xAxis, Axis moving the fish along x (AXIS_CRS / AXIS_LRS)
+ *       yAxis, Axis moving the fish along y
+ *       zAxis, Axis moving the fish along z
+ *       thetaAxis, Axis rotating this fish
+ * Note: Does not move the fish, boot_fishThread_ sends it home once its
+ *       servos are calibrated
 **/
-void fish_init(int id, int xServoNum, int yServoNum, int zServoNum, int thetaServo);
+void fish_init(int id, int xAxis, int yAxis, int zAxis, int thetaAxis);
 
 /**
  * Name: fish_goTo(long id, long x, long y, long z)
- * Desc: Has the fish go to the given position
+ * Desc: Has the fish go to the given position, by way of a detour
+ *       waypoint if a decoration is in the way (see og_findDetour)
  * Para: id, The id of the fish to move
  *       x, The x position to take this fish to
  *       y, The y position to take this fish to
@@ -550,6 +1489,15 @@ void fish_init(int id, int xServoNum, int yServoNum, int zServoNum, int thetaSer
 **/
 void fish_goTo(long id, long x, long y, long z);
 
+/**
+ * Name: fish_goToAnchor(int id, int anchor)
+ * Desc: Has the fish go to an anchor, following the route table if it is
+ *       resting at another anchor and planning with fish_goTo otherwise
+ * Para: id, The id of the fish to move
+ *       anchor, The ROUTE_ANCHOR_* to take this fish to
+**/
+void fish_goToAnchor(int id, int anchor);
+
 /**
  * Name: fish_onGoalReached(int id)
  * Desc: Event handler for when a fish reaches its goal position
@@ -560,12 +1508,49 @@ void fish_onGoalReached(int id);
 void fish_stop(int id);
 
 /**
- * Name: fish_onServoGoalReached(int id, int servoID)
- * Desc: Event handler for when a servo for a fish reaches its goal
- * Para: id, The id of the fish whose servo has reached a goal
- *       servoID, The id of the servo that reached its goal
+ * Name: fish_startLeg_(int id, long x, long y, long z)
+ * Desc: Sends the fish's axes off towards a point
+ * Para: id, The unique numerical id of the fish to operate on
+ *       x, y, z, The point to head to
+ * Note: Should be treated as a private member of Fish
+**/
+void fish_startLeg_(int id, long x, long y, long z);
+
+/**
+ * Name: fish_moveAxis_(int id, int axis, long position)
+ * Desc: Sends one of the fish's axes off at the fish's velocity, unless it
+ *       has been preempted (fish_onServoReturned sends it on later)
+ * Para: id, The unique numerical id of the fish to operate on
+ *       axis, The fish's axis to move
+ *       position, Where to send it
+ * Note: Should be treated as a private member of Fish
 **/
-void fish_onServoGoalReached(int id, int servoID);
+void fish_moveAxis_(int id, int axis, long position);
+
+/**
+ * Name: fish_followRoute_(int id)
+ * Desc: Sends the fish on to the next waypoint of its route, or to the
+ *       route's anchor after the last one
+ * Note: Should be treated as a private member of Fish
+**/
+void fish_followRoute_(int id);
+
+/**
+ * Name: fish_onServoGoalReached(int id, int axis)
+ * Desc: Event handler for when an axis of a fish reaches its goal
+ * Para: id, The id of the fish whose axis has reached a goal
+ *       axis, The axis that reached its goal
+**/
+void fish_onServoGoalReached(int id, int axis);
+
+/**
+ * Name: fish_onServoReturned(int id, int axis)
+ * Desc: Event handler for when an axis preempted from a fish is released
+ *       back to it, sends the axis on to the fish's current goal
+ * Para: id, The id of the fish getting the axis back
+ *       axis, The axis returned
+**/
+void fish_onServoReturned(int id, int axis);
 
 /**
  * Name: fish_goToNextInternalGoal_(int id)
@@ -656,6 +1641,22 @@ void psg_onTick(int id);
 
 // Aquarium abstraction
 
+typedef struct
+{
+  byte nextState;
+  byte action;
+} AquariumTransition;
+
+typedef struct
+{
+  unsigned long ms;
+  byte fromState;
+  byte event;
+  byte toState;
+} AquariumTraceEntry;
+
+typedef void (*AquariumAction)(int id);
+
 typedef struct
 {
   int fishNum;
@@ -666,6 +1667,17 @@ typedef struct
   long lastMS;
   long shortMSRemain;
   long longMSRemain;
+  byte state;
+  int lastTappedSensor;
+  boolean tapFiltering;
+  int fleeAnchor; // ROUTE_ANCHOR_* corner fled to or NONE
+  unsigned long lastTapMS;
+  unsigned long fleeStartMS;
+  unsigned long numTaps;
+  unsigned long numTapsDropped;
+  AquariumTraceEntry trace[AQ_TRACE_LENGTH];
+  byte traceNext;
+  unsigned long numTransitions;
 } Aquarium;
 
 /**
@@ -725,6 +1737,95 @@ void aquarium_tick(int id, long ms);
 **/
 void aquarium_onFishReachedGoal(int id, int fishID);
 
+/**
+ * Name: aquarium_dispatch_(int id, byte event)
+ * Desc: Looks up the transition for the current state and event, runs its
+ *       action and records it in the trace
+ * Para: id, The id of the aquarium to operate on
+ *       event, AQ_EVENT_* constant describing what happened
+ * Note: Should be treated as private member of Aquarium
+**/
+void aquarium_dispatch_(int id, byte event);
+
+/**
+ * Name: aquarium_acceptTap_(int id, int tappedSensor)
+ * Desc: Decides if a tap should reach the state machine. While the fish
+ *       is fleeing, taps inside the coalescing window of the last accepted
+ *       tap are merged into it, taps asking for the flee already under way
+ *       are dropped and taps asking for another corner wait out a holdoff
+ * Para: id, The id of the aquarium to operate on
+ *       tappedSensor, The high level id of the sensor that was fired
+ * Retr: True if the tap should be dispatched
+ * Note: Should be treated as private member of Aquarium
+**/
+boolean aquarium_acceptTap_(int id, int tappedSensor);
+
+/**
+ * Name: aquarium_getFleeAnchor_(int tappedSensor)
+ * Desc: Get the corner the fish runs to when the given sensor fires, the
+ *       one diagonally across the tank from it
+ * Para: tappedSensor, The high level id of the sensor that was fired
+ * Retr: ROUTE_ANCHOR_* flee corner or NONE
+ * Note: Should be treated as private member of Aquarium
+**/
+int aquarium_getFleeAnchor_(int tappedSensor);
+
+/**
+ * Name: aquarium_setTapFiltering(int id, boolean enabled)
+ * Desc: Turns tap coalescing and flee hysteresis on or off
+ * Para: id, The id of the aquarium to operate on
+ *       enabled, False to dispatch every tap (as before filtering existed)
+**/
+void aquarium_setTapFiltering(int id, boolean enabled);
+
+/**
+ * Name: aquarium_getState(int id)
+ * Desc: Get the current behavioral state of the aquarium
+ * Para: id, The id of the aquarium to check
+ * Retr: AQ_STATE_* constant
+**/
+byte aquarium_getState(int id);
+
+/**
+ * Name: aquarium_printTrace(int id)
+ * Desc: Writes the recent transitions, oldest first, over Serial as
+ *       "ms: from -event-> to" lines
+ * Para: id, The id of the aquarium whose trace should be printed
+**/
+void aquarium_printTrace(int id);
+
+/**
+ * Name: aquarium_continuePatrol_(int id)
+ * Desc: Send the fish on to the next point of its patrol
+ * Para: id, The id of the aquarium to operate on
+ * Note: Should be treated as private member of Aquarium
+**/
+void aquarium_continuePatrol_(int id);
+
+/**
+ * Name: aquarium_flee_(int id)
+ * Desc: Send the fish away from the most recently tapped sensor
+ * Para: id, The id of the aquarium to operate on
+ * Note: Should be treated as private member of Aquarium
+**/
+void aquarium_flee_(int id);
+
+/**
+ * Name: aquarium_stopFish_(int id)
+ * Desc: Stop the fish where it is
+ * Para: id, The id of the aquarium to operate on
+ * Note: Should be treated as private member of Aquarium
+**/
+void aquarium_stopFish_(int id);
+
+/**
+ * Name: aquarium_doNothing_(int id)
+ * Desc: Action for transitions that only change (or keep) the state
+ * Para: id, The id of the aquarium to operate on
+ * Note: Should be treated as private member of Aquarium
+**/
+void aquarium_doNothing_(int id);
+
 /**
  * Name: aquarium_onFishReachedGoal_(int id, int fishID)
  * Desc: Event handler for when a fish reaches its goal position
@@ -783,3 +1884,270 @@ long aquarium_getXBoundInDirection_(int id, int direction);
  * Retr: Extreme y position in direction
 **/
 long aquarium_getYBoundInDirection_(int id, int direction);
+
+// Flight recorder
+//
+// Keeps the last FR_LENGTH control events as compact binary records in a
+// ring that overwrites the oldest. The ring lives outside the zeroed data
+// section, so after a watchdog (or button) reset it still holds what led
+// up to it. Servo velocity writes and pot corrections come many times a
+// second, so only the newest of each per servo is kept, in trace slots
+// beside the ring, and they never push taps or transitions out of it.
+
+typedef struct
+{
+  unsigned int ms; // Low 16 bits of millis
+  byte event;
+  byte id;
+  int arg;
+} FlightRecord;
+
+typedef struct
+{
+  unsigned int magic; // FR_MAGIC once the fields below can be trusted
+  byte next;
+  byte count;
+  FlightRecord records[FR_LENGTH];
+  FlightRecord traces[FR_NUM_TRACES]; // event FR_NO_EVENT while empty
+} FlightRecorder;
+
+/**
+ * Name: fr_init()
+ * Desc: Keeps the records from before the reset if they are intact,
+ *       dumps them if the watchdog caused the reset, and records the boot
+ * Note: Must run before anything else is recorded. The Optiboot bootloader
+ *       clears MCUSR before the sketch starts, so watchdog resets are only
+ *       recognized on boards without it
+**/
+void fr_init();
+
+/**
+ * Name: fr_record(byte event, byte id, int arg)
+ * Desc: Appends a record, overwriting the oldest once the ring is full.
+ *       FR_EVENT_VELOCITY and FR_EVENT_CORRECTION replace the servo's
+ *       previous one in its trace slot instead
+ * Para: event, The FR_EVENT_* being recorded
+ *       id, The id of the object the event happened to
+ *       arg, Event specific value (see FR_EVENT_*)
+**/
+void fr_record(byte event, byte id, int arg);
+
+/**
+ * Name: fr_getTrace_(byte event, byte id)
+ * Desc: Get the trace slot of a servo event
+ * Retr: The slot or NULL if the event is kept in the ring
+ * Note: Should be treated as private member of the flight recorder
+**/
+FlightRecord * fr_getTrace_(byte event, byte id);
+
+/**
+ * Name: fr_dump()
+ * Desc: Writes every record, ring and traces merged oldest first, to
+ *       Serial as one "ms event id arg" line each
+**/
+void fr_dump();
+
+/**
+ * Name: fr_print_(FlightRecord * record)
+ * Desc: Writes one record as a fr_dump line
+ * Note: Should be treated as private member of the flight recorder
+**/
+void fr_print_(FlightRecord * record);
+
+/**
+ * Name: fr_startWatchdog()
+ * Desc: Arms the watchdog if FR_WATCHDOG is defined
+ * Note: Called at the end of setup, the boot graph after it runs one
+ *       step per loop and so feeds the watchdog as it goes
+**/
+void fr_startWatchdog();
+
+/**
+ * Name: fr_poll()
+ * Desc: Feeds the watchdog, should be called once per loop
+ * Note: FR_DUMP_COMMAND is picked up from Serial by cs_poll
+**/
+void fr_poll();
+
+// Clock sync
+//
+// Lets several boards, each on its own serial line, act on a shared
+// timeline kept by a host master (see host/clock_master.cpp). The master
+// does all the estimation: it stamps sync frames on its own clock, each
+// board answers with when it read the frame and when it started the
+// reply, and the master sends back the offset and skew that map the
+// board's micros onto the shared timeline. Boards only keep that mapping
+// and a short queue of commands waiting for their shared start time.
+// From the first frame for it on, a board drops its debug text
+// (DEBUG_PRINT), so a reply never waits behind it in the transmit buffer
+
+typedef struct
+{
+  unsigned long atUs; // Shared time to run at
+  char type; // CS_FRAME_FISH_GOTO or CS_FRAME_JELLYFISH
+  long args[CS_MAX_ARGS - 1];
+} CsScheduledCommand;
+
+typedef struct
+{
+  byte address;
+  boolean active; // A frame for this board has arrived, debug text is off
+  char frame[CS_FRAME_LENGTH];
+  byte frameLength;
+  boolean inFrame;
+  unsigned long frameStartUs; // Local micros when CS_FRAME_START was read
+  boolean synced;
+  unsigned long refUs; // Local micros the offset was measured at
+  long offsetUs;
+  long skewPpm;
+  CsScheduledCommand scheduled[CS_MAX_SCHEDULED];
+  byte numScheduled;
+} ClockSync;
+
+/**
+ * Name: cs_init()
+ * Desc: Loads the bus address from EEPROM, with no timeline yet
+**/
+void cs_init();
+
+/**
+ * Name: cs_setAddress(byte address)
+ * Desc: Changes and persists the address this board answers to
+ * Para: address, The new address (not CS_BROADCAST_ADDRESS)
+**/
+void cs_setAddress(byte address);
+
+/**
+ * Name: cs_isSynced()
+ * Desc: Determines if the master has sent this board a timeline yet
+ * Retr: True if cs_getSharedMicros can be trusted
+**/
+boolean cs_isSynced();
+
+/**
+ * Name: cs_isActive()
+ * Desc: Determines if a master is talking to this board
+ * Retr: True once a frame for this board (or broadcast) has arrived,
+ *       until the next reset
+**/
+boolean cs_isActive();
+
+/**
+ * Name: cs_getSharedMicros()
+ * Desc: Get the current time on the shared timeline
+ * Retr: Shared microseconds, wrapping like micros()
+**/
+unsigned long cs_getSharedMicros();
+
+/**
+ * Name: cs_poll()
+ * Desc: Reads Serial, answering sync frames and queueing commands, and
+ *       runs queued commands whose time has come once boot is done.
+ *       FR_DUMP_COMMAND outside a frame dumps the flight recorder. Should
+ *       be called once per loop
+**/
+void cs_poll();
+
+/**
+ * Name: cs_onFrame_(unsigned long receivedUs)
+ * Desc: Acts on the complete frame in the buffer
+ * Para: receivedUs, Local micros when the frame started arriving
+ * Note: Should be treated as private member of ClockSync
+**/
+void cs_onFrame_(unsigned long receivedUs);
+
+/**
+ * Name: cs_reply_(long seq, unsigned long receivedUs)
+ * Desc: Answers a sync frame, stamping the reply as it starts to go out
+ * Para: seq, The sequence number of the sync frame
+ *       receivedUs, Local micros when the sync frame started arriving
+ * Note: Should be treated as private member of ClockSync
+**/
+void cs_reply_(long seq, unsigned long receivedUs);
+
+/**
+ * Name: cs_schedule_(char type, long * args)
+ * Desc: Queues a command for its shared start time
+ * Para: type, CS_FRAME_FISH_GOTO or CS_FRAME_JELLYFISH
+ *       args, The frame arguments, shared start time first
+ * Retr: False if the queue is full
+ * Note: Should be treated as private member of ClockSync
+**/
+boolean cs_schedule_(char type, long * args);
+
+/**
+ * Name: cs_runDue_()
+ * Desc: Runs and removes queued commands whose time has come
+ * Note: Should be treated as private member of ClockSync
+**/
+void cs_runDue_();
+
+// Boot sequence
+//
+// setup() only configures pins and state; everything that takes time
+// (calibrating servos, baselining sensors, homing) runs afterwards as boot
+// tasks stepped from loop(). The tasks and the order between them are a
+// dependency graph in the bootTasks table: a task starts once every task in
+// its after mask has ended, and tasks that have started run side by side.
+// The aquarium starts ticking when the last task ends.
+
+typedef char (*BootThread)(Pt * pt, int arg);
+
+typedef struct
+{
+  BootThread thread;
+  byte arg; // Passed to the thread, eg. the servo id
+  byte after; // BOOT_AFTER of each task that must end first
+} BootTask;
+
+typedef struct
+{
+  Pt pts[NUM_BOOT_TASKS];
+  byte done; // BOOT_AFTER of each task that has ended
+  unsigned long readyMS; // millis when the last task ended
+} Boot;
+
+/**
+ * Name: boot_init()
+ * Desc: Makes every boot task ready to start
+**/
+void boot_init();
+
+/**
+ * Name: boot_step()
+ * Desc: Runs each boot task whose dependencies have ended once, along
+ *       with background servo calibration and homing
+**/
+void boot_step();
+
+/**
+ * Name: boot_isReady()
+ * Desc: Determines if every boot task has ended
+ * Retr: True once the aquarium can start ticking
+**/
+boolean boot_isReady();
+
+/**
+ * Name: boot_getReadyMS()
+ * Desc: Get how long boot took
+ * Retr: millis when the last boot task ended, 0 until then
+**/
+unsigned long boot_getReadyMS();
+
+/**
+ * Name: boot_fishThread_(Pt * pt, int id)
+ * Desc: Boot task sending the fish home once its servos know where they are
+ * Para: pt, The task's state
+ *       id, The unique numerical id of the fish
+ * Retr: PT_* result of the step
+**/
+char boot_fishThread_(Pt * pt, int id);
+
+/**
+ * Name: boot_aquariumThread_(Pt * pt, int id)
+ * Desc: Boot task starting the aquarium and its opening swim
+ * Para: pt, The task's state
+ *       id, The unique numerical id of the aquarium
+ * Retr: PT_* result of the step
+**/
+char boot_aquariumThread_(Pt * pt, int id);
@@ -1,7 +1,13 @@
 #include "aquariumlogic.h"
+#include "aquarium_routes.h"
+#include "fastio.h"
 #include <Servo.h>
 #include <EEPROM.h>
 
+#if defined(__AVR__)
+#include <avr/wdt.h>
+#endif
+
 Servo globalServos[NUM_LIM_ROT_SERVOS + NUM_CONT_ROT_SERVOS]; // Shared limited resource servo instance
 
 ContinuousRotationServo contRotServos[NUM_CONT_ROT_SERVOS];
@@ -10,24 +16,180 @@ PiezoSensor piezoSensors[NUM_PIEZO_SENSORS];
 LightSensor lightSensors[NUM_LIGHT_SENSORS];
 LEDAbstraction leds[NUM_LED];
 Jellyfish jellyfish[NUM_JELLYFISH];
+JellyfishWave jellyfishWave;
 Fish fish[NUM_FISH];
 PiezoSensorGroup piezoSensorGroups[NUM_PIEZO_SENSOR_GROUPS];
 Aquarium aquariums[NUM_AQUARIUMS];
+BamPort bamPorts[BAM_MAX_PORTS];
+BamChannel bamChannels[BAM_MAX_CHANNELS];
+volatile byte bamNumPorts;
+byte bamNumChannels;
+volatile byte bamBit;
+FlightRecorder flightRecorder FR_NOINIT;
+ClockSync clockSync;
+Boot boot;
+
+#if defined(BAM_BENCHMARK)
+const byte bamBenchmarkPins[BAM_BENCHMARK_NUM_PINS] = {2, 3, 7, 8, 10, 11};
+#endif
 
 int globalStep;
 
+// Aquarium transition table, indexed [state][event]
+const AquariumTransition aquariumTransitions[AQ_NUM_STATES][AQ_NUM_EVENTS] PROGMEM = {
+  // TAP, DARK, LIGHT, FISH_GOAL
+  { // AQ_STATE_FISH
+    {AQ_STATE_FLEEING, AQ_ACTION_FLEE},
+    {AQ_STATE_HIDING, AQ_ACTION_HIDE},
+    {AQ_STATE_FISH, AQ_ACTION_NONE},
+    {AQ_STATE_FISH, AQ_ACTION_PATROL}
+  },
+  { // AQ_STATE_FLEEING
+    {AQ_STATE_FLEEING, AQ_ACTION_FLEE},
+    {AQ_STATE_HIDING, AQ_ACTION_HIDE},
+    {AQ_STATE_FLEEING, AQ_ACTION_NONE},
+    {AQ_STATE_FISH, AQ_ACTION_PATROL}
+  },
+  { // AQ_STATE_HIDING
+    {AQ_STATE_HIDING, AQ_ACTION_NONE},
+    {AQ_STATE_HIDING, AQ_ACTION_NONE},
+    {AQ_STATE_FISH, AQ_ACTION_SHOW_FISH},
+    {AQ_STATE_JELLYFISH, AQ_ACTION_STOP}
+  },
+  { // AQ_STATE_JELLYFISH
+    {AQ_STATE_JELLYFISH, AQ_ACTION_NONE},
+    {AQ_STATE_JELLYFISH, AQ_ACTION_NONE},
+    {AQ_STATE_FISH, AQ_ACTION_SHOW_FISH},
+    {AQ_STATE_JELLYFISH, AQ_ACTION_STOP}
+  }
+};
+
+// Aquarium transition actions, indexed by AQ_ACTION_*
+AquariumAction const aquariumActions[AQ_NUM_ACTIONS] PROGMEM = {
+  aquarium_doNothing_,
+  aquarium_continuePatrol_,
+  aquarium_flee_,
+  aquarium_transitionToJellyfishState_,
+  aquarium_stopFish_,
+  aquarium_transitionToFishState_
+};
+
+// Axis owner callbacks, indexed [*_OWNER][AXIS_OWNER_*], NULL to ignore
+const AxisOwnerCallback axisOwnerCallbacks[NUM_OWNER_TYPES][AXIS_NUM_OWNER_EVENTS] PROGMEM = {
+  // GOAL_REACHED, PREEMPTED, RETURNED
+  {fish_onServoGoalReached, NULL, fish_onServoReturned}, // FISH_OWNER
+  {jellyfish_onServoGoalReached, NULL, NULL} // JELLYFISH_OWNER, never preempted
+};
+
+// Boot task graph, indexed by BOOT_TASK_*
+const BootTask bootTasks[NUM_BOOT_TASKS] PROGMEM = {
+  {crs_readyThread_, 0, 0},
+  {crs_readyThread_, 1, 0},
+  {crs_readyThread_, 2, 0},
+  {ls_baselineThread_, 0, 0},
+  {boot_fishThread_, 0, BOOT_AFTER(BOOT_TASK_SERVO_X) | BOOT_AFTER(BOOT_TASK_SERVO_Y) | BOOT_AFTER(BOOT_TASK_SERVO_Z)},
+  {boot_aquariumThread_, 0, BOOT_AFTER(BOOT_TASK_LIGHT) | BOOT_AFTER(BOOT_TASK_FISH)}
+};
+
+// Decorations, bit x of occupancyGrid[z][y] set if that cell is taken.
+// A castle in the middle of the floor and a plant towards the back left
+const uint16_t occupancyGrid[OG_CELLS_Z][OG_CELLS_Y] PROGMEM = {
+  { // z 0
+    0x0000, 0x0000, 0x3000, 0x3000, 0x0000, 0x0000, 0x03C0, 0x03C0,
+    0x03C0, 0x03C0, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  },
+  { // z 1
+    0x0000, 0x0000, 0x3000, 0x3000, 0x0000, 0x0000, 0x03C0, 0x03C0,
+    0x03C0, 0x03C0, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  },
+  { // z 2
+    0x0000, 0x0000, 0x3000, 0x3000, 0x0000, 0x0000, 0x03C0, 0x03C0,
+    0x03C0, 0x03C0, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  },
+  { // z 3
+    0x0000, 0x0000, 0x3000, 0x3000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  },
+  { // z 4
+    0x0000, 0x0000, 0x3000, 0x3000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  },
+  { // z 5
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  },
+  { // z 6
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  },
+  { // z 7
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000,
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+  }
+};
+
+// Detour waypoint directions for og_findDetour, in the order tried
+const signed char ogDetourDirections[OG_NUM_DETOUR_DIRECTIONS][3] PROGMEM = {
+  {0, 0, 1}, // Over
+  {0, 1, 0},
+  {0, -1, 0},
+  {1, 0, 0},
+  {-1, 0, 0},
+  {0, 0, -1} // Under
+};
+
+// Anchor cells of the route table, the flee corners halfway up the tank
+const byte routeAnchors[ROUTE_NUM_ANCHORS][3] PROGMEM = {
+  {OG_CELL_OF_X(CENTRAL_X_VAL), OG_CELL_OF_Y(CENTRAL_Y_VAL), OG_CELL_OF_Z(CENTRAL_Z_VAL)},
+  {OG_CELL_OF_X(FISH_HIDE_X), OG_CELL_OF_Y(FISH_HIDE_Y), OG_CELL_OF_Z(FISH_HIDE_Z)},
+  {OG_CELLS_X - 2, OG_CELLS_Y - 2, OG_CELLS_Z / 2}, // ROUTE_ANCHOR_NE
+  {OG_CELLS_X - 2, 1, OG_CELLS_Z / 2},
+  {1, 1, OG_CELLS_Z / 2},
+  {1, OG_CELLS_Y - 2, OG_CELLS_Z / 2}
+};
+
+// One wave of jellyfish bob and glow, round(127.5 * (1 - cos(2 pi i / 64)))
+const byte jellyfishWaveTable[JELLYFISH_WAVE_TABLE_SIZE] PROGMEM = {
+  0, 1, 2, 5, 10, 15, 21, 29, 37, 47, 57, 67, 79, 90, 103, 115,
+  127, 140, 152, 165, 176, 188, 198, 208, 218, 226, 234, 240, 245, 250, 253, 254,
+  255, 254, 253, 250, 245, 240, 234, 226, 218, 208, 198, 188, 176, 165, 152, 140,
+  128, 115, 103, 90, 79, 67, 57, 47, 37, 29, 21, 15, 10, 5, 2, 1
+};
+
+// Perceptual brightness to PWM duty, round(255 * (i / 255) ^ 2.2)
+const byte ledGammaTable[LED_MAX_BRIGHTNESS + 1] PROGMEM = {
+    0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   1,
+    1,   1,   1,   1,   1,   1,   1,   1,   1,   2,   2,   2,   2,   2,   2,   2,
+    3,   3,   3,   3,   3,   4,   4,   4,   4,   5,   5,   5,   5,   6,   6,   6,
+    6,   7,   7,   7,   8,   8,   8,   9,   9,   9,  10,  10,  11,  11,  11,  12,
+   12,  13,  13,  13,  14,  14,  15,  15,  16,  16,  17,  17,  18,  18,  19,  19,
+   20,  20,  21,  22,  22,  23,  23,  24,  25,  25,  26,  26,  27,  28,  28,  29,
+   30,  30,  31,  32,  33,  33,  34,  35,  35,  36,  37,  38,  39,  39,  40,  41,
+   42,  43,  43,  44,  45,  46,  47,  48,  49,  49,  50,  51,  52,  53,  54,  55,
+   56,  57,  58,  59,  60,  61,  62,  63,  64,  65,  66,  67,  68,  69,  70,  71,
+   73,  74,  75,  76,  77,  78,  79,  81,  82,  83,  84,  85,  87,  88,  89,  90,
+   91,  93,  94,  95,  97,  98,  99, 100, 102, 103, 105, 106, 107, 109, 110, 111,
+  113, 114, 116, 117, 119, 120, 121, 123, 124, 126, 127, 129, 130, 132, 133, 135,
+  137, 138, 140, 141, 143, 145, 146, 148, 149, 151, 153, 154, 156, 158, 159, 161,
+  163, 165, 166, 168, 170, 172, 173, 175, 177, 179, 181, 182, 184, 186, 188, 190,
+  192, 194, 196, 197, 199, 201, 203, 205, 207, 209, 211, 213, 215, 217, 219, 221,
+  223, 225, 227, 229, 231, 234, 236, 238, 240, 242, 244, 246, 248, 251, 253, 255
+};
+
 void setup()
 {
-  int i;
   ContinuousRotationServo * crs;
 
   Serial.begin(9600);
+  fr_init();
+  cs_init();
 
-  for(i=0; i<=13; i++)
-  {
-    pinMode(i, OUTPUT);
-    digitalWrite(i, 0);
-  }
+  fastio_makeOutputLowRange(0, 13);
+  bam_init();
+
+#if defined(BAM_BENCHMARK)
+  bam_benchmark();
+#endif
   
   ls_init(0, 12);
 
@@ -40,14 +202,14 @@ void setup()
   //crs_init(3, 7, 7, true);
   //`crs_init(3, 7, 7, false);
 
-  Serial.print("Finished initalization\n");
+  DEBUG_PRINT("Finished initalization\n");
   //crs_setVelocity_(3, 100);
 
   //crs_setTargetVelocity(0, 5000);
   //crs_setTargetVelocity(1, 5000);
   //crs_setTargetVelocity(2, 5000);
   //crs_setTargetVelocity(3, 1000);
-  fish_init(0, 0, 1, 2, 3);
+  fish_init(0, AXIS_CRS(0), AXIS_CRS(1), AXIS_CRS(2), AXIS_CRS(3));
   
   piezo_init(0, 0);
   piezo_init(1, 1);
@@ -66,18 +228,24 @@ void setup()
 
   lrs_init(0, 9);
   led_init(0, 12);
-  jellyfish_init(0, 0, 0);
+  jellyfish_init(0, AXIS_LRS(0), 0);
+#if defined(JELLYFISH_BENCHMARK)
+  jellyfish_benchmark();
+#endif
 
-  fish_setVelocity(0, 5000);
-  fish_goTo(0, 50000000, 5000000, 5000000);
-
-  aquarium_init(0, 0, 0, 0, 0);
+  boot_init();
+  fr_startWatchdog();
 }
 
 void loop()
 {
+  fr_poll();
+  cs_poll();
   delay(1);
-  aquarium_tick(0, millis());
+  if(boot_isReady())
+    aquarium_tick(0, millis());
+  else
+    boot_step();
 
   //fish_step(0, 100);
 
@@ -96,6 +264,7 @@ void crs_stop(int id)
 {
   crs_setVelocity_(id, 0);
   crs_setTargetVelocity(id, 0);
+  crs_savePosition_(id);
 }
 
 void crs_init(int id, byte controlLine, byte potLine, boolean calibrate)
@@ -106,36 +275,40 @@ void crs_init(int id, byte controlLine, byte potLine, boolean calibrate)
   target->potLine = potLine;
   target->zeroValue = PRE_CALIBRATION_ZERO_VAL;
   target->position = PRE_CALIBRATION_POSITION;
+  target->savedPosition = PRE_CALIBRATION_POSITION;
+  target->positionRemainder = 0;
   target->targetPosition = PRE_CALIBRATION_POSITION;
   target->targetVel = STARTING_TARGET_VELOCITY;
   target->velocitySlope = DEFAULT_VELOCITY_SLOPE;
   target->inTrustedArea = false;
   target->numMatchingVals = 0;
   target->correctionLastVal = analogRead(potLine);
-  target->ownerID = NONE;
-  target->ownerType = NONE;
+  target->ownership.owner.type = NONE;
+  target->ownership.preempted.type = NONE;
   target->selfID = id;
+  target->minTrustedVal = MIN_TRUSTED_VALUE;
+  target->maxTrustedVal = MAX_TRUSTED_VALUE;
+  target->learnLastVal = target->correctionLastVal;
+  crs_restartLearnRun_(id, true);
+  target->unsavedWindowGrowth = 0;
+  target->commandVelocity = 0;
+  target->commandRaw = NONE;
+  target->numSkippedWrites = 0;
+  target->calibration = NULL;
+  target->homing = NULL;
 
   globalServos[NUM_LIM_ROT_SERVOS + id].attach(target->controlLine);
 
   if(calibrate)
   {
-    crs_calibrate_(id);
-    crs_saveCalibration_(id);
+    crs_startCalibration(id);
   }
   else
   {
     crs_loadCalibration_(id);
+    crs_setVelocity_(id, 0);
+    crs_startHoming(id);
   }
-
-  crs_setVelocity_(id, 0);
-}
-
-void crs_setOwner(int id, int type, int ownerID)
-{
-  ContinuousRotationServo * target = crs_getInstance(id);
-  target->ownerID = ownerID;
-  target->ownerType = type;
 }
 
 void crs_startMovingTo(int id, long targetPosition)
@@ -178,16 +351,19 @@ void crs_step(int id, long ms)
   target = crs_getInstance(id);
   decreasing = target->decreasing;
 
-  // Update expected position
-  if(decreasing)
-    target->position -= ms * target->targetVel;
-  else
-    target->position += ms * target->targetVel;
+  // Update expected position from what the servo was told, in steps / sec
+  target->positionRemainder += ms * target->commandVelocity;
+  target->position += target->positionRemainder / MS_PER_SEC;
+  target->positionRemainder %= MS_PER_SEC;
 
   // Attempt to correct with pot
   if(target->targetVel != 0)
     crs_correctPos_(id);
 
+  // Arrival is reported once, when the servo stops for it
+  if(target->commandVelocity == 0)
+    return;
+
   // Check on delta
   delta = target->targetPosition - target->position;
   /*Serial.print("Delta: ");
@@ -215,14 +391,10 @@ void crs_onGoalReached(int id)
   /*Serial.print("Reached goal! Stop?");
    Serial.print("\n");*/
   crs_setVelocity_(id, 0);
+  crs_savePosition_(id);
 
   // Inform owner
-  switch(target->ownerType)
-  {
-  case FISH_OWNER:
-    fish_onServoGoalReached(target->ownerID, target->selfID);
-    break;
-  }
+  axis_notifyOwner_(target->ownership.owner, AXIS_OWNER_GOAL_REACHED, AXIS_CRS(id));
 }
 
 long crs_getPos(int id)
@@ -242,6 +414,7 @@ void crs_loadCalibration_(int id)
   int i;
   long position;
   CrsDto dto;
+  CrsWindowDto windowDto;
   byte * dtoPtr;
   ContinuousRotationServo * target;
 
@@ -254,8 +427,22 @@ void crs_loadCalibration_(int id)
     dtoPtr[i] = EEPROM.read(id * sizeof(CrsDto) + i);
   }
   target->position = dto.position;
+  target->savedPosition = dto.position;
   target->zeroValue = dto.zeroValue;
   target->velocitySlope = dto.velocitySlope;
+  crs_invalidateCommand_(id);
+
+  dtoPtr = (byte *)&windowDto;
+  for(i = 0; i<sizeof(CrsWindowDto); i++)
+    dtoPtr[i] = EEPROM.read(CRS_WINDOW_EEPROM_ADDR + id * sizeof(CrsWindowDto) + i);
+
+  // Keep the default window if nothing sensible was learned yet
+  if(MIN_LEARNABLE_VALUE <= windowDto.minTrustedVal && windowDto.minTrustedVal < windowDto.maxTrustedVal &&
+     windowDto.maxTrustedVal <= MAX_LEARNABLE_VALUE)
+  {
+    target->minTrustedVal = windowDto.minTrustedVal;
+    target->maxTrustedVal = windowDto.maxTrustedVal;
+  }
 }
 
 void crs_saveCalibration_(int id)
@@ -265,17 +452,46 @@ void crs_saveCalibration_(int id)
   byte * dtoPtr;
   ContinuousRotationServo * target;
   CrsDto dto;
+  CrsWindowDto windowDto;
 
   target = crs_getInstance(id);
   dto.position = target->position;
+  target->savedPosition = target->position;
   dto.zeroValue = target->zeroValue;
   dto.velocitySlope = target->velocitySlope;
   dtoPtr = (byte*)&dto;
 
   for(i = 0; i<sizeof(CrsDto); i++)
   {
-    EEPROM.write(id * sizeof(CrsDto) + i, dtoPtr[i]);
+    EEPROM.update(id * sizeof(CrsDto) + i, dtoPtr[i]);
   }
+
+  windowDto.minTrustedVal = target->minTrustedVal;
+  windowDto.maxTrustedVal = target->maxTrustedVal;
+  dtoPtr = (byte*)&windowDto;
+  for(i = 0; i<sizeof(CrsWindowDto); i++)
+    EEPROM.update(CRS_WINDOW_EEPROM_ADDR + id * sizeof(CrsWindowDto) + i, dtoPtr[i]);
+}
+
+void crs_savePosition_(int id)
+{
+  int i;
+  long position;
+  byte * positionPtr;
+  ContinuousRotationServo * target = crs_getInstance(id);
+
+  // Calibration and homing save everything once they are done
+  if(target->calibration != NULL || target->homing != NULL)
+    return;
+  if(abs(target->position - target->savedPosition) < CRS_SAVE_STEPS)
+    return;
+
+  // The position leads the servo's CrsDto
+  position = target->position;
+  target->savedPosition = position;
+  positionPtr = (byte *)&position;
+  for(i = 0; i < sizeof(long); i++)
+    EEPROM.update(id * sizeof(CrsDto) + i, positionPtr[i]);
 }
 
 /*void crs_goToMatchingSection_(int id, int minVal, int maxVal, int reqNumReadings)
@@ -302,218 +518,374 @@ void crs_saveCalibration_(int id)
  }
  }*/
 
-void crs_exhaustMatchingSection_(int id, int minVal, int maxVal)
+char crs_exhaustMatchingSection_(Pt * pt, int id, int minVal, int maxVal)
 {
-  int potVal;
-  int potLine;
-  ContinuousRotationServo * target;
+  ContinuousRotationServo * target = crs_getInstance(id);
+  CrsCalibration * cal = target->calibration;
 
-  // Get common information loaded
-  target = crs_getInstance(id);
-  potLine = target->potLine;
+  PT_BEGIN(pt);
 
   // Exhaust section
   do
   {
-    potVal = analogRead(potLine);
-    delay(SHORT_CALIBRATION_DUR);
+    cal->sectionVal = analogRead(target->potLine);
+    PT_WAIT_MS(pt, cal->sectionWaitStartUS, SHORT_CALIBRATION_DUR);
   }
-  while(minVal <= potVal && potVal <= maxVal);
+  while(minVal <= cal->sectionVal && cal->sectionVal <= maxVal);
+
+  PT_END(pt);
 }
 
-void crs_goToTrustedSection_(int id)
+char crs_goToTrustedSection_(Pt * pt, int id)
 {
-  int numMatchingVals;
   int potVal;
-  int lastVal;
-  int potLine;
-  boolean increasing;
   boolean consistent;
-  ContinuousRotationServo * target;
+  ContinuousRotationServo * target = crs_getInstance(id);
+  CrsCalibration * cal = target->calibration;
 
-  // Get background information
-  target = crs_getInstance(id);
-  increasing = true;
-  potLine = target->potLine;
-  numMatchingVals = 0;
+  PT_BEGIN(pt);
 
   // Run to linear section
-  numMatchingVals = 0;
-  lastVal = analogRead(potLine);
-  increasing = true;
-  while(numMatchingVals < REQUIRED_NUM_MATCHING_VALS_LOOSE)
-  {
-    delay(SHORT_CALIBRATION_DUR);
-    potVal = analogRead(potLine);
-    consistent = (increasing && potVal >= lastVal) || (!increasing && potVal <= lastVal);
-    if(MIN_TRUSTED_VALUE <= potVal && potVal <= MAX_TRUSTED_VALUE && consistent)
-      numMatchingVals++;
+  cal->sectionMatchingVals = 0;
+  cal->sectionLastVal = analogRead(target->potLine);
+  cal->sectionIncreasing = true;
+  while(cal->sectionMatchingVals < REQUIRED_NUM_MATCHING_VALS_LOOSE)
+  {
+    PT_WAIT_MS(pt, cal->sectionWaitStartUS, SHORT_CALIBRATION_DUR);
+    potVal = analogRead(target->potLine);
+    crs_learnTrustedWindow_(id, potVal);
+    consistent = (cal->sectionIncreasing && potVal >= cal->sectionLastVal) ||
+                 (!cal->sectionIncreasing && potVal <= cal->sectionLastVal);
+    if(crs_isTrustedVal_(id, potVal) && consistent)
+      cal->sectionMatchingVals++;
     else
     {
-      numMatchingVals -= abs(potVal - lastVal)/2;
-      if(numMatchingVals < 0)
-        numMatchingVals = 0;
-      increasing = potVal > lastVal;
+      cal->sectionMatchingVals -= abs(potVal - cal->sectionLastVal)/2;
+      if(cal->sectionMatchingVals < 0)
+        cal->sectionMatchingVals = 0;
+      cal->sectionIncreasing = potVal > cal->sectionLastVal;
     }
-    lastVal = potVal;
+    cal->sectionLastVal = potVal;
   }
+
+  PT_END(pt);
 }
 
-void crs_calibrate_(int id)
+char crs_calibrateThread_(Pt * pt, int id)
 {
-  long lastPos;
   int deltaPos;
   int potLine;
-  int potVal;
-  int lastVal;
-  int currentVel;
-  int numMatchingVals;
-  //boolean consistent;
-  //boolean increasing;
-  boolean finished;
-  float raw1;
-  float speed1;
-  float raw2;
-  float speed2;
-  int potVal1;
-  int potVal2;
   float estimatedSlope;
-  int estimatedZeroVal;
   float deltaSpeed;
-  float estimatedVelocity;
-  int i;
+  boolean finished;
+  CrsCalibration * cal;
   ContinuousRotationServo * target;
 
   // Get common information loaded
   target = crs_getInstance(id);
+  cal = target->calibration;
   potLine = target->potLine;
 
+  PT_BEGIN(pt);
+
   // Set small starting velocity
-  lastPos = analogRead(potLine);
-  currentVel = START_CALIBRATION_VEL;
+  cal->lastPos = analogRead(potLine);
+  cal->currentVel = START_CALIBRATION_VEL;
   do
   {
-    currentVel++;
-    crs_setVelocity_(id, currentVel);
-    delay(SHORT_CALIBRATION_DUR);
-    deltaPos = analogRead(potLine) - lastPos;
+    cal->currentVel++;
+    crs_setVelocity_(id, cal->currentVel);
+    PT_WAIT_MS(pt, cal->waitStartUS, SHORT_CALIBRATION_DUR);
+    deltaPos = analogRead(potLine) - cal->lastPos;
   }
   while(abs(deltaPos) < 10);
 
-  crs_goToTrustedSection_(id);
+  PT_SPAWN(pt, &cal->childPt, crs_goToTrustedSection_(&cal->childPt, id));
 
   // Newton's Method
-  //avgSlope = 0;
-  //numSlopesInAvg = 0;
-  estimatedSlope = 1;
-  estimatedZeroVal = 1500;
-  estimatedVelocity = estimatedSlope * currentVel + estimatedZeroVal;
-
   // Observe at first speed
-  potVal1 = analogRead(potLine);
-  delay(100);
-  potVal2 = analogRead(potLine);
-  deltaPos = potVal2 - potVal1;
-  speed1 = currentVel;
-  raw1 = deltaPos; // / 300.0; // TODO: constant for slope find delay time (50)
+  cal->potVal1 = analogRead(potLine);
+  PT_WAIT_MS(pt, cal->waitStartUS, 100);
+  deltaPos = analogRead(potLine) - cal->potVal1;
+  cal->speed1 = cal->currentVel;
+  cal->raw1 = deltaPos; // / 300.0; // TODO: constant for slope find delay time (50)
 
-  currentVel -= 3; // TODO: Constant
+  cal->currentVel -= 3; // TODO: Constant
 
   finished = false;
   while(!finished)
   {
     // TODO: take care of duplicated code 
-    crs_setVelocity_(id, currentVel);
-    potVal1 = analogRead(potLine);
-    delay(100);
-    potVal2 = analogRead(potLine);
-    deltaPos = potVal2 - potVal1;
-    speed2 = currentVel;
-    raw2 = deltaPos; // / 300.0; // TODO: constant for slope find delay time (50)
-
-    estimatedSlope = (raw2 - raw1) / (speed2 - speed1);
-    deltaSpeed = raw2 * CALIBRATION_CAUTIOUS_FACTOR / estimatedSlope;
+    crs_setVelocity_(id, cal->currentVel);
+    cal->potVal1 = analogRead(potLine);
+    PT_WAIT_MS(pt, cal->waitStartUS, 100);
+    deltaPos = analogRead(potLine) - cal->potVal1;
+    cal->speed2 = cal->currentVel;
+    cal->raw2 = deltaPos; // / 300.0; // TODO: constant for slope find delay time (50)
+
+    estimatedSlope = (cal->raw2 - cal->raw1) / (cal->speed2 - cal->speed1);
+    deltaSpeed = cal->raw2 * CALIBRATION_CAUTIOUS_FACTOR / estimatedSlope;
     finished = abs(deltaSpeed) < 1;
 
-    //avgSlope = (avgSlope * numSlopesInAvg + estimatedSlope) / (numSlopesInAvg + 1);
-    //numSlopesInAvg++;
-
-    if(finished)
-      break;
-    else
+    if(!finished)
     {
-      estimatedZeroVal = speed2 - deltaSpeed;
-      raw1 = raw2;
-      speed1 = speed2;
-      currentVel = estimatedZeroVal;
+      cal->raw1 = cal->raw2;
+      cal->speed1 = cal->speed2;
+      cal->currentVel = (int)(cal->speed2 - deltaSpeed);
     }
   }
 
-  Serial.print("Newtons done?\n");
+  DEBUG_PRINT("Newtons done?\n");
 
   // Finish with hill climbing
   // Change speed until delta position = 0
   // within clean section
-  numMatchingVals = 0;
-  while(numMatchingVals < REQUIRED_NUM_MATCHING_VALS)
-  {
-    lastVal = analogRead(potLine);
-    delay(10);
-    potVal = analogRead(potLine);
-    deltaPos = potVal - lastVal;
-    Serial.print(deltaPos);
-    Serial.print("\n");
+  cal->numMatchingVals = 0;
+  while(cal->numMatchingVals < REQUIRED_NUM_MATCHING_VALS)
+  {
+    cal->lastVal = analogRead(potLine);
+    PT_WAIT_MS(pt, cal->waitStartUS, 10);
+    deltaPos = analogRead(potLine) - cal->lastVal;
+    DEBUG_PRINT(deltaPos);
+    DEBUG_PRINT("\n");
 
     if(deltaPos == 0)
     {
-      numMatchingVals++;
+      cal->numMatchingVals++;
     }
     else
     {
       if(deltaPos < 0)
-        currentVel++;
+        cal->currentVel++;
       else
-        currentVel--;
-      if(currentVel > 40)
-        currentVel = 40;
-      else if(currentVel < -40)
-        currentVel = -40;
+        cal->currentVel--;
+      if(cal->currentVel > 40)
+        cal->currentVel = 40;
+      else if(cal->currentVel < -40)
+        cal->currentVel = -40;
 
-      numMatchingVals = 0;
+      cal->numMatchingVals = 0;
 
-      crs_setVelocity_(id, currentVel);
+      crs_setVelocity_(id, cal->currentVel);
     }
   }
 
   // Update zero value
-  target->zeroValue += target->velocitySlope * currentVel;
+  target->zeroValue += target->velocitySlope * cal->currentVel;
+  crs_invalidateCommand_(id);
 
   // Determine velocity conversion slope
   crs_setVelocity_(id, SLOPE_FINDING_VEL_1);
-  crs_exhaustMatchingSection_(id, MIN_TRUSTED_VALUE, MAX_TRUSTED_VALUE);
-  crs_goToTrustedSection_(id);
+  PT_SPAWN(pt, &cal->childPt,
+           crs_exhaustMatchingSection_(&cal->childPt, id, target->minTrustedVal, target->maxTrustedVal));
+  PT_SPAWN(pt, &cal->childPt, crs_goToTrustedSection_(&cal->childPt, id));
 
-  potVal1 = analogRead(potLine);
-  delay(SLOPE_FINDING_DUR);
-  potVal2 = analogRead(potLine);
-  deltaPos = potVal2 - potVal1;
-  speed1 = SLOPE_FINDING_VEL_1;
-  raw1 = deltaPos / (float)SLOPE_FINDING_DUR;
+  cal->potVal1 = analogRead(potLine);
+  PT_WAIT_MS(pt, cal->waitStartUS, SLOPE_FINDING_DUR);
+  deltaPos = analogRead(potLine) - cal->potVal1;
+  cal->speed1 = SLOPE_FINDING_VEL_1;
+  cal->raw1 = deltaPos * 1000000.0 / (micros() - cal->waitStartUS); // Steps / sec, other threads can stretch the wait
 
   crs_setVelocity_(id, SLOPE_FINDING_VEL_2);
-  potVal1 = analogRead(potLine);
-  delay(SLOPE_FINDING_DUR);
-  potVal2 = analogRead(potLine);
-  deltaPos = potVal2 - potVal1;
-  speed2 = SLOPE_FINDING_VEL_2;
-  raw2 = deltaPos / (float)SLOPE_FINDING_DUR;
-
-  estimatedSlope = (raw2 - raw1) / (speed2 - speed1);
-  target->velocitySlope = estimatedSlope;
+  cal->potVal1 = analogRead(potLine);
+  PT_WAIT_MS(pt, cal->waitStartUS, SLOPE_FINDING_DUR);
+  deltaPos = analogRead(potLine) - cal->potVal1;
+  cal->speed2 = SLOPE_FINDING_VEL_2;
+  cal->raw2 = deltaPos * 1000000.0 / (micros() - cal->waitStartUS);
+
+  // Pulse change per step / sec, so velocities are in steps / sec from here
+  if(cal->raw2 != cal->raw1)
+  {
+    estimatedSlope = (cal->speed2 - cal->speed1) * target->velocitySlope / (cal->raw2 - cal->raw1);
+    target->velocitySlope = estimatedSlope;
+  }
+  crs_invalidateCommand_(id);
 
   // Stop
   crs_setVelocity_(id, 0);
   crs_setTargetVelocity(id, 0);
+
+  PT_END(pt);
+}
+
+boolean crs_startCalibration(int id)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+
+  if(target->calibration != NULL || target->homing != NULL)
+    return false;
+
+  target->calibration = (CrsCalibration *)(malloc(sizeof(CrsCalibration)));
+  if(target->calibration == NULL)
+    return false;
+
+  PT_INIT(&target->calibration->pt);
+  return true;
+}
+
+boolean crs_isCalibrating(int id)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+  return target->calibration != NULL;
+}
+
+void crs_stepCalibration()
+{
+  int i;
+  ContinuousRotationServo * target;
+
+  for(i = 0; i < NUM_CONT_ROT_SERVOS; i++)
+  {
+    target = crs_getInstance(i);
+    if(target->calibration == NULL)
+      continue;
+
+    if(!PT_SCHEDULE(crs_calibrateThread_(&target->calibration->pt, i)))
+    {
+      free(target->calibration);
+      target->calibration = NULL;
+      crs_saveCalibration_(i);
+    }
+  }
+}
+
+boolean crs_startHoming(int id)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+
+  if(target->calibration != NULL || target->homing != NULL)
+    return false;
+
+  target->homing = (CrsHoming *)(malloc(sizeof(CrsHoming)));
+  if(target->homing == NULL)
+    return false;
+
+  PT_INIT(&target->homing->pt);
+  return true;
+}
+
+boolean crs_isHoming(int id)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+  return target->homing != NULL;
+}
+
+void crs_stepHoming()
+{
+  int i;
+  ContinuousRotationServo * target;
+
+  for(i = 0; i < NUM_CONT_ROT_SERVOS; i++)
+  {
+    target = crs_getInstance(i);
+    if(target->homing == NULL)
+      continue;
+
+    if(!PT_SCHEDULE(crs_homeThread_(&target->homing->pt, i)))
+    {
+      free(target->homing);
+      target->homing = NULL;
+      crs_saveCalibration_(i);
+    }
+  }
+}
+
+char crs_homeThread_(Pt * pt, int id)
+{
+  int potVal;
+  int delta;
+  boolean consistent;
+  long expected;
+  long phase;
+  long homed;
+  ContinuousRotationServo * target = crs_getInstance(id);
+  CrsHoming * homing = target->homing;
+
+  PT_BEGIN(pt);
+
+  homing->startMS = millis();
+  homing->travel = 0;
+  homing->lastVal = analogRead(target->potLine);
+  homing->increasing = true;
+
+  do
+  {
+    // Creep to the trusted section unless already resting in it
+    if(!crs_isTrustedVal_(id, homing->lastVal))
+      crs_setVelocity_(id, HOMING_VELOCITY);
+
+    homing->numMatchingVals = 0;
+    while(homing->numMatchingVals < REQUIRED_NUM_MATCHING_VALS_LOOSE)
+    {
+      PT_WAIT_MS(pt, homing->waitStartUS, SHORT_CALIBRATION_DUR);
+      if(millis() - homing->startMS > HOMING_TIMEOUT_MS)
+      {
+        // The shaft has crept this far, the saved position should say so
+        crs_setVelocity_(id, 0);
+        target->position += homing->travel;
+        target->targetPosition = target->position;
+        fr_record(FR_EVENT_HOMING_FAILED, id, homing->lastVal);
+        PT_EXIT(pt);
+      }
+
+      // Keep count of the distance covered, a jump is the dead zone passing
+      potVal = analogRead(target->potLine);
+      delta = potVal - homing->lastVal;
+      if(delta > MAX_LEARN_STEP_DELTA)
+        homing->travel += delta - NUM_STEPS_ROT;
+      else if(delta < -MAX_LEARN_STEP_DELTA)
+        homing->travel += delta + NUM_STEPS_ROT;
+      else
+        homing->travel += delta;
+
+      consistent = (homing->increasing && delta >= 0) || (!homing->increasing && delta <= 0);
+      if(crs_isTrustedVal_(id, potVal) && consistent)
+        homing->numMatchingVals++;
+      else
+      {
+        homing->numMatchingVals = 0;
+        homing->increasing = delta > 0;
+      }
+      homing->lastVal = potVal;
+    }
+
+    // Stop and let the shaft settle before taking its phase
+    if(target->commandVelocity != 0)
+    {
+      crs_setVelocity_(id, 0);
+      PT_WAIT_MS(pt, homing->waitStartUS, HOMING_SETTLE_MS);
+      potVal = analogRead(target->potLine);
+      homing->travel += potVal - homing->lastVal;
+      homing->lastVal = potVal;
+    }
+  }
+  while(!crs_isTrustedVal_(id, homing->lastVal)); // Coasted out, go again
+
+  // Take the turn nearest to where the restored position says we are
+  expected = target->position + homing->travel;
+  phase = expected % NUM_STEPS_ROT;
+  if(phase < 0)
+    phase += NUM_STEPS_ROT;
+  homed = expected - phase + homing->lastVal;
+  if(homed - expected > NUM_STEPS_ROT / 2)
+    homed -= NUM_STEPS_ROT;
+  else if(homed - expected < -NUM_STEPS_ROT / 2)
+    homed += NUM_STEPS_ROT;
+  fr_record(FR_EVENT_HOMED, id, homed - expected);
+
+  target->position = homed;
+  target->targetPosition = homed;
+  target->inTrustedArea = true;
+  target->correctionLastVal = homing->lastVal;
+
+  PT_END(pt);
+}
+
+char crs_readyThread_(Pt * pt, int id)
+{
+  PT_BEGIN(pt);
+  PT_WAIT_WHILE(pt, crs_isCalibrating(id) || crs_isHoming(id));
+  PT_END(pt);
 }
 
 void crs_setVelocity_(int id, int velocity)
@@ -522,10 +894,41 @@ void crs_setVelocity_(int id, int velocity)
 
   ContinuousRotationServo * target = crs_getInstance(id);
 
+  // Past its top speed the estimate would run ahead of the shaft
+  velocity = constrain(velocity, -CRS_MAX_VELOCITY, CRS_MAX_VELOCITY);
+
+  // Same velocity under the same calibration converts to the same pulse
+  if(target->commandRaw != NONE && velocity == target->commandVelocity)
+  {
+    target->numSkippedWrites++;
+    return;
+  }
+
   convertedVelocity = crs_convertVelocityToRaw_(id, velocity);
+  target->commandVelocity = velocity;
+  if(convertedVelocity == target->commandRaw)
+  {
+    target->numSkippedWrites++;
+    return;
+  }
+
+  target->commandRaw = convertedVelocity;
+  fr_record(FR_EVENT_VELOCITY, id, velocity);
   globalServos[NUM_LIM_ROT_SERVOS + id].writeMicroseconds(convertedVelocity);
 }
 
+void crs_invalidateCommand_(int id)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+  target->commandRaw = NONE;
+}
+
+unsigned long crs_getNumSkippedWrites(int id)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+  return target->numSkippedWrites;
+}
+
 void crs_correctPos_(int id)
 {
   ContinuousRotationServo * target = crs_getInstance(id);
@@ -537,18 +940,35 @@ void crs_correctPos_(int id)
   int numStepsIntoRot;
   int deltaSteps;
 
+  // Widen the trusted window, persisting it once it has grown enough
+  if(crs_learnTrustedWindow_(id, currentVal) && target->unsavedWindowGrowth >= TRUSTED_WINDOW_SAVE_STEP)
+  {
+    crs_saveCalibration_(id);
+    target->unsavedWindowGrowth = 0;
+  }
+
   // If in trusted zone, make sure we are still there and correct pos
   if(target->inTrustedArea)
   {
-    Serial.print("Here!");
-    Serial.print("\n");
+    DEBUG_PRINT("Here!");
+    DEBUG_PRINT("\n");
 
     // Make sure we are still in trusted range
-    if(currentVal >= MIN_TRUSTED_VALUE && currentVal <= MAX_TRUSTED_VALUE)
+    if(crs_isTrustedVal_(id, currentVal))
     {
       numStepsIntoRot = target->position % NUM_STEPS_ROT;
+      if(numStepsIntoRot < 0)
+        numStepsIntoRot += NUM_STEPS_ROT;
       deltaSteps = currentVal - numStepsIntoRot;
+
+      // Near the wrap the estimate may sit on the other side of it
+      if(deltaSteps > NUM_STEPS_ROT / 2)
+        deltaSteps -= NUM_STEPS_ROT;
+      else if(deltaSteps < -NUM_STEPS_ROT / 2)
+        deltaSteps += NUM_STEPS_ROT;
       target->position += deltaSteps;
+      if(deltaSteps != 0)
+        fr_record(FR_EVENT_CORRECTION, id, deltaSteps);
     }
     else
     {
@@ -560,12 +980,12 @@ void crs_correctPos_(int id)
   {
     // See if we have a matching value
     consistent = (increasing && currentVal >= lastVal) || (!increasing && currentVal <= lastVal);
-    if(MIN_TRUSTED_VALUE <= currentVal && currentVal <= MAX_TRUSTED_VALUE && consistent)
+    if(crs_isTrustedVal_(id, currentVal) && consistent)
     {
       numMatchingVals++;
-      Serial.print("Num matching vals:");
-      Serial.print(numMatchingVals);
-      Serial.print("\n");
+      DEBUG_PRINT("Num matching vals:");
+      DEBUG_PRINT(numMatchingVals);
+      DEBUG_PRINT("\n");
     }
     else
     {
@@ -581,6 +1001,87 @@ void crs_correctPos_(int id)
   }
 }
 
+boolean crs_learnTrustedWindow_(int id, int potVal)
+{
+  int delta;
+  int newMin;
+  int newMax;
+  boolean increasing;
+  boolean grew;
+  ContinuousRotationServo * target = crs_getInstance(id);
+
+  delta = potVal - target->learnLastVal;
+  target->learnLastVal = potVal;
+  if(delta == 0)
+    return false;
+
+  // Restart the run empty on wrap arounds and the dead zone, the sample
+  // that caused it cannot be trusted to bound the run
+  increasing = delta > 0;
+  if(abs(delta) > MAX_LEARN_STEP_DELTA || potVal < MIN_LEARNABLE_VALUE || potVal > MAX_LEARNABLE_VALUE)
+  {
+    crs_restartLearnRun_(id, increasing);
+    return false;
+  }
+
+  // and from the turning point on direction changes
+  if(increasing != target->learnIncreasing)
+  {
+    target->learnIncreasing = increasing;
+    target->learnRunMin = potVal;
+    target->learnRunMax = potVal;
+    target->learnRunLength = 0;
+    return false;
+  }
+
+  // Extend the current monotonic run
+  if(potVal < target->learnRunMin)
+    target->learnRunMin = potVal;
+  if(potVal > target->learnRunMax)
+    target->learnRunMax = potVal;
+  target->learnRunLength++;
+
+  if(target->learnRunLength < REQUIRED_NUM_MATCHING_VALS_LOOSE)
+    return false;
+
+  // Run is long enough to be believed, take it in (minus a margin)
+  grew = false;
+  newMin = target->learnRunMin + TRUSTED_WINDOW_MARGIN;
+  newMax = target->learnRunMax - TRUSTED_WINDOW_MARGIN;
+  newMin = constrain(newMin, MIN_LEARNABLE_VALUE, MAX_LEARNABLE_VALUE);
+  newMax = constrain(newMax, MIN_LEARNABLE_VALUE, MAX_LEARNABLE_VALUE);
+  if(newMin < target->minTrustedVal)
+  {
+    target->unsavedWindowGrowth += target->minTrustedVal - newMin;
+    target->minTrustedVal = newMin;
+    grew = true;
+  }
+  if(newMax > target->maxTrustedVal)
+  {
+    target->unsavedWindowGrowth += newMax - target->maxTrustedVal;
+    target->maxTrustedVal = newMax;
+    grew = true;
+  }
+  return grew;
+}
+
+void crs_restartLearnRun_(int id, boolean increasing)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+
+  // Inverted bounds, the first sample taken in sets both
+  target->learnIncreasing = increasing;
+  target->learnRunMin = MAX_LEARNABLE_VALUE;
+  target->learnRunMax = MIN_LEARNABLE_VALUE;
+  target->learnRunLength = 0;
+}
+
+boolean crs_isTrustedVal_(int id, int potVal)
+{
+  ContinuousRotationServo * target = crs_getInstance(id);
+  return target->minTrustedVal <= potVal && potVal <= target->maxTrustedVal;
+}
+
 LimitedRotationServo * lrs_getInstance(int id)
 {
   return &(limitedRotationServos[id]);
@@ -591,115 +1092,691 @@ void lrs_init(int id, byte controlLine)
   LimitedRotationServo * target = lrs_getInstance(id);
   globalServos[id].attach(controlLine);
   target->controlLine = controlLine;
+  target->angle = NONE;
+  target->startAngle = 0;
+  target->targetAngle = 0;
+  target->slewRate = LRS_DEFAULT_SLEW_RATE;
+  target->moveElapsedMS = 0;
+  target->moveDurationMS = 0;
+  target->moving = false;
+  target->numSkippedWrites = 0;
+  target->ownership.owner.type = NONE;
+  target->ownership.preempted.type = NONE;
 }
 
 void lrs_setAngle(int id, int angle)
 {
   LimitedRotationServo * target = lrs_getInstance(id);
-  int line = target->controlLine;
 
+  target->moving = false;
+  target->targetAngle = angle;
+  lrs_write_(id, angle);
+}
+
+void lrs_write_(int id, int angle)
+{
+  LimitedRotationServo * target = lrs_getInstance(id);
+
+  if(angle == target->angle)
+  {
+    target->numSkippedWrites++;
+    return;
+  }
+
+  target->angle = angle;
   globalServos[id].write(angle);
 }
 
-void lrs_step(int id, long ms)
+unsigned long lrs_getNumSkippedWrites(int id)
+{
+  LimitedRotationServo * target = lrs_getInstance(id);
+  return target->numSkippedWrites;
+}
+
+void lrs_startMovingTo(int id, int angle)
 {
+  long distance;
+  LimitedRotationServo * target = lrs_getInstance(id);
+
+  // Position unknown (never written), nothing to ease from
+  if(target->angle == NONE)
+  {
+    lrs_setAngle(id, angle);
+    return;
+  }
+
+  distance = abs(angle - target->angle);
+  target->startAngle = target->angle;
+  target->targetAngle = angle;
+  target->moveElapsedMS = 0;
 
+  // No rate to ease at, the next step jumps there
+  if(target->slewRate > 0)
+    target->moveDurationMS = distance * MS_PER_SEC / target->slewRate;
+  else
+    target->moveDurationMS = 0;
+  target->moving = distance != 0;
 }
 
-PiezoSensor * piezo_getInstance(int id)
+void lrs_stop(int id)
 {
-  return &(piezoSensors[id]);
+  LimitedRotationServo * target = lrs_getInstance(id);
+  target->moving = false;
+  target->targetAngle = target->angle;
 }
 
-void piezo_init(int id, byte line)
+void lrs_setSlewRate(int id, int slewRate)
 {
-  PiezoSensor * target = piezo_getInstance(id);
-  target->line = line;
-  target->fired = NO_TAP;
+  LimitedRotationServo * target = lrs_getInstance(id);
+  target->slewRate = slewRate;
 }
 
-int piezo_isFired(int id)
+boolean lrs_isMoving(int id)
 {
-  PiezoSensor * target = piezo_getInstance(id);
-  
-  int ret_val = target->fired;
-  target->fired = NO_TAP;
-  return ret_val;
+  LimitedRotationServo * target = lrs_getInstance(id);
+  return target->moving;
 }
 
-void piezo_onTick(int id)
+int lrs_ease_(long elapsedMS, long durationMS)
 {
-  PiezoSensor * target = piezo_getInstance(id);
-  int line = target->line;
+  long progress;
 
-  int val = analogRead(line);
+  if(elapsedMS >= durationMS)
+    return LRS_EASE_ONE;
 
-  //keep track of max fired val in target->fired
-  //if(val >= PIEZO_MIN_TAP_VAL && val > target->fired)
-  //  target->fired = val;
+  // 3p^2 - 2p^3 with p in [0, LRS_EASE_ONE]
+  progress = elapsedMS * LRS_EASE_ONE / durationMS;
+  return (progress * progress * (3 * LRS_EASE_ONE - 2 * progress)) / ((long)LRS_EASE_ONE * LRS_EASE_ONE);
 }
 
-LightSensor * ls_getInstance(int id)
+void lrs_step(int id, long ms)
 {
-  return &(lightSensors[id]);
+  int angle;
+  int eased;
+  LimitedRotationServo * target = lrs_getInstance(id);
+
+  if(!target->moving)
+    return;
+
+  target->moveElapsedMS += ms;
+  eased = lrs_ease_(target->moveElapsedMS, target->moveDurationMS);
+  angle = target->startAngle + (long)(target->targetAngle - target->startAngle) * eased / LRS_EASE_ONE;
+  target->moving = eased < LRS_EASE_ONE;
+
+  lrs_write_(id, angle);
+  if(!target->moving)
+    axis_notifyOwner_(target->ownership.owner, AXIS_OWNER_GOAL_REACHED, AXIS_LRS(id));
 }
 
-void ls_init(int id, byte line)
+void axis_startMovingTo(int axis, long position)
 {
-  LightSensor * target = ls_getInstance(id);
-  target->line = line;
-  target->isLight = analogRead(target->line) > MIN_LIGHT_VAL;
+  if(AXIS_IS_LRS(axis))
+    lrs_startMovingTo(AXIS_SERVO(axis), position);
+  else
+    crs_startMovingTo(AXIS_SERVO(axis), position);
 }
 
-boolean ls_isLight(int id)
+void axis_startMovingToAngle(int axis, double angle)
 {
-  boolean isLight;
-  
-  LightSensor * target = ls_getInstance(id);
-  if(target->isLight)
-    isLight = analogRead(target->line) > MIN_LIGHT_VAL;
+  if(AXIS_IS_LRS(axis))
+    lrs_startMovingTo(AXIS_SERVO(axis), (int)(angle * 180 / M_PI + 0.5));
   else
-    isLight = analogRead(target->line) > MIN_LIGHT_RECOVERY_VAL;
-  
-  target->isLight = isLight;
-  return isLight;
+    crs_startMovingToAngle(AXIS_SERVO(axis), angle);
 }
 
-LEDAbstraction * led_getInstance(int id)
+void axis_track(int axis, long position)
 {
-  return &(leds[id]);
+  if(AXIS_IS_LRS(axis))
+    lrs_setAngle(AXIS_SERVO(axis), position);
+  else
+    crs_startMovingTo(AXIS_SERVO(axis), position);
 }
 
-void led_init(int id, byte line)
+void axis_setSpeed(int axis, int speed)
 {
-  LEDAbstraction * target = led_getInstance(id);
+  if(AXIS_IS_LRS(axis))
+    lrs_setSlewRate(AXIS_SERVO(axis), speed);
+  else
+    crs_setTargetVelocity(AXIS_SERVO(axis), speed);
+}
+
+void axis_stop(int axis)
+{
+  if(AXIS_IS_LRS(axis))
+    lrs_stop(AXIS_SERVO(axis));
+  else
+    crs_stop(AXIS_SERVO(axis));
+}
+
+long axis_getPos(int axis)
+{
+  if(AXIS_IS_LRS(axis))
+    return lrs_getInstance(AXIS_SERVO(axis))->angle;
+  return crs_getPos(AXIS_SERVO(axis));
+}
+
+boolean axis_isMoving(int axis)
+{
+  if(AXIS_IS_LRS(axis))
+    return lrs_isMoving(AXIS_SERVO(axis));
+  return crs_getInstance(AXIS_SERVO(axis))->commandVelocity != 0;
+}
+
+void axis_step(int axis, long ms)
+{
+  if(AXIS_IS_LRS(axis))
+    lrs_step(AXIS_SERVO(axis), ms);
+  else
+    crs_step(AXIS_SERVO(axis), ms);
+}
+
+void axis_stepIfOwnedBy(int axis, int type, int ownerID, long ms)
+{
+  if(axis_isOwnedBy(axis, type, ownerID))
+    axis_step(axis, ms);
+}
+
+boolean axis_reserve(int axis, int type, int ownerID, byte priority)
+{
+  boolean preempting;
+  AxisOwnership * target = axis_getOwnership_(axis);
+
+  preempting = target->owner.type != NONE && !axis_isOwnedBy(axis, type, ownerID);
+  if(preempting)
+  {
+    if(priority <= target->owner.priority)
+      return false;
+
+    // Stop where it is so the old owner's goal is not reported to the new
+    target->preempted = target->owner;
+    axis_stop(axis);
+    if(!AXIS_IS_LRS(axis))
+      crs_getInstance(AXIS_SERVO(axis))->targetPosition = crs_getPos(AXIS_SERVO(axis));
+    fr_record(FR_EVENT_PREEMPTED, axis, type);
+  }
+
+  target->owner.type = type;
+  target->owner.id = ownerID;
+  target->owner.priority = priority;
+  if(preempting)
+    axis_notifyOwner_(target->preempted, AXIS_OWNER_PREEMPTED, axis);
+  return true;
+}
+
+void axis_release(int axis, int type, int ownerID)
+{
+  AxisOwnership * target = axis_getOwnership_(axis);
+
+  if(target->preempted.type == type && target->preempted.id == ownerID)
+  {
+    target->preempted.type = NONE;
+    return;
+  }
+  if(!axis_isOwnedBy(axis, type, ownerID))
+    return;
+
+  axis_stop(axis);
+  if(!AXIS_IS_LRS(axis))
+    crs_getInstance(AXIS_SERVO(axis))->targetPosition = crs_getPos(AXIS_SERVO(axis));
+  target->owner = target->preempted;
+  target->preempted.type = NONE;
+  axis_notifyOwner_(target->owner, AXIS_OWNER_RETURNED, axis);
+}
+
+boolean axis_isOwnedBy(int axis, int type, int ownerID)
+{
+  AxisOwnership * target = axis_getOwnership_(axis);
+  return target->owner.type == type && target->owner.id == ownerID;
+}
+
+AxisOwnership * axis_getOwnership_(int axis)
+{
+  if(AXIS_IS_LRS(axis))
+    return &(lrs_getInstance(AXIS_SERVO(axis))->ownership);
+  return &(crs_getInstance(AXIS_SERVO(axis))->ownership);
+}
+
+void axis_notifyOwner_(AxisReservation owner, byte event, int axis)
+{
+  AxisOwnerCallback callbackFunc;
+
+  if(owner.type == NONE)
+    return;
+  callbackFunc = (AxisOwnerCallback)pgm_read_ptr(&axisOwnerCallbacks[owner.type][event]);
+  if(callbackFunc != NULL)
+    callbackFunc(owner.id, axis);
+}
+
+PiezoSensor * piezo_getInstance(int id)
+{
+  return &(piezoSensors[id]);
+}
+
+void piezo_init(int id, byte line)
+{
+  PiezoSensor * target = piezo_getInstance(id);
+  target->line = line;
+  target->fired = NO_TAP;
+}
+
+int piezo_isFired(int id)
+{
+  int ret_val;
+  byte oldSREG;
+  PiezoSensor * target = piezo_getInstance(id);
+
+  // A tap raised between the read and the clear would be lost
+  oldSREG = SREG;
+  cli();
+  ret_val = target->fired;
+  target->fired = NO_TAP;
+  SREG = oldSREG;
+  return ret_val;
+}
+
+void piezo_onTick(int id)
+{
+  PiezoSensor * target = piezo_getInstance(id);
+  int line = target->line;
+
+  int val = analogRead(line);
+
+  //keep track of max fired val in target->fired
+  //if(val >= PIEZO_MIN_TAP_VAL && val > target->fired)
+  //  target->fired = val;
+}
+
+LightSensor * ls_getInstance(int id)
+{
+  return &(lightSensors[id]);
+}
+
+void ls_init(int id, byte line)
+{
+  LightSensor * target = ls_getInstance(id);
   target->line = line;
+  target->baseline = analogRead(target->line);
+  target->isLight = target->baseline > MIN_LIGHT_VAL;
+}
+
+boolean ls_isLight(int id)
+{
+  boolean isLight;
+  
+  LightSensor * target = ls_getInstance(id);
+  if(target->isLight)
+    isLight = analogRead(target->line) > MIN_LIGHT_VAL;
+  else
+    isLight = analogRead(target->line) > MIN_LIGHT_RECOVERY_VAL;
+  
+  target->isLight = isLight;
+  return isLight;
+}
+
+char ls_baselineThread_(Pt * pt, int id)
+{
+  LightSensor * target = ls_getInstance(id);
+
+  PT_BEGIN(pt);
+
+  target->baselineSum = analogRead(target->line);
+  for(target->baselineSamples = 1; target->baselineSamples < LS_BASELINE_SAMPLES; target->baselineSamples++)
+  {
+    PT_WAIT_MS(pt, target->baselineWaitStartUS, LS_BASELINE_INTERVAL_MS);
+    target->baselineSum += analogRead(target->line);
+  }
+
+  target->baseline = target->baselineSum / LS_BASELINE_SAMPLES;
+  target->isLight = target->baseline > MIN_LIGHT_VAL;
+
+  PT_END(pt);
+}
+
+LEDAbstraction * led_getInstance(int id)
+{
+  return &(leds[id]);
+}
+
+void led_init(int id, byte line)
+{
+  LEDAbstraction * target = led_getInstance(id);
+  target->line = line;
+  target->outReg = fastio_getPort(line);
+  target->outMask = FASTIO_MASK(line);
+  target->hasPWM = digitalPinHasPWM(line) && !bam_usesPin(line);
+  target->bamChannel = target->hasPWM ? NONE : bam_addChannel(line);
+  target->brightness = 0;
+  target->output = NONE;
+  target->animation = LED_ANIM_NONE;
   /*Serial.print("Initing with ");
    Serial.print(target->line);
    Serial.print("\n");*/
   pinMode(line, OUTPUT);
+  led_write_(id, 0);
 }
 
 void led_turnOn(int id)
 {
-  int line;
-  LEDAbstraction * target;
-
-  target = led_getInstance(id);
-  line = target->line;
-  //Serial.print(line);
-  digitalWrite(line, 1);
+  led_setBrightness(id, LED_MAX_BRIGHTNESS);
 }
 
 void led_turnOff(int id)
 {
-  int line;
-  LEDAbstraction * target;
+  led_setBrightness(id, 0);
+}
 
-  target = led_getInstance(id);
-  line = target->line;
-  //Serial.print(line);
-  digitalWrite(line, 0);
+void led_setBrightness(int id, int brightness)
+{
+  LEDAbstraction * target = led_getInstance(id);
+  target->animation = LED_ANIM_NONE;
+  led_write_(id, brightness);
+}
+
+void led_fadeTo(int id, int brightness, long durationMS)
+{
+  LEDAbstraction * target = led_getInstance(id);
+
+  if(durationMS <= 0)
+  {
+    led_setBrightness(id, brightness);
+    return;
+  }
+
+  target->animation = LED_ANIM_FADE;
+  target->animFrom = target->brightness;
+  target->animTo = brightness;
+  target->animElapsedMS = 0;
+  target->animDurationMS = durationMS;
+}
+
+void led_pulse(int id, int minBrightness, int maxBrightness, long periodMS)
+{
+  LEDAbstraction * target = led_getInstance(id);
+
+  if(periodMS < 2)
+  {
+    led_setBrightness(id, maxBrightness);
+    return;
+  }
+
+  target->animation = LED_ANIM_PULSE;
+  target->animFrom = minBrightness;
+  target->animTo = maxBrightness;
+  target->animDurationMS = periodMS;
+
+  // Start the breath at the current level so there is no jump
+  if(maxBrightness > minBrightness && target->brightness > minBrightness)
+    target->animElapsedMS = (long)(target->brightness - minBrightness) * (periodMS / 2) / (maxBrightness - minBrightness);
+  else
+    target->animElapsedMS = 0;
+}
+
+boolean led_isAnimating(int id)
+{
+  LEDAbstraction * target = led_getInstance(id);
+  return target->animation != LED_ANIM_NONE;
+}
+
+void led_step(int id, long ms)
+{
+  long half;
+  long phase;
+  int brightness;
+  LEDAbstraction * target = led_getInstance(id);
+
+  switch(target->animation)
+  {
+  case LED_ANIM_NONE:
+    return;
+
+  case LED_ANIM_FADE:
+    target->animElapsedMS += ms;
+    if(target->animElapsedMS >= target->animDurationMS)
+    {
+      brightness = target->animTo;
+      target->animation = LED_ANIM_NONE;
+    }
+    else
+    {
+      brightness = target->animFrom + (long)(target->animTo - target->animFrom) * target->animElapsedMS / target->animDurationMS;
+    }
+    break;
+
+  case LED_ANIM_PULSE:
+    // Triangle wave, gamma correction makes it look like breathing
+    target->animElapsedMS = (target->animElapsedMS + ms) % target->animDurationMS;
+    half = target->animDurationMS / 2;
+    phase = target->animElapsedMS < half ? target->animElapsedMS : target->animDurationMS - target->animElapsedMS;
+    brightness = target->animFrom + (long)(target->animTo - target->animFrom) * phase / half;
+    break;
+
+  default:
+    return;
+  }
+
+  led_write_(id, brightness);
+}
+
+void led_write_(int id, int brightness)
+{
+  int output;
+  LEDAbstraction * target = led_getInstance(id);
+
+  if(brightness < 0)
+    brightness = 0;
+  else if(brightness > LED_MAX_BRIGHTNESS)
+    brightness = LED_MAX_BRIGHTNESS;
+  target->brightness = brightness;
+
+  // Lines with neither PWM nor a BAM channel can only be on or off
+  if(target->hasPWM || target->bamChannel != NONE)
+    output = pgm_read_byte(&ledGammaTable[brightness]);
+  else
+    output = brightness >= LED_DIGITAL_THRESHOLD ? HIGH : LOW;
+
+  if(output == target->output)
+    return;
+  target->output = output;
+
+  if(target->hasPWM)
+    analogWrite(target->line, output);
+  else if(target->bamChannel != NONE)
+    bam_setLevel(target->bamChannel, output);
+  else
+    fastio_writeCached(target->outReg, target->outMask, target->line, output);
+}
+
+void bam_init()
+{
+  bamNumPorts = 0;
+  bamNumChannels = 0;
+  bamBit = 0;
+}
+
+int bam_addChannel(byte line)
+{
+  int i;
+  int portIndex;
+  byte oldSREG;
+  volatile uint8_t * port;
+  BamChannel * channel;
+
+  if(bamNumChannels >= BAM_MAX_CHANNELS)
+    return NONE;
+
+  // Find (or claim) the port table entry for this line
+  port = fastio_getPort(line);
+  portIndex = NONE;
+  for(i = 0; i < bamNumPorts; i++)
+  {
+    if(bamPorts[i].port == port)
+      portIndex = i;
+  }
+
+  if(portIndex == NONE)
+  {
+    if(bamNumPorts >= BAM_MAX_PORTS)
+      return NONE;
+    portIndex = bamNumPorts;
+    bamPorts[portIndex].port = port;
+    bamPorts[portIndex].mask = 0;
+    for(i = 0; i < BAM_BITS; i++)
+      bamPorts[portIndex].planes[i] = 0;
+  }
+
+  channel = &(bamChannels[bamNumChannels]);
+  channel->line = line;
+  channel->portIndex = portIndex;
+  channel->mask = FASTIO_MASK(line);
+  channel->level = 0;
+
+  // The interrupt must never see a half built port entry
+  oldSREG = SREG;
+  cli();
+  bamPorts[portIndex].mask |= channel->mask;
+  if(portIndex == bamNumPorts)
+    bamNumPorts++;
+  SREG = oldSREG;
+
+  if(bamNumChannels == 0)
+    bam_startTimer_();
+
+  return bamNumChannels++;
+}
+
+void bam_setLevel(int id, byte level)
+{
+  byte i;
+  BamChannel * channel = &(bamChannels[id]);
+  BamPort * port = &(bamPorts[channel->portIndex]);
+
+  channel->level = level;
+
+  // Single byte stores, the interrupt only ever reads the planes
+  for(i = 0; i < BAM_BITS; i++)
+  {
+    if(level & (1 << i))
+      port->planes[i] |= channel->mask;
+    else
+      port->planes[i] &= ~channel->mask;
+  }
+
+#if !defined(__AVR__)
+  analogWrite(channel->line, level);
+#endif
+}
+
+#if defined(__AVR__)
+
+boolean bam_usesPin(byte line)
+{
+  return digitalPinToTimer(line) == TIMER2A || digitalPinToTimer(line) == TIMER2B;
+}
+
+void bam_startTimer_()
+{
+  byte oldSREG = SREG;
+  cli();
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS22) | _BV(CS20);
+  TCNT2 = 0;
+  OCR2A = BAM_LSB_TICKS - 1;
+  TIFR2 = _BV(OCF2A);
+  TIMSK2 = _BV(OCIE2A);
+  SREG = oldSREG;
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+  bam_onTimer_();
+}
+
+#else
+
+// Off the board the HAL records each channel's duty through analogWrite
+
+boolean bam_usesPin(byte line)
+{
+  return false;
+}
+
+void bam_startTimer_()
+{
+}
+
+#endif
+
+void bam_onTimer_()
+{
+  byte i;
+  byte bit = bamBit;
+  BamPort * port;
+
+  // Length of this plane first, while the counter is still near zero
+#if defined(__AVR__)
+  OCR2A = (BAM_LSB_TICKS << bit) - 1;
+
+  // Taken late behind another interrupt, the counter can already be past
+  // a short plane's compare value (OCR2A is not buffered in CTC mode). It
+  // would run round to 255 first, so time the plane from now instead
+  if(TCNT2 >= OCR2A)
+    TCNT2 = 0;
+#endif
+
+  for(i = 0; i < bamNumPorts; i++)
+  {
+    port = &(bamPorts[i]);
+    *(port->port) = (*(port->port) & ~port->mask) | port->planes[bit];
+  }
+
+  bamBit = (bit + 1) & (BAM_BITS - 1);
+}
+
+void bam_benchmark()
+{
+#if defined(__AVR__) && defined(BAM_BENCHMARK)
+  int i;
+  int channel;
+  volatile unsigned long loops;
+  unsigned long baseline;
+  unsigned long endMS;
+
+  // Busy loop throughput with no interrupt load from the driver
+  TIMSK2 = 0;
+  loops = 0;
+  endMS = millis() + BAM_BENCHMARK_MS;
+  while(millis() < endMS)
+    loops++;
+  baseline = loops;
+
+  Serial.print("BAM channels, loops, load (per mille)\n");
+  for(i = 0; i < BAM_BENCHMARK_NUM_PINS; i++)
+  {
+    channel = bam_addChannel(bamBenchmarkPins[i]);
+    if(channel == NONE)
+      break;
+    bam_setLevel(channel, BAM_BENCHMARK_LEVEL);
+    TIMSK2 = _BV(OCIE2A);
+
+    loops = 0;
+    endMS = millis() + BAM_BENCHMARK_MS;
+    while(millis() < endMS)
+      loops++;
+
+    Serial.print(bamNumChannels);
+    Serial.print(", ");
+    Serial.print(loops);
+    Serial.print(", ");
+    Serial.print((baseline - loops) * 1000 / baseline);
+    Serial.print("\n");
+  }
+
+  // Leave the driver empty for the real LEDs
+  TIMSK2 = 0;
+  for(i = 0; i < bamNumPorts; i++)
+    *(bamPorts[i].port) &= ~bamPorts[i].mask;
+  bam_init();
+#endif
 }
 
 Jellyfish * jellyfish_getInstance(int id)
@@ -707,33 +1784,284 @@ Jellyfish * jellyfish_getInstance(int id)
   return &(jellyfish[id]);
 }
 
-void jellyfish_init(int id, int servoNum, int ledNum)
+void jellyfish_init(int id, int axis, int ledNum)
 {
   // Save properties
   Jellyfish * jellyfish = jellyfish_getInstance(id);
-  jellyfish->servoNum = servoNum;
+  jellyfish->axis = axis;
   jellyfish->ledNum = ledNum;
-  jellyfish_raise(id);
+  jellyfish->phaseOffset = (long)id * 256 / NUM_JELLYFISH;
+  if(id >= jellyfishWave.numJellyfish)
+    jellyfishWave.numJellyfish = id + 1;
+  jellyfish_raise(id); // Jumps there, a servo never written has nothing to ease from
 }
 
 void jellyfish_lower(int id)
 {
   Jellyfish * jellyfish = jellyfish_getInstance(id);
-  lrs_setAngle(jellyfish->servoNum, JELLYFISH_LOWERED_ANGLE);
-  led_turnOn(jellyfish->ledNum);
+  jellyfish->lowered = true;
+  jellyfish->waving = false;
+  if(axis_reserve(jellyfish->axis, JELLYFISH_OWNER, id, JELLYFISH_PRIORITY))
+  {
+    axis_setSpeed(jellyfish->axis, JELLYFISH_SLEW_RATE);
+    axis_startMovingTo(jellyfish->axis, JELLYFISH_LOWERED_ANGLE);
+  }
+  led_fadeTo(jellyfish->ledNum, JELLYFISH_GLOW_MAX, JELLYFISH_FADE_IN_MS);
 }
 
 void jellyfish_raise(int id)
 {
   Jellyfish * jellyfish = jellyfish_getInstance(id);
-  lrs_setAngle(jellyfish->servoNum, JELLYFISH_RAISED_ANGLE);
-  led_turnOff(jellyfish->ledNum);
+  jellyfish->lowered = false;
+  jellyfish->waving = false;
+  led_fadeTo(jellyfish->ledNum, 0, JELLYFISH_FADE_OUT_MS);
+  if(!axis_reserve(jellyfish->axis, JELLYFISH_OWNER, id, JELLYFISH_PRIORITY))
+    return;
+
+  // Held until it is up, or given straight back if it jumped there
+  axis_setSpeed(jellyfish->axis, JELLYFISH_SLEW_RATE);
+  axis_startMovingTo(jellyfish->axis, JELLYFISH_RAISED_ANGLE);
+  if(!axis_isMoving(jellyfish->axis))
+    axis_release(jellyfish->axis, JELLYFISH_OWNER, id);
+}
+
+void jellyfish_onServoGoalReached(int id, int axis)
+{
+  Jellyfish * jellyfish = jellyfish_getInstance(id);
+  if(!jellyfish->lowered)
+    axis_release(axis, JELLYFISH_OWNER, id);
 }
 
 void jellyfish_step(int id, long ms)
 {
+  int wave;
+  boolean holdsAxis;
   Jellyfish * jellyfish = jellyfish_getInstance(id);
-  lrs_step(jellyfish->servoNum, ms);
+  axis_stepIfOwnedBy(jellyfish->axis, JELLYFISH_OWNER, id, ms);
+  led_step(jellyfish->ledNum, ms);
+
+  if(!jellyfish->lowered)
+    return;
+
+  // Without the axis (another jellyfish on it holds it) only the led waves
+  holdsAxis = axis_isOwnedBy(jellyfish->axis, JELLYFISH_OWNER, id);
+
+  // Once in view, ease onto where the wave will be when the blend is done
+  if(!jellyfish->waving)
+  {
+    if((holdsAxis && axis_isMoving(jellyfish->axis)) || led_isAnimating(jellyfish->ledNum))
+      return;
+    jellyfish->waving = true;
+    wave = jellyfish_getWave_(id, JELLYFISH_WAVE_BLEND_MS);
+    if(holdsAxis)
+      axis_startMovingTo(jellyfish->axis, JELLYFISH_LOWERED_ANGLE + (long)JELLYFISH_WAVE_BOB_ANGLE * wave / 255);
+    led_fadeTo(jellyfish->ledNum, JELLYFISH_GLOW_MIN + (long)(JELLYFISH_GLOW_MAX - JELLYFISH_GLOW_MIN) * wave / 255,
+               JELLYFISH_WAVE_BLEND_MS);
+    return;
+  }
+  if(led_isAnimating(jellyfish->ledNum))
+    return;
+
+  // Bob and glow together, gamma correction makes the glow look like breathing
+  wave = jellyfish_getWave_(id, 0);
+  if(holdsAxis)
+    axis_track(jellyfish->axis, JELLYFISH_LOWERED_ANGLE + (long)JELLYFISH_WAVE_BOB_ANGLE * wave / 255);
+  led_setBrightness(jellyfish->ledNum, JELLYFISH_GLOW_MIN + (long)(JELLYFISH_GLOW_MAX - JELLYFISH_GLOW_MIN) * wave / 255);
+}
+
+void jellyfish_stepAll(long ms)
+{
+  int i;
+
+  jellyfishWave.phase += (unsigned long)ms * JELLYFISH_WAVE_PHASE_PER_MS;
+  for(i = 0; i < jellyfishWave.numJellyfish; i++)
+    jellyfish_step(i, ms);
+}
+
+void jellyfish_setPhaseOffset(int id, byte phaseOffset)
+{
+  Jellyfish * jellyfish = jellyfish_getInstance(id);
+  jellyfish->phaseOffset = phaseOffset;
+}
+
+int jellyfish_getWave_(int id, long aheadMS)
+{
+  byte phase;
+  Jellyfish * jellyfish = jellyfish_getInstance(id);
+
+  // Behind the shared phase by the offset, so the crest passes jellyfish 0 first
+  phase = ((jellyfishWave.phase + (unsigned long)aheadMS * JELLYFISH_WAVE_PHASE_PER_MS) >> 24) - jellyfish->phaseOffset;
+  return pgm_read_byte(&jellyfishWaveTable[phase / (256 / JELLYFISH_WAVE_TABLE_SIZE)]);
+}
+
+void jellyfish_benchmark()
+{
+#if defined(JELLYFISH_BENCHMARK)
+  int i;
+  int count;
+  unsigned long startUS;
+  unsigned long elapsedUS;
+  Jellyfish * first = jellyfish_getInstance(0);
+
+  // Extra jellyfish reuse jellyfish 0's hardware. Only jellyfish 0 holds
+  // the axis, so the others time the wave and led work without a servo
+  for(i = jellyfishWave.numJellyfish; i < NUM_JELLYFISH; i++)
+    jellyfish_init(i, first->axis, first->ledNum);
+  axis_reserve(first->axis, JELLYFISH_OWNER, 0, JELLYFISH_PRIORITY);
+  for(i = 0; i < NUM_JELLYFISH; i++)
+  {
+    jellyfish_getInstance(i)->lowered = true;
+    jellyfish_getInstance(i)->waving = true;
+  }
+
+  Serial.print("Jellyfish, us per step\n");
+  for(count = 1; count <= NUM_JELLYFISH; count++)
+  {
+    jellyfishWave.numJellyfish = count;
+    startUS = micros();
+    for(i = 0; i < JELLYFISH_BENCHMARK_TICKS; i++)
+      jellyfish_stepAll(SHORT_TIME_STEP);
+    elapsedUS = micros() - startUS;
+
+    Serial.print(count);
+    Serial.print(", ");
+    Serial.print((float)elapsedUS / JELLYFISH_BENCHMARK_TICKS);
+    Serial.print("\n");
+  }
+
+  // Back to the real jellyfish, out of view
+  jellyfishWave.numJellyfish = 1;
+  jellyfish_raise(0);
+#endif
+}
+
+boolean og_isBlocked(const OgPoint * point)
+{
+  long fixed[3];
+
+  og_toGrid_(point, fixed);
+  return og_isCellBlocked_(fixed[0] / OG_SUBCELLS, fixed[1] / OG_SUBCELLS, fixed[2] / OG_SUBCELLS);
+}
+
+boolean og_isSegmentClear(const OgPoint * from, const OgPoint * to)
+{
+  int i;
+  int axis;
+  long start[3];
+  long end[3];
+  int cell[3];
+  int lastCell[3];
+  int step[3];
+  long delta[3];
+  long toNext[3]; // Along each axis, from the start to the next cell boundary
+
+  og_toGrid_(from, start);
+  og_toGrid_(to, end);
+  for(i = 0; i < 3; i++)
+  {
+    cell[i] = start[i] / OG_SUBCELLS;
+    lastCell[i] = end[i] / OG_SUBCELLS;
+    delta[i] = labs(end[i] - start[i]);
+    if(end[i] >= start[i])
+    {
+      step[i] = 1;
+      toNext[i] = (long)(cell[i] + 1) * OG_SUBCELLS - start[i];
+    }
+    else
+    {
+      step[i] = -1;
+      toNext[i] = start[i] - (long)cell[i] * OG_SUBCELLS;
+    }
+  }
+
+  while(!og_isCellBlocked_(cell[0], cell[1], cell[2]))
+  {
+    if(cell[0] == lastCell[0] && cell[1] == lastCell[1] && cell[2] == lastCell[2])
+      return true;
+
+    // Cross the boundary the segment meets first, the smallest
+    // toNext / delta, compared multiplied out (at most 2^12 * 2^12)
+    axis = NONE;
+    for(i = 0; i < 3; i++)
+    {
+      if(cell[i] == lastCell[i])
+        continue;
+      if(axis == NONE || toNext[i] * delta[axis] < toNext[axis] * delta[i])
+        axis = i;
+    }
+    cell[axis] += step[axis];
+    toNext[axis] += OG_SUBCELLS;
+  }
+  return false;
+}
+
+boolean og_findDetour(const OgPoint * from, const OgPoint * to, OgPoint * waypoint)
+{
+  int i;
+  int distance;
+  long fromFixed[3];
+  long toFixed[3];
+  OgPoint middle;
+
+  // Middle of the part of the move inside the tank
+  og_toGrid_(from, fromFixed);
+  og_toGrid_(to, toFixed);
+  middle.x = MIN_X_VAL + (fromFixed[0] + toFixed[0]) / 2 * (OG_CELL_X_STEPS / OG_SUBCELLS);
+  middle.y = MIN_Y_VAL + (fromFixed[1] + toFixed[1]) / 2 * (OG_CELL_Y_STEPS / OG_SUBCELLS);
+  middle.z = MIN_Z_VAL + (fromFixed[2] + toFixed[2]) / 2 * (OG_CELL_Z_STEPS / OG_SUBCELLS);
+
+  for(distance = 1; distance <= OG_MAX_DETOUR_CELLS; distance++)
+  {
+    for(i = 0; i < OG_NUM_DETOUR_DIRECTIONS; i++)
+    {
+      waypoint->x = middle.x + (long)(signed char)pgm_read_byte(&ogDetourDirections[i][0]) * distance * OG_CELL_X_STEPS;
+      waypoint->y = middle.y + (long)(signed char)pgm_read_byte(&ogDetourDirections[i][1]) * distance * OG_CELL_Y_STEPS;
+      waypoint->z = middle.z + (long)(signed char)pgm_read_byte(&ogDetourDirections[i][2]) * distance * OG_CELL_Z_STEPS;
+      if(waypoint->x < MIN_X_VAL || waypoint->x >= MAX_X_VAL || waypoint->y < MIN_Y_VAL ||
+         waypoint->y >= MAX_Y_VAL || waypoint->z < MIN_Z_VAL || waypoint->z >= MAX_Z_VAL)
+        continue;
+      if(!og_isBlocked(waypoint) && og_isSegmentClear(from, waypoint) && og_isSegmentClear(waypoint, to))
+        return true;
+    }
+  }
+  return false;
+}
+
+void og_toGrid_(const OgPoint * point, long * fixed)
+{
+  fixed[0] = (constrain(point->x, MIN_X_VAL, MAX_X_VAL - 1) - MIN_X_VAL) / (OG_CELL_X_STEPS / OG_SUBCELLS);
+  fixed[1] = (constrain(point->y, MIN_Y_VAL, MAX_Y_VAL - 1) - MIN_Y_VAL) / (OG_CELL_Y_STEPS / OG_SUBCELLS);
+  fixed[2] = (constrain(point->z, MIN_Z_VAL, MAX_Z_VAL - 1) - MIN_Z_VAL) / (OG_CELL_Z_STEPS / OG_SUBCELLS);
+}
+
+boolean og_isCellBlocked_(int cellX, int cellY, int cellZ)
+{
+  return (pgm_read_word(&occupancyGrid[cellZ][cellY]) >> cellX) & 1;
+}
+
+void route_getAnchor(int anchor, OgPoint * point)
+{
+  route_getCellCentre_(pgm_read_byte(&routeAnchors[anchor][0]), pgm_read_byte(&routeAnchors[anchor][1]),
+                       pgm_read_byte(&routeAnchors[anchor][2]), point);
+}
+
+int route_getLength(int fromAnchor, int toAnchor)
+{
+  return pgm_read_byte(&routeLengths[fromAnchor][toAnchor]);
+}
+
+void route_getWaypoint(int fromAnchor, int toAnchor, int index, OgPoint * point)
+{
+  uint16_t packed = pgm_read_word(&routeWaypoints[pgm_read_byte(&routeOffsets[fromAnchor][toAnchor]) + index]);
+
+  route_getCellCentre_(ROUTE_CELL_X(packed), ROUTE_CELL_Y(packed), ROUTE_CELL_Z(packed), point);
+}
+
+void route_getCellCentre_(int cellX, int cellY, int cellZ, OgPoint * point)
+{
+  point->x = MIN_X_VAL + (long)cellX * OG_CELL_X_STEPS + OG_CELL_X_STEPS / 2;
+  point->y = MIN_Y_VAL + (long)cellY * OG_CELL_Y_STEPS + OG_CELL_Y_STEPS / 2;
+  point->z = MIN_Z_VAL + (long)cellZ * OG_CELL_Z_STEPS + OG_CELL_Z_STEPS / 2;
 }
 
 Fish * fish_getInstance(int id)
@@ -745,28 +2073,37 @@ void fish_stop(int id)
 {
   Fish * targetFish = fish_getInstance(id);
 
-  // Save servo nums
-  crs_stop(targetFish->xServo);
-  crs_stop(targetFish->yServo);
-  crs_stop(targetFish->zServo);
+  targetFish->detouring = false;
+  targetFish->anchor = NONE;
+  targetFish->routeFrom = NONE;
+  targetFish->routeTo = NONE;
+
+  // Axes lent out are left to their current owner
+  if(axis_isOwnedBy(targetFish->xAxis, FISH_OWNER, id))
+    axis_stop(targetFish->xAxis);
+  if(axis_isOwnedBy(targetFish->yAxis, FISH_OWNER, id))
+    axis_stop(targetFish->yAxis);
+  if(axis_isOwnedBy(targetFish->zAxis, FISH_OWNER, id))
+    axis_stop(targetFish->zAxis);
 }
 
-void fish_init(int id, int xServoNum, int yServoNum, int zServoNum, int thetaServo)
+void fish_init(int id, int xAxis, int yAxis, int zAxis, int thetaAxis)
 {
   Fish * targetFish = fish_getInstance(id);
 
   // Save servo nums
-  targetFish->xServo = xServoNum;
-  crs_setOwner(xServoNum, FISH_OWNER, id);
-  targetFish->yServo = yServoNum;
-  crs_setOwner(yServoNum, FISH_OWNER, id);
-  targetFish->zServo = zServoNum;
-  crs_setOwner(zServoNum, FISH_OWNER, id);
-  targetFish->thetaServo = thetaServo;
+  targetFish->xAxis = xAxis;
+  axis_reserve(xAxis, FISH_OWNER, id, FISH_PRIORITY);
+  targetFish->yAxis = yAxis;
+  axis_reserve(yAxis, FISH_OWNER, id, FISH_PRIORITY);
+  targetFish->zAxis = zAxis;
+  axis_reserve(zAxis, FISH_OWNER, id, FISH_PRIORITY);
+  targetFish->thetaAxis = thetaAxis;
   targetFish->numWaitingServos = 0;
-
-  // Start going home
-  fish_goTo(id, 0, 0, 0);
+  targetFish->detouring = false;
+  targetFish->anchor = NONE;
+  targetFish->routeFrom = NONE;
+  targetFish->routeTo = NONE;
 }
 
 void fish_goTo(long id, long targetX, long targetY, long targetZ)
@@ -780,6 +2117,9 @@ void fish_goTo(long id, long targetX, long targetY, long targetZ)
   double targetTheta;
   byte limitingAxis;
   float limitingAxisDistance;
+  OgPoint from;
+  OgPoint to;
+  OgPoint waypoint;
 
   Fish * target = fish_getInstance(id);
 
@@ -789,9 +2129,9 @@ void fish_goTo(long id, long targetX, long targetY, long targetZ)
    target->targetZ = targetZ;
    
    // Get current position
-   currentX = crs_getPos(target->xServo);
-   currentY = crs_getPos(target->yServo);
-   currentZ = crs_getPos(target->zServo);
+   currentX = axis_getPos(target->xAxis);
+   currentY = axis_getPos(target->yAxis);
+   currentZ = axis_getPos(target->zAxis);
    
    // Find vector
    deltaX = targetX - currentX;
@@ -811,7 +2151,7 @@ void fish_goTo(long id, long targetX, long targetY, long targetZ)
    }
    
    // Change orientation as quickly as possible
-   crs_startMovingToAngle(target->thetaServo, targetTheta);
+   axis_startMovingToAngle(target->thetaAxis, targetTheta);
    
    // Determine limiting axis for this goal
    if(deltaX > deltaY)
@@ -841,18 +2181,95 @@ void fish_goTo(long id, long targetX, long targetY, long targetZ)
 
   // Start off to first positional subgoal
   //fish_goToNextInternalGoal_(id); // TODO: Cos wiggle
-  crs_setTargetVelocity(target->xServo, target->velocity);
-  crs_startMovingTo(target->xServo, targetX);
-  crs_setTargetVelocity(target->yServo, target->velocity);
-  crs_startMovingTo(target->yServo, targetY);
-  crs_setTargetVelocity(target->zServo, target->velocity);
-  crs_startMovingTo(target->zServo, targetZ);
+  target->targetX = targetX;
+  target->targetY = targetY;
+  target->targetZ = targetZ;
+  target->anchor = NONE;
+  target->routeFrom = NONE;
+  target->routeTo = NONE;
+
+  // Go around any decoration in the way
+  from.x = axis_getPos(target->xAxis);
+  from.y = axis_getPos(target->yAxis);
+  from.z = axis_getPos(target->zAxis);
+  to.x = targetX;
+  to.y = targetY;
+  to.z = targetZ;
+  target->detouring = !og_isSegmentClear(&from, &to) && og_findDetour(&from, &to, &waypoint);
+  if(target->detouring)
+    fish_startLeg_(id, waypoint.x, waypoint.y, waypoint.z);
+  else
+    fish_startLeg_(id, targetX, targetY, targetZ);
+}
+
+void fish_goToAnchor(int id, int anchor)
+{
+  OgPoint point;
+  Fish * target = fish_getInstance(id);
+
+  route_getAnchor(anchor, &point);
+
+  // Only routes between anchors are in the table
+  if(target->anchor == NONE || target->anchor == anchor)
+  {
+    fish_goTo(id, point.x, point.y, point.z);
+    target->routeTo = anchor;
+    return;
+  }
+
+  target->targetX = point.x;
+  target->targetY = point.y;
+  target->targetZ = point.z;
+  target->detouring = false;
+  target->routeFrom = target->anchor;
+  target->routeTo = anchor;
+  target->routeIndex = 0;
+  target->anchor = NONE;
+  fish_followRoute_(id);
+}
+
+void fish_followRoute_(int id)
+{
+  OgPoint waypoint;
+  Fish * target = fish_getInstance(id);
+
+  if(target->routeIndex < route_getLength(target->routeFrom, target->routeTo))
+  {
+    route_getWaypoint(target->routeFrom, target->routeTo, target->routeIndex, &waypoint);
+    fish_startLeg_(id, waypoint.x, waypoint.y, waypoint.z);
+  }
+  else
+  {
+    fish_startLeg_(id, target->targetX, target->targetY, target->targetZ);
+  }
+}
+
+void fish_startLeg_(int id, long x, long y, long z)
+{
+  Fish * target = fish_getInstance(id);
+
+  target->legX = x;
+  target->legY = y;
+  target->legZ = z;
+  fish_moveAxis_(id, target->xAxis, x);
+  fish_moveAxis_(id, target->yAxis, y);
+  fish_moveAxis_(id, target->zAxis, z);
 
   // We are waiting on a few servos
-  target->numWaitingServos = 4;
+  target->numWaitingServos = 3; // x, y and z, theta is not driven
 }
 
-void fish_onServoGoalReached(int id, int servoID)
+void fish_moveAxis_(int id, int axis, long position)
+{
+  Fish * target = fish_getInstance(id);
+
+  if(!axis_isOwnedBy(axis, FISH_OWNER, id))
+    return;
+  axis_setSpeed(axis, target->velocity);
+  axis_startMovingTo(axis, position);
+}
+
+void fish_onServoGoalReached(int id, int axis)
 {
   Fish * target = fish_getInstance(id);
   target->numWaitingServos--;
@@ -860,11 +2277,44 @@ void fish_onServoGoalReached(int id, int servoID)
     fish_onGoalReached(id);
 }
 
+void fish_onServoReturned(int id, int axis)
+{
+  long goal;
+  Fish * target = fish_getInstance(id);
+
+  if(axis == target->xAxis)
+    goal = target->legX;
+  else if(axis == target->yAxis)
+    goal = target->legY;
+  else
+    goal = target->legZ;
+  fish_moveAxis_(id, axis, goal);
+}
+
 void fish_onGoalReached(int id)
 {
   Fish * target = fish_getInstance(id);
 
-  Serial.print("Here :(\n");
+  DEBUG_PRINT("Here :(\n");
+
+  // Only a waypoint, carry on to the target
+  if(target->detouring)
+  {
+    target->detouring = false;
+    fish_startLeg_(id, target->targetX, target->targetY, target->targetZ);
+    return;
+  }
+
+  // Only a waypoint of a route, carry on along it
+  if(target->routeFrom != NONE && target->routeIndex < route_getLength(target->routeFrom, target->routeTo))
+  {
+    target->routeIndex++;
+    fish_followRoute_(id);
+    return;
+  }
+  target->anchor = target->routeTo;
+  target->routeFrom = NONE;
+  target->routeTo = NONE;
 
   // Determine if subgoal or actual goal
   target->subStepsLeftToGoal--;
@@ -909,34 +2359,34 @@ void fish_goToNextInternalGoal_(int id)
   // Update x goal
   newGoalX = (long)(newGoalGeneral * target->xSpeedPortion  + target->startX);
   newGoalX += xWiggleOffset;
-  crs_startMovingTo(target->xServo, newGoalX);
+  axis_startMovingTo(target->xAxis, newGoalX);
 
   // Update y goal
   newGoalY = (long)(newGoalGeneral * target->ySpeedPortion + target->startY);
   newGoalY += yWiggleOffset;
-  crs_startMovingTo(target->yServo, newGoalY);
+  axis_startMovingTo(target->yAxis, newGoalY);
 
   // Update z goal
   newGoalZ = (long)(newGoalGeneral * target->zSpeedPortion + target->startZ);
-  crs_startMovingTo(target->zServo, newGoalZ);
+  axis_startMovingTo(target->zAxis, newGoalZ);
 }
 
 void fish_step(int id, long ms)
 {
   Fish * target = fish_getInstance(id);
-  crs_step(target->xServo, ms);
-  crs_step(target->yServo, ms);
-  crs_step(target->zServo, ms);
-  //crs_step(target->thetaServo, ms);
+  axis_stepIfOwnedBy(target->xAxis, FISH_OWNER, id, ms);
+  axis_stepIfOwnedBy(target->yAxis, FISH_OWNER, id, ms);
+  axis_stepIfOwnedBy(target->zAxis, FISH_OWNER, id, ms);
+  //axis_step(target->thetaAxis, ms);
 }
 
 void fish_setVelocity(int id, float velocity)
 {
   Fish * target = fish_getInstance(id);
   target->velocity = velocity;
-  /*crs_setTargetVelocity(target->xServo, velocity);
-   crs_setTargetVelocity(target->yServo, velocity);
-   crs_setTargetVelocity(target->zServo, velocity);*/
+  /*axis_setSpeed(target->xAxis, velocity);
+   axis_setSpeed(target->yAxis, velocity);
+   axis_setSpeed(target->zAxis, velocity);*/
 }
 
 PiezoSensorGroup * psg_getInstance(int id)
@@ -1030,6 +2480,16 @@ int piezoSensorGroupNum)
   target->lightSensorNum = lightSensorNum;
   target->piezoSensorGroupNum = piezoSensorGroupNum;
   target->isLight = true;
+  target->state = AQ_STATE_FISH;
+  target->lastTappedSensor = NONE;
+  target->tapFiltering = true;
+  target->fleeAnchor = NONE;
+  target->lastTapMS = 0;
+  target->fleeStartMS = 0;
+  target->numTaps = 0;
+  target->numTapsDropped = 0;
+  target->traceNext = 0;
+  target->numTransitions = 0;
 
   // Setup necessary state for time keeping
   target->lastMS = millis();
@@ -1051,23 +2511,34 @@ void aquarium_shortStep(int id, long ms)
   // Check sensors
   tappedSensor = psg_getTapped(target->piezoSensorGroupNum);
   curLight = ls_isLight(target->lightSensorNum);
-  Serial.print("isLight:");
-  Serial.print(target->lightSensorNum);
-  Serial.print("\n");
+  DEBUG_PRINT("isLight:");
+  DEBUG_PRINT(target->lightSensorNum);
+  DEBUG_PRINT("\n");
 
   // Respond to tap
   if(tappedSensor != NONE)
-      aquarium_runFishToOpposingSide_(id, tappedSensor);
+  {
+    if(aquarium_acceptTap_(id, tappedSensor))
+    {
+      fr_record(FR_EVENT_TAP, id, tappedSensor);
+      target->lastTappedSensor = tappedSensor;
+      aquarium_dispatch_(id, AQ_EVENT_TAP);
+    }
+    else
+    {
+      fr_record(FR_EVENT_TAP_DROPPED, id, tappedSensor);
+    }
+  }
+
+  // Jellyfish motion is eased, so it is advanced at the short step rate
+  jellyfish_stepAll(ms);
 
   // Repond to light
   if(curLight != target->isLight) // If the light sensor state has changed
   {
     target->isLight = curLight;
-
-    if(curLight)
-      aquarium_transitionToFishState_(id);
-    else
-      aquarium_transitionToJellyfishState_(id);
+    fr_record(FR_EVENT_LIGHT, id, curLight);
+    aquarium_dispatch_(id, curLight ? AQ_EVENT_LIGHT : AQ_EVENT_DARK);
   }
 }
 
@@ -1075,7 +2546,6 @@ void aquarium_longStep(int id, long ms)
 {
   Aquarium * target = aquarium_getInstance(id);
 
-  jellyfish_step(target->jellyfishNum, ms);
   fish_step(target->fishNum, ms);
 }
 
@@ -1099,12 +2569,12 @@ void aquarium_transitionToFishState_(int id)
 {
   Aquarium * target = aquarium_getInstance(id);
   jellyfish_raise(target->jellyfishNum);
-  aquarium_onFishReachedGoal(id, target->fishNum);
+  aquarium_continuePatrol_(id);
 }
 
 void aquarium_transitionToJellyfishState_(int id)
 {
-  Serial.print("Jellyfish?\n");
+  DEBUG_PRINT("Jellyfish?\n");
   Aquarium * target = aquarium_getInstance(id);
   fish_goTo(0, 0, 0, 1000000000);
   jellyfish_lower(target->jellyfishNum);
@@ -1125,7 +2595,10 @@ void aquarium_tick(int id, long newMS)
   // Check if long step was fired
   if(newLongMSRemain < 0)
   {
-    Serial.print("Long step \n");
+    DEBUG_PRINT("Long step \n");
+    // Only stalls, routine ticks would push everything else out of the ring
+    if(LONG_TIME_STEP - newLongMSRemain >= FR_TICK_OVERRUN_MS)
+      fr_record(FR_EVENT_TICK, id, LONG_TIME_STEP - newLongMSRemain);
     aquarium_longStep(id, LONG_TIME_STEP - newLongMSRemain);
     newLongMSRemain = LONG_TIME_STEP;
   }
@@ -1134,7 +2607,7 @@ void aquarium_tick(int id, long newMS)
   // Check if short step was fired
   if(newShortMSRemain < 0)
   {
-    Serial.print("Short step \n");
+    DEBUG_PRINT("Short step \n");
     aquarium_shortStep(id, SHORT_TIME_STEP - newShortMSRemain);
     newShortMSRemain = SHORT_TIME_STEP;
   }
@@ -1144,53 +2617,606 @@ void aquarium_tick(int id, long newMS)
   
   //perform events for every tick
   psg_onTick(target->piezoSensorGroupNum);
+  crs_stepCalibration();
+  crs_stepHoming();
 }
 
 void aquarium_onFishReachedGoal(int id, int fishID)
 {
-  Aquarium * target;
-  target = aquarium_getInstance(id);
-  if(target->isLight)
+  fr_record(FR_EVENT_GOAL_REACHED, id, fishID);
+  aquarium_dispatch_(id, AQ_EVENT_FISH_GOAL);
+}
+
+void aquarium_dispatch_(int id, byte event)
+{
+  byte fromState;
+  byte nextState;
+  byte action;
+  AquariumAction actionFunc;
+  AquariumTraceEntry * entry;
+  Aquarium * target = aquarium_getInstance(id);
+
+  fromState = target->state;
+  nextState = pgm_read_byte(&aquariumTransitions[fromState][event].nextState);
+  action = pgm_read_byte(&aquariumTransitions[fromState][event].action);
+
+  // Quiet self transitions are not worth a trace slot
+  if(nextState != fromState || action != AQ_ACTION_NONE)
+  {
+    entry = &(target->trace[target->traceNext]);
+    entry->ms = millis();
+    entry->fromState = fromState;
+    entry->event = event;
+    entry->toState = nextState;
+    target->traceNext = (target->traceNext + 1) % AQ_TRACE_LENGTH;
+    target->numTransitions++;
+    fr_record(FR_EVENT_TRANSITION, id, (fromState << 12) | (event << 8) | nextState);
+  }
+
+  // State first, so actions that raise further events see the new state
+  target->state = nextState;
+  actionFunc = (AquariumAction)pgm_read_ptr(&aquariumActions[action]);
+  actionFunc(id);
+}
+
+byte aquarium_getState(int id)
+{
+  Aquarium * target = aquarium_getInstance(id);
+  return target->state;
+}
+
+void aquarium_printTrace(int id)
+{
+  int i;
+  int numEntries;
+  int index;
+  AquariumTraceEntry * entry;
+  Aquarium * target = aquarium_getInstance(id);
+
+  numEntries = target->numTransitions < AQ_TRACE_LENGTH ? target->numTransitions : AQ_TRACE_LENGTH;
+  for(i = 0; i < numEntries; i++)
+  {
+    index = (target->traceNext + AQ_TRACE_LENGTH - numEntries + i) % AQ_TRACE_LENGTH;
+    entry = &(target->trace[index]);
+    Serial.print(entry->ms);
+    Serial.print(": ");
+    Serial.print(entry->fromState);
+    Serial.print(" -");
+    Serial.print(entry->event);
+    Serial.print("-> ");
+    Serial.print(entry->toState);
+    Serial.print("\n");
+  }
+}
+
+boolean aquarium_acceptTap_(int id, int tappedSensor)
+{
+  unsigned long now;
+  unsigned long sinceLastTap;
+  int anchor;
+  Aquarium * target = aquarium_getInstance(id);
+
+  target->numTaps++;
+  if(!target->tapFiltering)
+    return true;
+
+  now = millis();
+  sinceLastTap = now - target->lastTapMS;
+  anchor = aquarium_getFleeAnchor_(tappedSensor);
+
+  // Only a flee in progress is worth protecting
+  if(target->state == AQ_STATE_FLEEING)
   {
-    globalStep++;
-    globalStep %= 3;
-    fish_setVelocity(target->fishNum, 5000);
-    switch(globalStep)
+    if(anchor == target->fleeAnchor || sinceLastTap < TAP_COALESCE_MS ||
+       now - target->fleeStartMS < FLEE_REVERSE_HOLDOFF_MS)
     {
-      case 0:
-        fish_goTo(target->fishNum, 0, 0, 0);
-        break;
-      case 1:
-        fish_goTo(target->fishNum, 50000000, 5000000, 5000000);
-        break;
-      case 2:
-        fish_goTo(target->fishNum, 100000000, 0, 0);
-        break;
+      target->numTapsDropped++;
+      return false;
     }
   }
-  else
+
+  target->lastTapMS = now;
+  return true;
+}
+
+int aquarium_getFleeAnchor_(int tappedSensor)
+{
+  switch(tappedSensor)
+  {
+    case NORTHEAST:
+      return ROUTE_ANCHOR_SW;
+
+    case SOUTHEAST:
+      return ROUTE_ANCHOR_NW;
+
+    case SOUTHWEST:
+      return ROUTE_ANCHOR_NE;
+
+    case NORTHWEST:
+      return ROUTE_ANCHOR_SE;
+  }
+  return NONE;
+}
+
+void aquarium_setTapFiltering(int id, boolean enabled)
+{
+  Aquarium * target = aquarium_getInstance(id);
+  target->tapFiltering = enabled;
+}
+
+void aquarium_continuePatrol_(int id)
+{
+  Aquarium * target;
+  target = aquarium_getInstance(id);
+
+  globalStep++;
+  globalStep %= 3;
+  fish_setVelocity(target->fishNum, 5000);
+  switch(globalStep)
   {
-    fish_stop(target->fishNum);
+    case 0:
+      fish_goToAnchor(target->fishNum, ROUTE_ANCHOR_CENTRE);
+      break;
+    case 1:
+      fish_goTo(target->fishNum, 50000000, 5000000, 5000000);
+      break;
+    case 2:
+      fish_goTo(target->fishNum, 100000000, 0, 0);
+      break;
   }
 }
 
+void aquarium_flee_(int id)
+{
+  Aquarium * target = aquarium_getInstance(id);
+  target->fleeAnchor = aquarium_getFleeAnchor_(target->lastTappedSensor);
+  target->fleeStartMS = millis();
+  aquarium_runFishToOpposingSide_(id, target->lastTappedSensor);
+}
+
+void aquarium_stopFish_(int id)
+{
+  Aquarium * target = aquarium_getInstance(id);
+  fish_stop(target->fishNum);
+}
+
+void aquarium_doNothing_(int id)
+{
+}
+
 void aquarium_runFishToOpposingSide_(int id, int tappedSensor)
 {
+  int anchor;
   Aquarium * target;
   target = aquarium_getInstance(id);
   
   fish_setVelocity(0, 10000);
-  switch(tappedSensor)
+  anchor = aquarium_getFleeAnchor_(tappedSensor);
+  if(anchor != NONE)
+    fish_goToAnchor(target->fishNum, anchor);
+}
+
+void fr_init()
+{
+  byte i;
+  byte resetFlags = 0;
+
+#if defined(__AVR__)
+  // The watchdog stays armed across the reset it causes
+  resetFlags = MCUSR;
+  MCUSR = 0;
+  wdt_disable();
+#endif
+
+  // Anything but intact records from before the reset is power on noise
+  if(flightRecorder.magic != FR_MAGIC || flightRecorder.next >= FR_LENGTH ||
+     flightRecorder.count > FR_LENGTH)
   {
-    case NORTHEAST:
-    case SOUTHEAST:
-      fish_goTo(target->fishNum, -100000000, 0, 0);
+    flightRecorder.magic = FR_MAGIC;
+    flightRecorder.next = 0;
+    flightRecorder.count = 0;
+    for(i = 0; i < FR_NUM_TRACES; i++)
+      flightRecorder.traces[i].event = FR_NO_EVENT;
+  }
+
+#if defined(__AVR__)
+  if(resetFlags & _BV(WDRF))
+  {
+    Serial.print("Watchdog reset, last events:\n");
+    fr_dump();
+  }
+#endif
+
+  fr_record(FR_EVENT_BOOT, 0, resetFlags);
+}
+
+void fr_record(byte event, byte id, int arg)
+{
+  FlightRecord * record = fr_getTrace_(event, id);
+
+  if(record == NULL)
+  {
+    record = &(flightRecorder.records[flightRecorder.next]);
+    flightRecorder.next = (flightRecorder.next + 1) & (FR_LENGTH - 1);
+    if(flightRecorder.count < FR_LENGTH)
+      flightRecorder.count++;
+  }
+
+  record->ms = millis();
+  record->event = event;
+  record->id = id;
+  record->arg = arg;
+}
+
+FlightRecord * fr_getTrace_(byte event, byte id)
+{
+  if(id >= NUM_CONT_ROT_SERVOS)
+    return NULL;
+  if(event == FR_EVENT_VELOCITY)
+    return &(flightRecorder.traces[id]);
+  if(event == FR_EVENT_CORRECTION)
+    return &(flightRecorder.traces[NUM_CONT_ROT_SERVOS + id]);
+  return NULL;
+}
+
+void fr_dump()
+{
+  byte i;
+  byte j;
+  byte oldest;
+  byte numTraces;
+  byte traceOrder[FR_NUM_TRACES];
+  FlightRecord * record;
+  FlightRecord * trace;
+
+  // Order the filled trace slots by age (ms wraps, so compare differences)
+  numTraces = 0;
+  for(i = 0; i < FR_NUM_TRACES; i++)
+  {
+    if(flightRecorder.traces[i].event != FR_NO_EVENT)
+      traceOrder[numTraces++] = i;
+  }
+  for(i = 1; i < numTraces; i++)
+  {
+    oldest = traceOrder[i];
+    for(j = i; j > 0 && (int)(flightRecorder.traces[oldest].ms - flightRecorder.traces[traceOrder[j - 1]].ms) < 0; j--)
+      traceOrder[j] = traceOrder[j - 1];
+    traceOrder[j] = oldest;
+  }
+
+  // Then merge them into the ring as it is written out
+  Serial.print("Flight recorder ms event id arg\n");
+  j = 0;
+  for(i = 0; i < flightRecorder.count; i++)
+  {
+    record = &(flightRecorder.records[(flightRecorder.next - flightRecorder.count + i) & (FR_LENGTH - 1)]);
+    for(; j < numTraces; j++)
+    {
+      trace = &(flightRecorder.traces[traceOrder[j]]);
+      if((int)(trace->ms - record->ms) >= 0)
+        break;
+      fr_print_(trace);
+    }
+    fr_print_(record);
+  }
+  for(; j < numTraces; j++)
+    fr_print_(&(flightRecorder.traces[traceOrder[j]]));
+}
+
+void fr_print_(FlightRecord * record)
+{
+  Serial.print(record->ms);
+  Serial.print(" ");
+  Serial.print(record->event);
+  Serial.print(" ");
+  Serial.print(record->id);
+  Serial.print(" ");
+  Serial.print(record->arg);
+  Serial.print("\n");
+}
+
+void fr_startWatchdog()
+{
+#if defined(__AVR__) && defined(FR_WATCHDOG)
+  wdt_enable(WDTO_2S);
+#endif
+}
+
+void fr_poll()
+{
+#if defined(__AVR__) && defined(FR_WATCHDOG)
+  wdt_reset();
+#endif
+}
+
+void cs_init()
+{
+  byte address = EEPROM.read(CS_ADDRESS_EEPROM_ADDR);
+
+  // Erased EEPROM reads back as the broadcast address
+  clockSync.address = address == CS_BROADCAST_ADDRESS ? CS_DEFAULT_ADDRESS : address;
+  clockSync.active = false;
+  clockSync.frameLength = 0;
+  clockSync.inFrame = false;
+  clockSync.synced = false;
+  clockSync.refUs = 0;
+  clockSync.offsetUs = 0;
+  clockSync.skewPpm = 0;
+  clockSync.numScheduled = 0;
+}
+
+void cs_setAddress(byte address)
+{
+  if(address == CS_BROADCAST_ADDRESS)
+    return;
+  clockSync.address = address;
+  EEPROM.write(CS_ADDRESS_EEPROM_ADDR, address);
+}
+
+boolean cs_isActive()
+{
+  return clockSync.active;
+}
+
+boolean cs_isSynced()
+{
+  return clockSync.synced;
+}
+
+unsigned long cs_getSharedMicros()
+{
+  unsigned long local = micros();
+  long elapsedMS = (uint32_t)(local - clockSync.refUs) / 1000;
+
+  // Skew is bounded, so the correction fits a long for over half an hour.
+  // Wraps at 32 bits like micros() even where long is wider
+  return (uint32_t)(local + clockSync.offsetUs + elapsedMS * clockSync.skewPpm / 1000);
+}
+
+void cs_poll()
+{
+  int value;
+
+  while(Serial.available() > 0)
+  {
+    value = Serial.read();
+
+    if(!clockSync.inFrame)
+    {
+      if(value == CS_FRAME_START)
+      {
+        clockSync.frameStartUs = micros();
+        clockSync.inFrame = true;
+        clockSync.frameLength = 0;
+      }
+      else if(value == FR_DUMP_COMMAND)
+      {
+        fr_dump();
+      }
+    }
+    else if(value == CS_FRAME_END)
+    {
+      clockSync.frame[clockSync.frameLength] = '\0';
+      clockSync.inFrame = false;
+      cs_onFrame_(clockSync.frameStartUs);
+    }
+    else if(clockSync.frameLength < CS_FRAME_LENGTH - 1)
+    {
+      clockSync.frame[clockSync.frameLength++] = value;
+    }
+    else
+    {
+      clockSync.inFrame = false; // Too long to be ours, drop it
+    }
+  }
+
+  if(boot_isReady())
+    cs_runDue_();
+}
+
+void cs_onFrame_(unsigned long receivedUs)
+{
+  int numArgs;
+  long address;
+  long args[CS_MAX_ARGS];
+  unsigned long sharedBefore;
+  char type = clockSync.frame[0];
+  char * cursor = &(clockSync.frame[1]);
+  char * end;
+
+  address = strtoul(cursor, &end, 10);
+  if(end == cursor)
+    return;
+  if(address != clockSync.address && address != CS_BROADCAST_ADDRESS)
+    return;
+  clockSync.active = true;
+
+  for(numArgs = 0; numArgs < CS_MAX_ARGS; numArgs++)
+  {
+    cursor = end;
+    // Times use the full unsigned range, strtoul wraps negatives back
+    args[numArgs] = strtoul(cursor, &end, 10);
+    if(end == cursor)
       break;
-    
-    case SOUTHWEST:
-    case NORTHWEST:
-      fish_goTo(target->fishNum, 100000000, 0, 0);
+  }
+
+  switch(type)
+  {
+    case CS_FRAME_SYNC:
+      // Only one board may answer to a sync request
+      if(numArgs >= 1 && address == clockSync.address)
+        cs_reply_(args[0], receivedUs);
+      break;
+
+    case CS_FRAME_SET_CLOCK:
+      if(numArgs < 3)
+        break;
+      sharedBefore = cs_getSharedMicros();
+      clockSync.refUs = args[0];
+      clockSync.offsetUs = args[1];
+      clockSync.skewPpm = constrain(args[2], -CS_MAX_SKEW_PPM, CS_MAX_SKEW_PPM);
+      fr_record(FR_EVENT_CLOCK_SET, clockSync.address,
+                clockSync.synced ? (int32_t)(cs_getSharedMicros() - sharedBefore) / 1000 : 0);
+      clockSync.synced = true;
+      break;
+
+    case CS_FRAME_FISH_GOTO:
+      if(numArgs >= 4)
+        cs_schedule_(type, args);
+      break;
+
+    case CS_FRAME_JELLYFISH:
+      if(numArgs >= 2)
+        cs_schedule_(type, args);
       break;
+
+    case CS_FRAME_ADDRESS:
+      if(numArgs >= 1 && address == clockSync.address)
+        cs_setAddress(args[0]);
+      break;
+  }
+}
+
+void cs_reply_(long seq, unsigned long receivedUs)
+{
+  unsigned long sentUs;
+
+  // Anything queued ahead of the reply would delay it past its stamp
+  Serial.flush();
+  sentUs = micros();
+  Serial.print(CS_FRAME_START);
+  Serial.print(CS_FRAME_REPLY);
+  Serial.print(clockSync.address);
+  Serial.print(" ");
+  Serial.print(seq);
+  Serial.print(" ");
+  Serial.print(receivedUs);
+  Serial.print(" ");
+  Serial.print(sentUs);
+  Serial.print(CS_FRAME_END);
+}
+
+boolean cs_schedule_(char type, long * args)
+{
+  int i;
+  CsScheduledCommand * command;
+
+  if(clockSync.numScheduled >= CS_MAX_SCHEDULED)
+    return false;
+
+  command = &(clockSync.scheduled[clockSync.numScheduled]);
+  command->atUs = args[0];
+  command->type = type;
+  for(i = 0; i < CS_MAX_ARGS - 1; i++)
+    command->args[i] = args[i + 1];
+  clockSync.numScheduled++;
+  return true;
+}
+
+void cs_runDue_()
+{
+  int i;
+  long lateUs;
+  CsScheduledCommand command;
+
+  if(!clockSync.synced)
+    return;
+
+  i = 0;
+  while(i < clockSync.numScheduled)
+  {
+    lateUs = (int32_t)(cs_getSharedMicros() - clockSync.scheduled[i].atUs);
+    if(lateUs < 0)
+    {
+      i++;
+      continue;
+    }
+
+    // Remove before running, commands are free to queue more
+    command = clockSync.scheduled[i];
+    clockSync.numScheduled--;
+    clockSync.scheduled[i] = clockSync.scheduled[clockSync.numScheduled];
+    fr_record(FR_EVENT_SCHEDULED_RUN, command.type, lateUs / 1000);
+
+    // Each board drives a single fish and jellyfish
+    switch(command.type)
+    {
+      case CS_FRAME_FISH_GOTO:
+        fish_goTo(0, command.args[0], command.args[1], command.args[2]);
+        break;
+
+      case CS_FRAME_JELLYFISH:
+        if(command.args[0])
+          jellyfish_lower(0);
+        else
+          jellyfish_raise(0);
+        break;
+    }
+  }
+}
+
+void boot_init()
+{
+  int i;
+
+  for(i = 0; i < NUM_BOOT_TASKS; i++)
+    PT_INIT(&boot.pts[i]);
+  boot.done = 0;
+  boot.readyMS = 0;
+}
+
+void boot_step()
+{
+  int i;
+  byte after;
+  BootThread thread;
+
+  crs_stepCalibration();
+  crs_stepHoming();
+
+  for(i = 0; i < NUM_BOOT_TASKS; i++)
+  {
+    after = pgm_read_byte(&bootTasks[i].after);
+    if((boot.done & BOOT_AFTER(i)) || (boot.done & after) != after)
+      continue;
+
+    thread = (BootThread)pgm_read_ptr(&bootTasks[i].thread);
+    if(!PT_SCHEDULE(thread(&boot.pts[i], pgm_read_byte(&bootTasks[i].arg))))
+      boot.done |= BOOT_AFTER(i);
   }
+
+  if(boot_isReady())
+    boot.readyMS = millis();
+}
+
+boolean boot_isReady()
+{
+  return boot.done == BOOT_AFTER(NUM_BOOT_TASKS) - 1;
+}
+
+unsigned long boot_getReadyMS()
+{
+  return boot.readyMS;
+}
+
+char boot_fishThread_(Pt * pt, int id)
+{
+  PT_BEGIN(pt);
+
+  // Start going home
+  fish_goTo(id, 0, 0, 0);
+
+  PT_END(pt);
 }
 
+char boot_aquariumThread_(Pt * pt, int id)
+{
+  PT_BEGIN(pt);
+
+  aquarium_init(id, 0, 0, 0, 0);
+
+  fish_setVelocity(0, 5000);
+  fish_goTo(0, 50000000, 5000000, 5000000);
+
+  PT_END(pt);
+}
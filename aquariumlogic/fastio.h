@@ -0,0 +1,238 @@
+/**
+ * Name: fastio.h
+ * Desc: Direct port register digital I/O for output pins. With a constant
+ *       pin number the port and bit are resolved at compile time, so a set
+ *       or clear is a single sbi / cbi (2 cycles) instead of digitalWrite's
+ *       pin table lookup, PWM timer check and interrupt guard (~56 cycles)
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Note: Pins 0 - 13 are mapped for the ATmega328P (Uno) and ATmega2560
+ *       (Mega). Off the board the calls fall back to digitalWrite so the
+ *       host HAL still sees every write
+**/
+
+#ifndef FASTIO_H
+#define FASTIO_H
+
+#include <Arduino.h>
+
+#define FASTIO_NUM_PINS 14
+
+// Pin to port / bit tables
+
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+
+#define FASTIO_PORT_ID_(pin) ((pin) <= 3 || (pin) == 5 ? 'E' : (pin) == 4 ? 'G' : (pin) <= 9 ? 'H' : 'B')
+#define FASTIO_BIT_(pin) ((pin) < 2 ? (pin) : (pin) < 4 ? (pin) + 2 : (pin) == 4 ? 5 : \
+                          (pin) == 5 ? 3 : (pin) < 10 ? (pin) - 3 : (pin) - 6)
+#define FASTIO_PORT_(pin) (*(FASTIO_PORT_ID_(pin) == 'E' ? &PORTE : FASTIO_PORT_ID_(pin) == 'G' ? &PORTG : \
+                             FASTIO_PORT_ID_(pin) == 'H' ? &PORTH : &PORTB))
+#define FASTIO_DDR_(pin) (*(FASTIO_PORT_ID_(pin) == 'E' ? &DDRE : FASTIO_PORT_ID_(pin) == 'G' ? &DDRG : \
+                            FASTIO_PORT_ID_(pin) == 'H' ? &DDRH : &DDRB))
+
+#else
+
+#define FASTIO_PORT_ID_(pin) ((pin) < 8 ? 'D' : (pin) < 14 ? 'B' : 'C')
+#define FASTIO_BIT_(pin) ((pin) < 8 ? (pin) : (pin) < 14 ? (pin) - 8 : (pin) - 14)
+#define FASTIO_PORT_(pin) (*((pin) < 8 ? &PORTD : (pin) < 14 ? &PORTB : &PORTC))
+#define FASTIO_DDR_(pin) (*((pin) < 8 ? &DDRD : (pin) < 14 ? &DDRB : &DDRC))
+
+#endif
+
+/**
+ * Name: FASTIO_MASK(pin)
+ * Desc: Bit mask of the given pin within its port, for batched writes
+**/
+#define FASTIO_MASK(pin) ((uint8_t)(1 << FASTIO_BIT_(pin)))
+
+/**
+ * Name: FASTIO_SAME_PORT(pinA, pinB)
+ * Desc: True if two pins can be written together with fastio_writeMask
+**/
+#define FASTIO_SAME_PORT(pinA, pinB) (FASTIO_PORT_ID_(pinA) == FASTIO_PORT_ID_(pinB))
+
+/**
+ * Name: FASTIO_RANGE_MASK(pin, first, last)
+ * Desc: Bit mask of every pin in [first, last] sharing a port with pin
+**/
+#define FASTIO_RANGE_BIT_(other, pin, first, last) \
+  ((first) <= (other) && (other) <= (last) && FASTIO_SAME_PORT(other, pin) ? FASTIO_MASK(other) : 0)
+#define FASTIO_RANGE_MASK(pin, first, last) \
+  (FASTIO_RANGE_BIT_(0, pin, first, last) | FASTIO_RANGE_BIT_(1, pin, first, last) | \
+   FASTIO_RANGE_BIT_(2, pin, first, last) | FASTIO_RANGE_BIT_(3, pin, first, last) | \
+   FASTIO_RANGE_BIT_(4, pin, first, last) | FASTIO_RANGE_BIT_(5, pin, first, last) | \
+   FASTIO_RANGE_BIT_(6, pin, first, last) | FASTIO_RANGE_BIT_(7, pin, first, last) | \
+   FASTIO_RANGE_BIT_(8, pin, first, last) | FASTIO_RANGE_BIT_(9, pin, first, last) | \
+   FASTIO_RANGE_BIT_(10, pin, first, last) | FASTIO_RANGE_BIT_(11, pin, first, last) | \
+   FASTIO_RANGE_BIT_(12, pin, first, last) | FASTIO_RANGE_BIT_(13, pin, first, last))
+
+#define FASTIO_INLINE static inline __attribute__((always_inline))
+
+#if defined(__AVR__)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+// Registers above 0x3F (eg. PORTH on the Mega) have no sbi / cbi, so the
+// read-modify-write must be guarded against ISRs (Servo) on the same port
+#define FASTIO_HAS_BIT_OPS_(reg) (_SFR_MEM_ADDR(reg) < 0x40)
+
+/**
+ * Name: fastio_write(uint8_t pin, uint8_t value)
+ * Desc: Sets a pin high or low, a single instruction for constant pins
+ * Para: pin, The digital pin to write (0 - 13)
+ *       value, HIGH or LOW
+**/
+FASTIO_INLINE void fastio_write(uint8_t pin, uint8_t value)
+{
+  uint8_t oldSREG;
+
+  if(FASTIO_HAS_BIT_OPS_(FASTIO_PORT_(pin)))
+  {
+    if(value)
+      FASTIO_PORT_(pin) |= FASTIO_MASK(pin);
+    else
+      FASTIO_PORT_(pin) &= ~FASTIO_MASK(pin);
+  }
+  else
+  {
+    oldSREG = SREG;
+    cli();
+    if(value)
+      FASTIO_PORT_(pin) |= FASTIO_MASK(pin);
+    else
+      FASTIO_PORT_(pin) &= ~FASTIO_MASK(pin);
+    SREG = oldSREG;
+  }
+}
+
+/**
+ * Name: fastio_writeMask(uint8_t pin, uint8_t mask, uint8_t values)
+ * Desc: Writes several pins sharing a port with one register update
+ * Para: pin, Any pin on the port to write
+ *       mask, FASTIO_MASK of every pin to change, or'd together
+ *       values, New levels for the pins in mask (bit set means HIGH)
+**/
+FASTIO_INLINE void fastio_writeMask(uint8_t pin, uint8_t mask, uint8_t values)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  FASTIO_PORT_(pin) = (FASTIO_PORT_(pin) & ~mask) | (values & mask);
+  SREG = oldSREG;
+}
+
+/**
+ * Name: fastio_makeOutputMask(uint8_t pin, uint8_t mask, uint8_t values)
+ * Desc: Sets the levels of several pins sharing a port and makes them outputs
+ * Para: pin, Any pin on the port to configure
+ *       mask, FASTIO_MASK of every pin to configure, or'd together
+ *       values, Starting levels for the pins in mask
+**/
+FASTIO_INLINE void fastio_makeOutputMask(uint8_t pin, uint8_t mask, uint8_t values)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  FASTIO_PORT_(pin) = (FASTIO_PORT_(pin) & ~mask) | (values & mask);
+  FASTIO_DDR_(pin) |= mask;
+  SREG = oldSREG;
+}
+
+/**
+ * Name: fastio_getPort(uint8_t pin)
+ * Desc: Resolves a pin that is only known at run time to its output register
+ * Para: pin, The digital pin to resolve
+ * Retr: Pointer to the pin's PORT register, for fastio_writeCached
+**/
+FASTIO_INLINE volatile uint8_t * fastio_getPort(uint8_t pin)
+{
+  return &FASTIO_PORT_(pin);
+}
+
+/**
+ * Name: fastio_writeCached(volatile uint8_t * port, uint8_t mask,
+ *                          uint8_t pin, uint8_t value)
+ * Desc: Writes a pin through a register resolved earlier by fastio_getPort
+ *       (about 10 cycles with the interrupt guard)
+ * Para: port, The register returned by fastio_getPort
+ *       mask, FASTIO_MASK of the pin
+ *       pin, The pin itself (used off the board only)
+ *       value, HIGH or LOW
+**/
+FASTIO_INLINE void fastio_writeCached(volatile uint8_t * port, uint8_t mask, uint8_t pin, uint8_t value)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if(value)
+    *port |= mask;
+  else
+    *port &= ~mask;
+  SREG = oldSREG;
+}
+
+#else
+
+// Off the board: keep the semantics, route every write through the HAL
+
+FASTIO_INLINE void fastio_write(uint8_t pin, uint8_t value)
+{
+  digitalWrite(pin, value);
+}
+
+FASTIO_INLINE void fastio_writeMask(uint8_t pin, uint8_t mask, uint8_t values)
+{
+  uint8_t i;
+  for(i = 0; i < FASTIO_NUM_PINS; i++)
+  {
+    if(FASTIO_SAME_PORT(i, pin) && (mask & FASTIO_MASK(i)))
+      digitalWrite(i, (values & FASTIO_MASK(i)) ? HIGH : LOW);
+  }
+}
+
+FASTIO_INLINE void fastio_makeOutputMask(uint8_t pin, uint8_t mask, uint8_t values)
+{
+  uint8_t i;
+  for(i = 0; i < FASTIO_NUM_PINS; i++)
+  {
+    if(FASTIO_SAME_PORT(i, pin) && (mask & FASTIO_MASK(i)))
+      pinMode(i, OUTPUT);
+  }
+  fastio_writeMask(pin, mask, values);
+}
+
+FASTIO_INLINE volatile uint8_t * fastio_getPort(uint8_t pin)
+{
+  return NULL;
+}
+
+FASTIO_INLINE void fastio_writeCached(volatile uint8_t * port, uint8_t mask, uint8_t pin, uint8_t value)
+{
+  digitalWrite(pin, value);
+}
+
+#endif
+
+/**
+ * Name: fastio_makeOutputLowRange(uint8_t first, uint8_t last)
+ * Desc: Makes every pin in [first, last] a low output, with one batched
+ *       write per port rather than one per pin
+ * Para: first, The first pin to configure
+ *       last, The last pin to configure (at most 13)
+**/
+FASTIO_INLINE void fastio_makeOutputLowRange(uint8_t first, uint8_t last)
+{
+  uint8_t pin;
+  uint8_t other;
+  boolean portDone;
+
+  for(pin = first; pin <= last; pin++)
+  {
+    // Each port is written once, at the first pin of the range it holds
+    portDone = false;
+    for(other = first; other < pin; other++)
+      portDone = portDone || FASTIO_SAME_PORT(other, pin);
+
+    if(!portDone)
+      fastio_makeOutputMask(pin, FASTIO_RANGE_MASK(pin, first, last), 0);
+  }
+}
+
+#endif
@@ -0,0 +1,91 @@
+/**
+ * Name: pt.h
+ * Desc: Stackless coroutines (protothreads) for routines that read best
+ *       as straight line code but must not block the tick scheduler. A
+ *       thread is a function taking its Pt that is called again and again;
+ *       each call resumes after the yield point it last stopped at
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Note: Resuming is a switch on the line number saved in the Pt, so a
+ *       thread costs 2 bytes of SRAM plus whatever it keeps in its own
+ *       state. Locals do not survive a yield (keep them in the state
+ *       struct) and a thread must not use switch itself across yields
+**/
+
+#ifndef PT_H
+#define PT_H
+
+#include <Arduino.h>
+
+// Thread function results
+#define PT_WAITING 0 // Blocked on a condition
+#define PT_YIELDED 1 // Gave up the CPU, will carry on next call
+#define PT_EXITED 2 // Left early through PT_EXIT
+#define PT_ENDED 3 // Ran off PT_END
+
+typedef struct
+{
+  unsigned int lc; // Line to resume at, 0 to start over
+} Pt;
+
+/**
+ * Name: PT_INIT(pt)
+ * Desc: Makes the next call of the thread start from the top
+**/
+#define PT_INIT(pt) ((pt)->lc = 0)
+
+/**
+ * Name: PT_BEGIN(pt) / PT_END(pt)
+ * Desc: Bracket the body of a thread function returning char
+**/
+#define PT_BEGIN(pt) { char ptYielded_ = 1; (void)ptYielded_; switch((pt)->lc) { case 0:
+#define PT_END(pt) } ptYielded_ = 0; PT_INIT(pt); return PT_ENDED; }
+
+/**
+ * Name: PT_WAIT_UNTIL(pt, condition) / PT_WAIT_WHILE(pt, condition)
+ * Desc: Returns PT_WAITING until the condition holds (or stops holding)
+**/
+#define PT_WAIT_UNTIL(pt, condition) \
+  do { (pt)->lc = __LINE__; case __LINE__: if(!(condition)) return PT_WAITING; } while(0)
+#define PT_WAIT_WHILE(pt, condition) PT_WAIT_UNTIL(pt, !(condition))
+
+/**
+ * Name: PT_YIELD(pt)
+ * Desc: Gives up the CPU once, carrying on from here on the next call
+**/
+#define PT_YIELD(pt) \
+  do { ptYielded_ = 0; (pt)->lc = __LINE__; case __LINE__: if(ptYielded_ == 0) return PT_YIELDED; } while(0)
+
+/**
+ * Name: PT_WAIT_MS(pt, startUS, ms)
+ * Desc: Stands in for delay(ms) inside a thread, timed on micros like
+ *       delay itself so short waits do not come up to 1ms short
+ * Para: startUS, unsigned long in the thread's state to hold the start
+ *       ms, The wait (under 71 minutes)
+**/
+#define PT_WAIT_MS(pt, startUS, ms) \
+  do { (startUS) = micros(); PT_WAIT_UNTIL(pt, micros() - (startUS) >= (unsigned long)(ms) * 1000UL); } while(0)
+
+/**
+ * Name: PT_SPAWN(pt, child, thread)
+ * Desc: Starts a child thread and waits for it to finish
+ * Para: child, The child's Pt, kept in the parent's state
+ *       thread, The call running the child once, eg. foo_thread_(child, id)
+**/
+#define PT_SPAWN(pt, child, thread) \
+  do { PT_INIT(child); PT_WAIT_UNTIL(pt, (thread) >= PT_EXITED); } while(0)
+
+/**
+ * Name: PT_EXIT(pt) / PT_RESTART(pt)
+ * Desc: Leave the thread now, or start it over on the next call
+**/
+#define PT_EXIT(pt) do { PT_INIT(pt); return PT_EXITED; } while(0)
+#define PT_RESTART(pt) do { PT_INIT(pt); return PT_WAITING; } while(0)
+
+/**
+ * Name: PT_SCHEDULE(thread)
+ * Desc: Runs a thread once
+ * Retr: True while the thread has not finished
+**/
+#define PT_SCHEDULE(thread) ((thread) < PT_EXITED)
+
+#endif
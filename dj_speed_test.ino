@@ -22,7 +22,18 @@
 
 #define POSITION_TOLLERANCE 200
 
+// Revolution timing (analog comparator against the 1.1V bandgap)
+#define POT_AIN_PORT 0
+#define REV_HOLDOFF_US 5000
+#define REVS_TO_SETTLE 1
+#define REVS_PER_VELOCITY 3
+#define START_VELOCITY 15
+#define MAX_VELOCITY 1000
+#define VELOCITY_STEP 1
+
 #include <Servo.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
 
 Servo globalServo;
 
@@ -252,84 +263,134 @@ void crs_step(int servoNum)
   }
 }
 
+// Revolution timer
+//
+// Servo owns Timer1, so instead of input capture the pot wiper is fed to
+// the analog comparator through the ADC multiplexer and compared against
+// the internal bandgap. Each time the pot falls through the threshold the
+// comparator interrupt stamps the crossing with micros(), leaving the CPU
+// free (and asleep) in between.
+
+volatile unsigned long revLastCrossingUS;
+volatile unsigned long revLastPeriodUS;
+volatile unsigned long revCount;
+
+/**
+ * Name: ISR(ANALOG_COMP_vect)
+ * Desc: Time stamps a pot threshold crossing, ignoring edges that arrive
+ *       too soon after the last one (noise around the threshold)
+**/
+ISR(ANALOG_COMP_vect)
+{
+  unsigned long now = micros();
+  unsigned long period = now - revLastCrossingUS;
+
+  if(revCount != 0 && period < REV_HOLDOFF_US)
+    return;
+
+  revLastPeriodUS = period;
+  revLastCrossingUS = now;
+  revCount++;
+}
+
+/**
+ * Name: rev_init(int potLine)
+ * Desc: Routes the given analog line to the comparator and starts timing
+ *       revolutions
+ * Para: potLine, The analog line the servo's pot is attached to
+ * Note: Disables the ADC, so analogRead must not be used afterwards
+**/
+void rev_init(int potLine)
+{
+  revCount = 0;
+  revLastCrossingUS = 0;
+  revLastPeriodUS = 0;
+
+  ADCSRA &= ~_BV(ADEN);
+  ADCSRB |= _BV(ACME);
+  ADMUX = (ADMUX & 0xF0) | (potLine & 0x07);
+  ACSR = _BV(ACBG) | _BV(ACI) | _BV(ACIS1) | _BV(ACIS0);
+  ACSR |= _BV(ACIE);
+}
+
+/**
+ * Name: rev_getCount()
+ * Desc: Get the number of revolutions seen so far
+ * Retr: Number of accepted threshold crossings
+**/
+unsigned long rev_getCount()
+{
+  unsigned long count;
+  noInterrupts();
+  count = revCount;
+  interrupts();
+  return count;
+}
+
+/**
+ * Name: rev_getLastPeriod()
+ * Desc: Get the duration of the most recent revolution
+ * Retr: Microseconds between the last two crossings
+**/
+unsigned long rev_getLastPeriod()
+{
+  unsigned long period;
+  noInterrupts();
+  period = revLastPeriodUS;
+  interrupts();
+  return period;
+}
+
+/**
+ * Name: rev_waitForCount(unsigned long count)
+ * Desc: Sleep until the given number of revolutions have been seen
+ * Para: count, The revolution count to wait for
+**/
+void rev_waitForCount(unsigned long count)
+{
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  while((long)(rev_getCount() - count) < 0)
+    sleep_mode();
+}
+
 void setup()
 {
   Serial.begin(9600);
   crs_init(0, 9, 0);
   crs_setTargetVelocity(0, 100);
   crs_startMovingTo(0, -2000);
+  rev_init(POT_AIN_PORT);
 }
 
 void loop()
 {
-  long time;
-  long startTime;
-  int potval;
-  int startPotVal;
-  /*long waitTime;
-  int delta;
-  int adjustment;
-  long startTime = millis();
-  crs_step(0);
-  delta = millis() - startTime;
-  adjustment = TIME_STEP - delta;
-  if(adjustment > 0)
-    delay(adjustment);*/
+  unsigned long period;
+  unsigned long startCount;
   int velocity;
-  velocity = 15;
-  
-  potval = analogRead(0);
-  
+  int i;
+
   Serial.print("Starting!\n");
-  
-  
-  /*crs_setVelocity(0, velocity);
-  while(1)
-  {
-    Serial.print(analogRead(0));
-    Serial.print("\n");
-  }*/
-  
-  while(velocity <= 1000)
+
+  for(velocity = START_VELOCITY; velocity <= MAX_VELOCITY; velocity += VELOCITY_STEP)
   {
-    // Get to start of rotation
+    // Let the servo settle at the new speed before timing it
     crs_setVelocity(0, velocity);
-    while(potval > 25)
-      potval = analogRead(0);
-    while(potval < 1000)
-      potval = analogRead(0);
-    while(potval > 512)
-    {
-      potval = analogRead(0);
-      time = millis();
-    }
-    startPotVal = potval;
-    startTime = time;
-    for(int i = 0; i < 10; i++)
+    rev_waitForCount(rev_getCount() + REVS_TO_SETTLE);
+
+    for(i = 0; i < REVS_PER_VELOCITY; i++)
     {
-      crs_setVelocity(0, velocity);
-      while(potval > 25)
-        potval = analogRead(0);
-      while(potval < 1000)
-        potval = analogRead(0);
-      while(potval > 512)
-      {
-        potval = analogRead(0);
-        time = millis();
-        //Serial.print(potval);
-        //Serial.print("\n");
-      }
-      Serial.print(startPotVal);
+      startCount = rev_getCount();
+      rev_waitForCount(startCount + 1);
+      period = rev_getLastPeriod();
+
+      Serial.print(startCount);
       Serial.print(" => ");
-      Serial.print(potval);
+      Serial.print(startCount + 1);
       Serial.print(" in ");
-      Serial.print(time - startTime);
+      Serial.print(period);
       Serial.print(" at ");
       Serial.print(velocity);
       Serial.print("\n");
-      startPotVal = potval;
-      startTime = time;
     }
-    velocity++;
   }
 }
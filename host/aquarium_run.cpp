@@ -0,0 +1,90 @@
+/**
+ * Name: aquarium_run.cpp
+ * Desc: Runs the unmodified aquariumlogic sketch on the host, either
+ *       against the simulator (virtual time, modeled servos) or the
+ *       wall clock host backend
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -I hal -I ../aquariumlogic -o aquarium_sim \
+ *         -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         aquarium_run.cpp commission.cpp hal/hal_common.cpp hal/hal_sim.cpp
+ *       ./aquarium_sim [seconds] [-v] [-e eeprom.bin] [-d periodMs]
+ *       (-d sends FR_DUMP_COMMAND every periodMs of board time, so -v
+ *       shows the flight recorder as telemetry_bridge reads it)
+ *       (link hal/hal_host.cpp instead of hal/hal_sim.cpp for wall clock,
+ *       and pass it -e since it has no pot model to commission against)
+ * Note: On the board the sketch includes the real Arduino core, Servo and
+ *       EEPROM headers, so the AVR build is untouched by any of this.
+ *       Without -e the servos are commissioned first (see commission.h)
+ *       and the run is the boot after that
+**/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aquariumlogic.h"
+#include "commission.h"
+#include "hal_backend.h"
+
+#define DEFAULT_RUN_SECONDS 10
+
+void setup();
+void loop();
+
+int main(int argc, char ** argv)
+{
+  int i;
+  double seconds = DEFAULT_RUN_SECONDS;
+  uint64_t endCycles;
+  unsigned long loops;
+  unsigned long dumpPeriodMS = 0;
+  unsigned long lastDumpMS;
+  const char dumpCommand = FR_DUMP_COMMAND;
+  bool echo = false;
+  const char * eepromPath = NULL;
+
+  for(i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-v") == 0)
+      echo = true;
+    else if(strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+      eepromPath = argv[++i];
+    else if(strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+      dumpPeriodMS = strtoul(argv[++i], NULL, 10);
+    else
+      seconds = atof(argv[i]);
+  }
+
+  if(!commission_powerUp(eepromPath))
+    return 1;
+  hal_setSerialEcho(echo);
+
+  setup();
+
+  loops = 0;
+  lastDumpMS = millis();
+  endCycles = hal_getCycles() + (uint64_t)(seconds * F_CPU);
+  while(hal_getCycles() < endCycles)
+  {
+    // As an operator at the serial console would, cs_poll picks it up
+    if(dumpPeriodMS > 0 && millis() - lastDumpMS >= dumpPeriodMS)
+    {
+      hal_pushSerialInput(&dumpCommand, 1);
+      lastDumpMS = millis();
+    }
+
+    loop();
+    loops++;
+  }
+
+  fprintf(stderr, "ran %lu loops in %.3f s\n", loops, (double)hal_getCycles() / F_CPU);
+  fprintf(stderr, "boot ready after %lu ms\n", boot_getReadyMS());
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+  {
+    fprintf(stderr, "pot %d at %.3f turns, %lu servo writes, %lu skipped\n", modeledPotLines[i],
+            hal_getPotTurns(modeledPotLines[i]), hal_getServoWrites(modeledServoPins[i]),
+            crs_getNumSkippedWrites(i));
+  }
+  fprintf(stderr, "%lu EEPROM writes\n", hal_getEepromWrites(-1));
+  return 0;
+}
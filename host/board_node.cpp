@@ -0,0 +1,150 @@
+/**
+ * Name: board_node.cpp
+ * Desc: Runs the unmodified aquariumlogic sketch against the wall clock
+ *       host backend with its Serial on a pseudo-terminal, standing in for
+ *       one board on its own clock sync line. The board's clock can be given
+ *       an offset and rate error, and once synced the node reports how far
+ *       its shared time is from the master's clock and its slowest loop
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -I hal -I ../aquariumlogic -o board_node \
+ *         -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         board_node.cpp hal/hal_common.cpp hal/hal_host.cpp
+ *       ./board_node [-a address] [-o offsetUs] [-k skewPpm] [-s seconds]
+ *       (prints the pseudo-terminal to hand to clock_master)
+ * Note: clock_master keeps the shared timeline on CLOCK_MONOTONIC, which
+ *       is what lets a node on the same machine measure its real error
+**/
+
+#include <Arduino.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aquariumlogic.h"
+#include "hal_backend.h"
+
+#define LIGHT_AIN_PORT 12
+#define BRIGHT_LIGHT_VAL 800
+#define REPORT_PERIOD_MS 1000
+
+/**
+ * Name: node_monotonicUs_()
+ * Desc: Get CLOCK_MONOTONIC in microseconds, the master's timeline
+**/
+uint64_t node_monotonicUs_()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Name: node_openPty_(int * slave)
+ * Desc: Creates a raw pseudo-terminal pair for Serial
+ * Para: slave, Set to the slave side, held open so the pair stays up
+ *       while no master is connected
+ * Retr: The non-blocking master side or -1 on failure
+**/
+int node_openPty_(int * slave)
+{
+  int fd;
+  struct termios attrs;
+
+  fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0)
+    return -1;
+
+  *slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+  if(*slave < 0)
+    return -1;
+  tcgetattr(*slave, &attrs);
+  cfmakeraw(&attrs);
+  tcsetattr(*slave, TCSANOW, &attrs);
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return fd;
+}
+
+extern ClockSync clockSync;
+
+void setup();
+void loop();
+
+int main(int argc, char ** argv)
+{
+  int i;
+  int fd;
+  int slave;
+  int address = NONE;
+  long offsetUs = 0;
+  double skewPpm = 0;
+  double seconds = 0;
+  uint64_t startUs;
+  uint64_t nextReportUs;
+  uint64_t loopStartUs;
+  uint64_t loopUs;
+  uint64_t worstLoopUs = 0;
+  long error;
+
+  for(i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "-a") == 0)
+      address = atoi(argv[i + 1]);
+    else if(strcmp(argv[i], "-o") == 0)
+      offsetUs = atol(argv[i + 1]);
+    else if(strcmp(argv[i], "-k") == 0)
+      skewPpm = atof(argv[i + 1]);
+    else if(strcmp(argv[i], "-s") == 0)
+      seconds = atof(argv[i + 1]);
+  }
+
+  fd = node_openPty_(&slave);
+  if(fd < 0)
+  {
+    perror("pseudo-terminal");
+    return 1;
+  }
+
+  hal_reset();
+  hal_setClockError(offsetUs, skewPpm);
+  hal_setAnalogInput(LIGHT_AIN_PORT, BRIGHT_LIGHT_VAL);
+  hal_attachSerialDevice(fd);
+
+  setup();
+  if(address != NONE)
+    cs_setAddress(address);
+  address = clockSync.address;
+
+  fprintf(stderr, "board %d on %s\n", address, ptsname(fd));
+
+  startUs = node_monotonicUs_();
+  nextReportUs = startUs + REPORT_PERIOD_MS * 1000;
+  while(seconds <= 0 || node_monotonicUs_() - startUs < seconds * 1000000)
+  {
+    loopStartUs = node_monotonicUs_();
+    loop();
+    loopUs = node_monotonicUs_() - loopStartUs;
+    if(loopUs > worstLoopUs)
+      worstLoopUs = loopUs;
+
+    if(node_monotonicUs_() >= nextReportUs)
+    {
+      nextReportUs += REPORT_PERIOD_MS * 1000;
+      if(cs_isSynced())
+      {
+        error = (long)(int32_t)(cs_getSharedMicros() - (uint32_t)node_monotonicUs_());
+        fprintf(stderr, "board %d shared time error %ld us, slowest loop %.1f ms\n", address, error,
+                worstLoopUs / 1000.0);
+      }
+      worstLoopUs = 0;
+    }
+  }
+
+  close(slave);
+  close(fd);
+  return 0;
+}
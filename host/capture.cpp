@@ -0,0 +1,345 @@
+/**
+ * Name: capture.cpp
+ * Desc: Writer and mmap reader for the columnar capture format
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#include "capture.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Name: capture_align_(uint64_t size)
+ * Desc: Round the given size up to the 8 byte section alignment
+**/
+static uint64_t capture_align_(uint64_t size)
+{
+  return (size + 7) & ~(uint64_t)7;
+}
+
+/**
+ * Name: capture_chunkSize_(uint32_t numRecords)
+ * Desc: Get the number of bytes a chunk of the given length occupies
+**/
+static uint64_t capture_chunkSize_(uint32_t numRecords)
+{
+  uint64_t size = sizeof(CaptureChunkHeader);
+  size += (uint64_t)numRecords * (sizeof(int64_t) + 2 * sizeof(int32_t) + 2 * sizeof(uint8_t));
+  return capture_align_(size);
+}
+
+/**
+ * Name: capture_writePadding_(FILE * file, uint64_t written)
+ * Desc: Pads the file so the next section starts 8 byte aligned
+**/
+static bool capture_writePadding_(FILE * file, uint64_t written)
+{
+  static const uint8_t zeros[8] = {0};
+  uint64_t padding = capture_align_(written) - written;
+  return fwrite(zeros, 1, padding, file) == padding;
+}
+
+/**
+ * Name: capture_flushChunk_(CaptureWriter * target)
+ * Desc: Writes the buffered records as one chunk and records it in the index
+**/
+static bool capture_flushChunk_(CaptureWriter * target)
+{
+  uint32_t n = target->numBuffered;
+  long offset;
+  uint64_t written;
+  CaptureChunkHeader header;
+  CaptureIndexEntry * entry;
+
+  if(n == 0)
+    return true;
+
+  offset = ftell(target->file);
+  if(offset < 0)
+    return false;
+
+  header.numRecords = n;
+  header.reserved = 0;
+  header.firstTimestamp = target->timestamps[0];
+  header.lastTimestamp = target->timestamps[n - 1];
+
+  if(fwrite(&header, sizeof(header), 1, target->file) != 1 ||
+     fwrite(target->timestamps, sizeof(int64_t), n, target->file) != n ||
+     fwrite(target->values, sizeof(int32_t), n, target->file) != n ||
+     fwrite(target->eventArgs, sizeof(int32_t), n, target->file) != n ||
+     fwrite(target->channels, sizeof(uint8_t), n, target->file) != n ||
+     fwrite(target->events, sizeof(uint8_t), n, target->file) != n)
+    return false;
+
+  written = sizeof(header) + (uint64_t)n * (sizeof(int64_t) + 2 * sizeof(int32_t) + 2 * sizeof(uint8_t));
+  if(!capture_writePadding_(target->file, written))
+    return false;
+
+  // Grow the in memory index as needed
+  if(target->numChunks == target->indexCapacity)
+  {
+    uint32_t newCapacity = target->indexCapacity ? target->indexCapacity * 2 : 64;
+    CaptureIndexEntry * newIndex = (CaptureIndexEntry *)realloc(target->index, newCapacity * sizeof(CaptureIndexEntry));
+    if(newIndex == NULL)
+      return false;
+    target->index = newIndex;
+    target->indexCapacity = newCapacity;
+  }
+
+  entry = &(target->index[target->numChunks]);
+  entry->firstTimestamp = header.firstTimestamp;
+  entry->lastTimestamp = header.lastTimestamp;
+  entry->offset = offset;
+  entry->numRecords = n;
+  entry->reserved = 0;
+
+  target->numChunks++;
+  target->numBuffered = 0;
+  return true;
+}
+
+/**
+ * Name: capture_writeHeader_(CaptureWriter * target, uint64_t indexOffset)
+ * Desc: Writes (or rewrites) the file header at the start of the file
+**/
+static bool capture_writeHeader_(CaptureWriter * target, uint64_t indexOffset)
+{
+  CaptureFileHeader header;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+  header.version = CAPTURE_VERSION;
+  header.numChunks = target->numChunks;
+  header.indexOffset = indexOffset;
+  header.numRecords = target->numRecords;
+
+  if(fseek(target->file, 0, SEEK_SET) != 0)
+    return false;
+  return fwrite(&header, sizeof(header), 1, target->file) == 1;
+}
+
+bool capture_openWriter(CaptureWriter * target, const char * path, uint32_t chunkRecords)
+{
+  memset(target, 0, sizeof(CaptureWriter));
+
+  if(chunkRecords == 0)
+    chunkRecords = CAPTURE_DEFAULT_CHUNK_RECORDS;
+  target->chunkCapacity = chunkRecords;
+
+  target->file = fopen(path, "wb");
+  if(target->file == NULL)
+    return false;
+
+  target->timestamps = (int64_t *)malloc(chunkRecords * sizeof(int64_t));
+  target->values = (int32_t *)malloc(chunkRecords * sizeof(int32_t));
+  target->eventArgs = (int32_t *)malloc(chunkRecords * sizeof(int32_t));
+  target->channels = (uint8_t *)malloc(chunkRecords);
+  target->events = (uint8_t *)malloc(chunkRecords);
+
+  // Placeholder header, patched with the index location on close
+  if(target->timestamps == NULL || target->values == NULL || target->eventArgs == NULL ||
+     target->channels == NULL || target->events == NULL || !capture_writeHeader_(target, 0))
+  {
+    capture_closeWriter(target);
+    return false;
+  }
+
+  return true;
+}
+
+bool capture_append(CaptureWriter * target, int64_t timestamp, uint8_t channel,
+                    int32_t value, uint8_t event, int32_t eventArg)
+{
+  uint32_t i = target->numBuffered;
+
+  if(target->numRecords > 0 && timestamp < target->lastTimestamp)
+    return false;
+
+  target->lastTimestamp = timestamp;
+  target->timestamps[i] = timestamp;
+  target->values[i] = value;
+  target->eventArgs[i] = eventArg;
+  target->channels[i] = channel;
+  target->events[i] = event;
+  target->numBuffered++;
+  target->numRecords++;
+
+  if(target->numBuffered == target->chunkCapacity)
+    return capture_flushChunk_(target);
+  return true;
+}
+
+bool capture_closeWriter(CaptureWriter * target)
+{
+  bool ok = target->file != NULL;
+  long indexOffset;
+
+  if(ok)
+  {
+    ok = capture_flushChunk_(target);
+    indexOffset = ftell(target->file);
+    ok = ok && indexOffset >= 0;
+    ok = ok && fwrite(target->index, sizeof(CaptureIndexEntry), target->numChunks, target->file) == target->numChunks;
+    ok = ok && capture_writeHeader_(target, indexOffset);
+    ok = (fclose(target->file) == 0) && ok;
+  }
+
+  free(target->timestamps);
+  free(target->values);
+  free(target->eventArgs);
+  free(target->channels);
+  free(target->events);
+  free(target->index);
+  memset(target, 0, sizeof(CaptureWriter));
+  return ok;
+}
+
+bool capture_openReader(CaptureReader * target, const char * path)
+{
+  struct stat info;
+  uint32_t i;
+  uint64_t indexEnd;
+
+  memset(target, 0, sizeof(CaptureReader));
+  target->fd = -1;
+
+  target->fd = open(path, O_RDONLY);
+  if(target->fd < 0)
+    return false;
+
+  if(fstat(target->fd, &info) != 0 || (size_t)info.st_size < sizeof(CaptureFileHeader))
+  {
+    capture_closeReader(target);
+    return false;
+  }
+
+  target->size = info.st_size;
+  target->base = (const uint8_t *)mmap(NULL, target->size, PROT_READ, MAP_SHARED, target->fd, 0);
+  if(target->base == MAP_FAILED)
+  {
+    target->base = NULL;
+    capture_closeReader(target);
+    return false;
+  }
+
+  // Validate the header and index before handing out pointers
+  target->header = (const CaptureFileHeader *)target->base;
+  indexEnd = target->header->indexOffset + (uint64_t)target->header->numChunks * sizeof(CaptureIndexEntry);
+  if(memcmp(target->header->magic, CAPTURE_MAGIC, sizeof(target->header->magic)) != 0 ||
+     target->header->version != CAPTURE_VERSION ||
+     target->header->indexOffset < sizeof(CaptureFileHeader) ||
+     target->header->indexOffset % 8 != 0 || indexEnd > target->size)
+  {
+    capture_closeReader(target);
+    return false;
+  }
+
+  target->index = (const CaptureIndexEntry *)(target->base + target->header->indexOffset);
+  for(i = 0; i < target->header->numChunks; i++)
+  {
+    if(target->index[i].offset % 8 != 0 ||
+       target->index[i].offset + capture_chunkSize_(target->index[i].numRecords) > target->header->indexOffset)
+    {
+      capture_closeReader(target);
+      return false;
+    }
+  }
+
+  // Columns are read once front to back by most tools
+  madvise((void *)target->base, target->size, MADV_SEQUENTIAL);
+  return true;
+}
+
+void capture_closeReader(CaptureReader * target)
+{
+  if(target->base != NULL)
+    munmap((void *)target->base, target->size);
+  if(target->fd >= 0)
+    close(target->fd);
+  memset(target, 0, sizeof(CaptureReader));
+  target->fd = -1;
+}
+
+bool capture_isCaptureFile(const char * path)
+{
+  char magic[8];
+  bool matches;
+  FILE * file = fopen(path, "rb");
+
+  if(file == NULL)
+    return false;
+  matches = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+            memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0;
+  fclose(file);
+  return matches;
+}
+
+uint32_t capture_getNumChunks(const CaptureReader * target)
+{
+  return target->header->numChunks;
+}
+
+CaptureChunk capture_getChunk(const CaptureReader * target, uint32_t id)
+{
+  CaptureChunk chunk;
+  const CaptureIndexEntry * entry = &(target->index[id]);
+  const uint8_t * column = target->base + entry->offset + sizeof(CaptureChunkHeader);
+  uint32_t n = entry->numRecords;
+
+  chunk.numRecords = n;
+  chunk.timestamps = (const int64_t *)column;
+  column += n * sizeof(int64_t);
+  chunk.values = (const int32_t *)column;
+  column += n * sizeof(int32_t);
+  chunk.eventArgs = (const int32_t *)column;
+  column += n * sizeof(int32_t);
+  chunk.channels = column;
+  column += n;
+  chunk.events = column;
+  return chunk;
+}
+
+CaptureCursor capture_seek(const CaptureReader * target, int64_t timestamp)
+{
+  uint32_t low;
+  uint32_t high;
+  uint32_t mid;
+  CaptureCursor cursor;
+  CaptureChunk chunk;
+
+  // First chunk whose last timestamp reaches the requested time
+  low = 0;
+  high = target->header->numChunks;
+  while(low < high)
+  {
+    mid = low + (high - low) / 2;
+    if(target->index[mid].lastTimestamp < timestamp)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  cursor.chunk = low;
+  cursor.record = 0;
+  if(low == target->header->numChunks)
+    return cursor;
+
+  // First record in that chunk at or after the requested time
+  chunk = capture_getChunk(target, low);
+  high = chunk.numRecords;
+  while(cursor.record < high)
+  {
+    mid = cursor.record + (high - cursor.record) / 2;
+    if(chunk.timestamps[mid] < timestamp)
+      cursor.record = mid + 1;
+    else
+      high = mid;
+  }
+
+  return cursor;
+}
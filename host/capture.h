@@ -0,0 +1,208 @@
+/**
+ * Name: capture.h
+ * Desc: Chunked, columnar binary capture format for telemetry and analog
+ *       traces, read back through mmap without copying
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+// File layout (little endian, every section 8 byte aligned)
+//
+//   CaptureFileHeader
+//   chunk 0: CaptureChunkHeader, timestamps[n] (int64 us),
+//            values[n] (int32), eventArgs[n] (int32),
+//            channels[n] (uint8), events[n] (uint8)
+//   chunk 1 ...
+//   CaptureIndexEntry[numChunks]
+//
+// Records must be written in non-decreasing timestamp order so both the
+// chunk index and the timestamp column can be binary searched.
+
+#define CAPTURE_MAGIC "AQCAP01"
+#define CAPTURE_VERSION 1
+#define CAPTURE_DEFAULT_CHUNK_RECORDS 4096
+
+// Channel constants
+#define CAPTURE_CHANNEL_POT 0
+#define CAPTURE_CHANNEL_PIEZO 1
+#define CAPTURE_CHANNEL_LIGHT 2
+#define CAPTURE_CHANNEL_SPEED 3
+
+// Event constants
+#define CAPTURE_EVENT_NONE 0
+#define CAPTURE_EVENT_REVOLUTION 1
+#define CAPTURE_EVENT_TAP 2
+#define CAPTURE_EVENT_LIGHT_CHANGE 3
+#define CAPTURE_EVENT_GOAL_REACHED 4
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t numChunks;
+  uint64_t indexOffset;
+  uint64_t numRecords;
+} CaptureFileHeader;
+
+typedef struct
+{
+  uint32_t numRecords;
+  uint32_t reserved;
+  int64_t firstTimestamp;
+  int64_t lastTimestamp;
+} CaptureChunkHeader;
+
+typedef struct
+{
+  int64_t firstTimestamp;
+  int64_t lastTimestamp;
+  uint64_t offset;
+  uint32_t numRecords;
+  uint32_t reserved;
+} CaptureIndexEntry;
+
+// Zero copy view of one chunk (pointers into the mapping)
+
+typedef struct
+{
+  uint32_t numRecords;
+  const int64_t * timestamps;
+  const int32_t * values;
+  const int32_t * eventArgs;
+  const uint8_t * channels;
+  const uint8_t * events;
+} CaptureChunk;
+
+// Position of a record inside a capture
+
+typedef struct
+{
+  uint32_t chunk;
+  uint32_t record;
+} CaptureCursor;
+
+// Capture writer
+
+typedef struct
+{
+  FILE * file;
+  uint32_t chunkCapacity;
+  uint32_t numBuffered;
+  uint32_t numChunks;
+  uint64_t numRecords;
+  int64_t lastTimestamp; // Newest appended, nothing older may follow
+  int64_t * timestamps;
+  int32_t * values;
+  int32_t * eventArgs;
+  uint8_t * channels;
+  uint8_t * events;
+  CaptureIndexEntry * index;
+  uint32_t indexCapacity;
+} CaptureWriter;
+
+/**
+ * Name: capture_openWriter(CaptureWriter * target, const char * path,
+ *                          uint32_t chunkRecords)
+ * Desc: Creates a new capture file
+ * Para: target, The writer to initialize
+ *       path, Where the capture should be written
+ *       chunkRecords, How many records each chunk holds
+ * Retr: False if the file could not be created
+**/
+bool capture_openWriter(CaptureWriter * target, const char * path, uint32_t chunkRecords);
+
+/**
+ * Name: capture_append(CaptureWriter * target, int64_t timestamp,
+ *                      uint8_t channel, int32_t value, uint8_t event,
+ *                      int32_t eventArg)
+ * Desc: Adds one record, flushing the current chunk when it fills up.
+ *       Records older than the last one are refused, as the file must
+ *       stay in timestamp order
+ * Para: target, The writer to add to
+ *       timestamp, Microseconds since the capture started
+ *       channel, Which signal the value belongs to
+ *       value, The sample value
+ *       event, CAPTURE_EVENT_* constant or CAPTURE_EVENT_NONE
+ *       eventArg, Event specific argument
+ * Retr: False if the record is out of order or could not be written
+**/
+bool capture_append(CaptureWriter * target, int64_t timestamp, uint8_t channel,
+                    int32_t value, uint8_t event, int32_t eventArg);
+
+/**
+ * Name: capture_closeWriter(CaptureWriter * target)
+ * Desc: Flushes the last chunk, writes the chunk index and closes the file
+ * Para: target, The writer to close
+ * Retr: False if the capture could not be completed
+**/
+bool capture_closeWriter(CaptureWriter * target);
+
+// Capture reader
+
+typedef struct
+{
+  int fd;
+  const uint8_t * base;
+  size_t size;
+  const CaptureFileHeader * header;
+  const CaptureIndexEntry * index;
+} CaptureReader;
+
+/**
+ * Name: capture_openReader(CaptureReader * target, const char * path)
+ * Desc: Maps a capture file and validates its header and index
+ * Para: target, The reader to initialize
+ *       path, The capture file to open
+ * Retr: False if the file is missing or is not a valid capture
+**/
+bool capture_openReader(CaptureReader * target, const char * path);
+
+/**
+ * Name: capture_closeReader(CaptureReader * target)
+ * Desc: Unmaps the capture file
+ * Para: target, The reader to close
+**/
+void capture_closeReader(CaptureReader * target);
+
+/**
+ * Name: capture_isCaptureFile(const char * path)
+ * Desc: Determines if the given file starts with the capture magic
+ * Para: path, The file to check
+ * Retr: True if the file looks like a binary capture
+**/
+bool capture_isCaptureFile(const char * path);
+
+/**
+ * Name: capture_getNumChunks(const CaptureReader * target)
+ * Desc: Get the number of chunks in the capture
+ * Para: target, The reader to query
+ * Retr: Number of chunks
+**/
+uint32_t capture_getNumChunks(const CaptureReader * target);
+
+/**
+ * Name: capture_getChunk(const CaptureReader * target, uint32_t id)
+ * Desc: Get column pointers for the given chunk
+ * Para: target, The reader to query
+ *       id, The index of the chunk
+ * Retr: View whose pointers stay valid until the reader is closed
+**/
+CaptureChunk capture_getChunk(const CaptureReader * target, uint32_t id);
+
+/**
+ * Name: capture_seek(const CaptureReader * target, int64_t timestamp)
+ * Desc: Find the first record at or after the given time using the chunk
+ *       index and the timestamp column (O(log n))
+ * Para: target, The reader to search
+ *       timestamp, Microseconds since the capture started
+ * Retr: Cursor to the record, chunk == numChunks if past the end
+**/
+CaptureCursor capture_seek(const CaptureReader * target, int64_t timestamp);
+
+#endif
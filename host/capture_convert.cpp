@@ -0,0 +1,119 @@
+/**
+ * Name: capture_convert.cpp
+ * Desc: Converts the old text captures into the columnar capture format
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -o capture_convert capture_convert.cpp capture.cpp
+ *       ./capture_convert pot <pot_feedback> <out> [sampleRate]
+ *       ./capture_convert speed <dj_speed_data> <out> [us]
+**/
+
+#include "capture.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_POT_SAMPLE_RATE 1000.0
+#define US_PER_MS 1000
+
+/**
+ * Name: convertPot(FILE * in, CaptureWriter * out, double sampleRate)
+ * Desc: Converts newline separated pot readings taken at a fixed rate
+ * Para: in, The text capture
+ *       out, The capture to write to
+ *       sampleRate, Samples per second of the text capture
+ * Retr: False on write failure
+**/
+bool convertPot(FILE * in, CaptureWriter * out, double sampleRate)
+{
+  long value;
+  long i = 0;
+
+  while(fscanf(in, "%ld", &value) == 1)
+  {
+    int64_t timestamp = (int64_t)(i * 1000000.0 / sampleRate);
+    if(!capture_append(out, timestamp, CAPTURE_CHANNEL_POT, value, CAPTURE_EVENT_NONE, 0))
+      return false;
+    i++;
+  }
+  return true;
+}
+
+/**
+ * Name: convertSpeed(FILE * in, CaptureWriter * out, long usPerUnit)
+ * Desc: Converts "a => b in t at v" revolution lines from dj_speed_test
+ *       into revolution events on the speed channel
+ * Para: in, The text capture
+ *       out, The capture to write to
+ *       usPerUnit, Microseconds per unit of t in the text capture
+ * Retr: False on write failure or a negative period
+**/
+bool convertSpeed(FILE * in, CaptureWriter * out, long usPerUnit)
+{
+  char line[128];
+  long start;
+  long end;
+  long period;
+  long velocity;
+  int64_t timestamp = 0;
+
+  while(fgets(line, sizeof(line), in) != NULL)
+  {
+    if(sscanf(line, "%ld => %ld in %ld at %ld", &start, &end, &period, &velocity) != 4)
+      continue;
+
+    // Revolutions are back to back, so the periods add up to a timeline
+    timestamp += (int64_t)period * usPerUnit;
+    if(!capture_append(out, timestamp, CAPTURE_CHANNEL_SPEED, velocity,
+                       CAPTURE_EVENT_REVOLUTION, period * usPerUnit))
+      return false;
+  }
+  return true;
+}
+
+void printUsage(const char * name)
+{
+  fprintf(stderr, "usage: %s pot <pot_feedback> <capture> [sampleRate]\n", name);
+  fprintf(stderr, "       %s speed <dj_speed_data> <capture> [us]\n", name);
+}
+
+int main(int argc, char ** argv)
+{
+  FILE * in;
+  CaptureWriter out;
+  bool ok;
+
+  if(argc < 4)
+  {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  in = fopen(argv[2], "r");
+  if(in == NULL)
+  {
+    perror(argv[2]);
+    return 1;
+  }
+
+  if(!capture_openWriter(&out, argv[3], CAPTURE_DEFAULT_CHUNK_RECORDS))
+  {
+    perror(argv[3]);
+    fclose(in);
+    return 1;
+  }
+
+  if(strcmp(argv[1], "pot") == 0)
+    ok = convertPot(in, &out, argc > 4 ? atof(argv[4]) : DEFAULT_POT_SAMPLE_RATE);
+  else if(strcmp(argv[1], "speed") == 0)
+    ok = convertSpeed(in, &out, (argc > 4 && strcmp(argv[4], "us") == 0) ? 1 : US_PER_MS);
+  else
+  {
+    printUsage(argv[0]);
+    ok = false;
+  }
+
+  fclose(in);
+  ok = capture_closeWriter(&out) && ok;
+  return ok ? 0 : 1;
+}
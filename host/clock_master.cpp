@@ -0,0 +1,421 @@
+/**
+ * Name: clock_master.cpp
+ * Desc: Keeps the shared timeline for several aquarium boards and
+ *       schedules choreography on it. Each round it exchanges a burst of
+ *       sync frames with every board, keeps the one with the shortest
+ *       round trip (the least queueing on either side), and sends the
+ *       board the offset and skew that map its micros onto the timeline
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -o clock_master clock_master.cpp
+ *       ./clock_master [-r rounds] [-p periodMs] [-c spacingMs] device:address ...
+ *       (-c sends the fish across the tanks in argument order, spacingMs
+ *       apart, after the first round)
+ * Note: The timeline is CLOCK_MONOTONIC in microseconds, truncated to 32
+ *       bits on the wire. Frames are described in aquariumlogic.h (CS_*)
+**/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_BOARDS 8
+#define BYTE_US (10 * 1000000 / 9600) // Start, 8 data and stop bits at 9600 baud
+#define LINE_LENGTH 128
+#define SAMPLES_PER_ROUND 16
+#define HISTORY_LENGTH 16 // Rounds the offset and skew are fitted over
+#define SAMPLE_JITTER_US 3000 // Random gap so samples do not lock to the board's loop
+#define REPLY_TIMEOUT_US 250000
+#define DEFAULT_ROUNDS 10
+#define DEFAULT_PERIOD_MS 1000
+#define MIN_SKEW_BASELINE_US 2000000 // Shorter baselines give noise, not skew
+#define MAX_SKEW_PPM 1000 // CS_MAX_SKEW_PPM on the boards
+#define CHOREOGRAPHY_LEAD_US 500000 // Time for the frames to reach every board
+#define SWIM_ACROSS_X 100000000 // Past the east edge, as in aquarium_runFishToOpposingSide_
+
+struct Board {
+  const char * device;
+  int fd;
+  int address;
+  char line[LINE_LENGTH];
+  int lineLength;
+  uint64_t lineStartUs; // When the line's first byte was read
+  int numHistory;
+  uint32_t lastRefUs;
+  int64_t historyRefUs[HISTORY_LENGTH]; // Board time since the first round, unwrapped
+  int64_t historyOffsetUs[HISTORY_LENGTH];
+};
+
+struct SyncSample {
+  uint32_t boardRefUs; // Board micros the offset holds at
+  int64_t offsetUs; // Shared minus board
+  int64_t roundTripUs;
+};
+
+/**
+ * Name: master_nowUs()
+ * Desc: Get the current time on the shared timeline
+**/
+uint64_t master_nowUs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Name: master_openBoard(Board * board, const char * spec)
+ * Desc: Opens and configures the serial device of a "device:address" spec
+ * Retr: False if the spec is malformed or the device cannot be opened
+**/
+bool master_openBoard(Board * board, char * spec)
+{
+  char * colon = strrchr(spec, ':');
+  struct termios attrs;
+
+  if(colon == NULL)
+    return false;
+  *colon = '\0';
+  board->device = spec;
+  board->address = atoi(colon + 1);
+  board->lineLength = 0;
+  board->numHistory = 0;
+
+  board->fd = open(spec, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if(board->fd < 0)
+    return false;
+  if(tcgetattr(board->fd, &attrs) == 0)
+  {
+    cfmakeraw(&attrs);
+    cfsetispeed(&attrs, B9600);
+    cfsetospeed(&attrs, B9600);
+    tcsetattr(board->fd, TCSANOW, &attrs);
+  }
+  return true;
+}
+
+/**
+ * Name: master_send(Board * board, const char * frame)
+ * Desc: Writes a whole frame a byte per byte time, stamping the moment it
+ *       starts going out
+ * Retr: The shared time the first byte was handed to the device
+ * Note: A serial line paces the bytes anyway, pacing them here (and
+ *       frames read in master_readFrame) as well gives a pseudo-terminal
+ *       (see board_node.cpp) the same timing
+**/
+uint64_t master_send(Board * board, const char * frame)
+{
+  uint64_t sentUs;
+  uint64_t dueUs;
+  uint64_t now;
+  size_t length = strlen(frame);
+  size_t written = 0;
+  ssize_t n;
+
+  sentUs = master_nowUs();
+  while(written < length)
+  {
+    n = write(board->fd, frame + written, 1);
+    if(n > 0)
+      written += n;
+    else if(n < 0 && errno != EAGAIN)
+      break;
+
+    dueUs = sentUs + written * BYTE_US;
+    now = master_nowUs();
+    if(written < length && dueUs > now)
+      usleep(dueUs - now);
+  }
+  return sentUs;
+}
+
+/**
+ * Name: master_readFrame(Board * board, uint64_t deadlineUs, uint64_t * startUs)
+ * Desc: Reads until a whole frame (a line starting with '@') arrives,
+ *       discarding the board's other Serial output
+ * Para: startUs, Set to when the frame's first byte was read
+ * Retr: The frame without its '@', or NULL at the deadline
+**/
+const char * master_readFrame(Board * board, uint64_t deadlineUs, uint64_t * startUs)
+{
+  struct pollfd pfd;
+  uint64_t now;
+  char value;
+
+  pfd.fd = board->fd;
+  pfd.events = POLLIN;
+  while(true)
+  {
+    // Drain a byte at a time so each one is stamped as it is read
+    while(read(board->fd, &value, 1) == 1)
+    {
+      if(value == '@')
+      {
+        board->lineLength = 0;
+        board->lineStartUs = master_nowUs();
+        board->line[board->lineLength++] = value;
+      }
+      else if(board->lineLength == 0)
+      {
+        continue; // Debug text between frames
+      }
+      else if(value == '\n')
+      {
+        // Not done before the line could have crossed the wire
+        now = board->lineStartUs + (board->lineLength + 1) * BYTE_US;
+        if(now > master_nowUs())
+          usleep(now - master_nowUs());
+
+        board->line[board->lineLength] = '\0';
+        board->lineLength = 0;
+        *startUs = board->lineStartUs;
+        return board->line + 1;
+      }
+      else if(board->lineLength < LINE_LENGTH - 1)
+      {
+        board->line[board->lineLength++] = value;
+      }
+    }
+
+    now = master_nowUs();
+    if(now >= deadlineUs)
+      return NULL;
+    poll(&pfd, 1, (deadlineUs - now) / 1000 + 1);
+  }
+}
+
+/**
+ * Name: master_sample(Board * board, long seq, SyncSample * sample)
+ * Desc: Runs one sync exchange with a board
+ * Retr: False if the board did not answer in time
+**/
+bool master_sample(Board * board, long seq, SyncSample * sample)
+{
+  char frame[LINE_LENGTH];
+  const char * reply;
+  uint64_t sentUs;
+  uint64_t receivedUs;
+  uint64_t deadlineUs;
+  int address;
+  long replySeq;
+  unsigned long boardReceivedUs;
+  unsigned long boardSentUs;
+  int64_t outbound;
+  int64_t inbound;
+
+  snprintf(frame, sizeof(frame), "@S%d %ld\n", board->address, seq);
+  sentUs = master_send(board, frame);
+  deadlineUs = sentUs + REPLY_TIMEOUT_US;
+
+  while((reply = master_readFrame(board, deadlineUs, &receivedUs)) != NULL)
+  {
+    if(sscanf(reply, "R%d %ld %lu %lu", &address, &replySeq, &boardReceivedUs, &boardSentUs) != 4)
+      continue;
+    if(address != board->address || replySeq != seq)
+      continue; // Late answer to an earlier sample
+
+    // Board minus shared on the way out and back, queueing makes the
+    // first too large and the second too small by the same amount
+    outbound = (int32_t)((uint32_t)boardReceivedUs - (uint32_t)sentUs);
+    inbound = (int32_t)((uint32_t)boardSentUs - (uint32_t)receivedUs);
+    sample->boardRefUs = boardReceivedUs;
+    sample->offsetUs = -(outbound + inbound) / 2;
+    sample->roundTripUs = (int64_t)(receivedUs - sentUs) - (int32_t)(boardSentUs - boardReceivedUs);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Name: master_fit(Board * board, int64_t * offsetUs, double * skew)
+ * Desc: Least squares line through the board's recent best samples
+ * Para: offsetUs, Set to the fitted offset at the newest sample
+ *       skew, Set to the offset change per board microsecond, 0 until
+ *       the samples span MIN_SKEW_BASELINE_US
+**/
+void master_fit(Board * board, int64_t * offsetUs, double * skew)
+{
+  int i;
+  int n = board->numHistory < HISTORY_LENGTH ? board->numHistory : HISTORY_LENGTH;
+  int newest = (board->numHistory - 1) % HISTORY_LENGTH;
+  int oldest = board->numHistory <= HISTORY_LENGTH ? 0 : board->numHistory % HISTORY_LENGTH;
+  double meanRef = 0;
+  double meanOffset = 0;
+  double covariance = 0;
+  double variance = 0;
+
+  *offsetUs = board->historyOffsetUs[newest];
+  *skew = 0;
+  if(board->historyRefUs[newest] - board->historyRefUs[oldest] < MIN_SKEW_BASELINE_US)
+    return;
+
+  for(i = 0; i < n; i++)
+  {
+    meanRef += board->historyRefUs[i];
+    meanOffset += board->historyOffsetUs[i];
+  }
+  meanRef /= n;
+  meanOffset /= n;
+  for(i = 0; i < n; i++)
+  {
+    covariance += (board->historyRefUs[i] - meanRef) * (board->historyOffsetUs[i] - meanOffset);
+    variance += (board->historyRefUs[i] - meanRef) * (board->historyRefUs[i] - meanRef);
+  }
+
+  *skew = covariance / variance;
+  *offsetUs = (int64_t)(meanOffset + *skew * (board->historyRefUs[newest] - meanRef));
+}
+
+/**
+ * Name: master_syncBoard(Board * board, long * seq)
+ * Desc: Samples a board, keeps the shortest round trip, fits it in with
+ *       the previous rounds and sends the board the resulting timeline
+ * Retr: False if no sample came back
+**/
+bool master_syncBoard(Board * board, long * seq)
+{
+  int i;
+  char frame[LINE_LENGTH];
+  SyncSample sample;
+  SyncSample best = SyncSample();
+  bool haveBest = false;
+  int slot;
+  int64_t offsetUs;
+  double skew;
+  long skewPpm;
+
+  for(i = 0; i < SAMPLES_PER_ROUND; i++)
+  {
+    usleep(rand() % SAMPLE_JITTER_US);
+    if(master_sample(board, (*seq)++, &sample) &&
+       (!haveBest || sample.roundTripUs < best.roundTripUs))
+    {
+      best = sample;
+      haveBest = true;
+    }
+  }
+  if(!haveBest)
+    return false;
+
+  // Board micros wrap every 71 minutes, the history must not
+  slot = board->numHistory % HISTORY_LENGTH;
+  if(board->numHistory == 0)
+    board->historyRefUs[slot] = 0;
+  else
+    board->historyRefUs[slot] = board->historyRefUs[(board->numHistory - 1) % HISTORY_LENGTH] +
+                                (uint32_t)(best.boardRefUs - board->lastRefUs);
+  board->historyOffsetUs[slot] = best.offsetUs;
+  board->lastRefUs = best.boardRefUs;
+  board->numHistory++;
+
+  master_fit(board, &offsetUs, &skew);
+  skewPpm = (long)(skew * 1000000 + (skew < 0 ? -0.5 : 0.5));
+  if(skewPpm > MAX_SKEW_PPM)
+    skewPpm = MAX_SKEW_PPM;
+  else if(skewPpm < -MAX_SKEW_PPM)
+    skewPpm = -MAX_SKEW_PPM;
+
+  snprintf(frame, sizeof(frame), "@O%d %lu %lld %ld\n", board->address,
+           (unsigned long)best.boardRefUs, (long long)offsetUs, skewPpm);
+  master_send(board, frame);
+
+  printf("board %d: offset %lld us, round trip %lld us (+/- %lld us), skew %ld ppm\n",
+         board->address, (long long)offsetUs, (long long)best.roundTripUs,
+         (long long)(best.roundTripUs / 2), skewPpm);
+  return true;
+}
+
+/**
+ * Name: master_swimAcross(Board * boards, int numBoards, long spacingMs)
+ * Desc: Schedules the fish of each board to swim east, one tank after
+ *       the other
+**/
+void master_swimAcross(Board * boards, int numBoards, long spacingMs)
+{
+  int i;
+  char frame[LINE_LENGTH];
+  uint64_t startUs = master_nowUs() + CHOREOGRAPHY_LEAD_US;
+  uint32_t atUs;
+
+  for(i = 0; i < numBoards; i++)
+  {
+    atUs = (uint32_t)(startUs + (uint64_t)i * spacingMs * 1000);
+    snprintf(frame, sizeof(frame), "@G%d %lu %d 0 0\n", boards[i].address,
+             (unsigned long)atUs, SWIM_ACROSS_X);
+    master_send(&boards[i], frame);
+    printf("board %d: fish leaves at %lu\n", boards[i].address, (unsigned long)atUs);
+  }
+}
+
+void printUsage(const char * name)
+{
+  fprintf(stderr, "usage: %s [-r rounds] [-p periodMs] [-c spacingMs] device:address ...\n", name);
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  int round;
+  int numBoards = 0;
+  int rounds = DEFAULT_ROUNDS;
+  long periodMs = DEFAULT_PERIOD_MS;
+  long spacingMs = 0;
+  long seq = 0;
+  uint64_t nextRoundUs;
+  uint64_t now;
+  Board boards[MAX_BOARDS];
+
+  for(i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      rounds = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+      periodMs = atol(argv[++i]);
+    else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      spacingMs = atol(argv[++i]);
+    else if(numBoards < MAX_BOARDS)
+    {
+      if(!master_openBoard(&boards[numBoards], argv[i]))
+      {
+        perror(argv[i]);
+        return 1;
+      }
+      numBoards++;
+    }
+  }
+
+  if(numBoards == 0)
+  {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  nextRoundUs = master_nowUs();
+  for(round = 0; round < rounds; round++)
+  {
+    now = master_nowUs();
+    if(now < nextRoundUs)
+      usleep(nextRoundUs - now);
+    nextRoundUs += periodMs * 1000;
+
+    for(i = 0; i < numBoards; i++)
+    {
+      if(!master_syncBoard(&boards[i], &seq))
+        printf("board %d: no answer\n", boards[i].address);
+    }
+
+    if(round == 0 && spacingMs > 0)
+      master_swimAcross(boards, numBoards, spacingMs);
+    fflush(stdout);
+  }
+
+  for(i = 0; i < numBoards; i++)
+    close(boards[i].fd);
+  return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ * Name: commission.cpp
+ * Desc: Calibrated power up of the simulated board for host harnesses
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#include "commission.h"
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "aquariumlogic.h"
+#include "hal_backend.h"
+
+#define MID_TRAVEL_READING 512
+
+const int modeledPotLines[NUM_MODELED_POTS] = {4, 5, 6};
+const int modeledServoPins[NUM_MODELED_POTS] = {4, 5, 6};
+
+void setup();
+void loop();
+
+void commission_attachModels()
+{
+  int i;
+
+  hal_setAnalogInput(LIGHT_AIN_PORT, BRIGHT_LIGHT_VAL);
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+    hal_attachPot(modeledPotLines[i], modeledServoPins[i], MID_TRAVEL_READING);
+}
+
+void commission_boot()
+{
+  setup();
+  while(!boot_isReady())
+    loop();
+}
+
+bool commission_calibrate(const char * path)
+{
+  int i;
+  unsigned int j;
+  boolean calibrating;
+  CrsDto dto;
+
+  // An uncalibrated servo: neutral pulse, unit slope, no learned pot window
+  hal_reset();
+  dto.position = MID_TRAVEL_READING;
+  dto.zeroValue = 1500;
+  dto.velocitySlope = 1;
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+  {
+    for(j = 0; j < sizeof(CrsDto); j++)
+      EEPROM.write(i * sizeof(CrsDto) + j, ((byte *)&dto)[j]);
+  }
+
+  commission_attachModels();
+  commission_boot();
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+    crs_startCalibration(i);
+  do
+  {
+    crs_stepCalibration();
+    calibrating = false;
+    for(i = 0; i < NUM_MODELED_POTS; i++)
+      calibrating = calibrating || crs_isCalibrating(i);
+  } while(calibrating);
+
+  return hal_saveEeprom(path);
+}
+
+bool commission_powerUp(const char * path)
+{
+  int fd = -1;
+  bool ok;
+  char commissionedPath[] = "/tmp/commission_eepromXXXXXX";
+
+  if(path == NULL)
+  {
+    fd = mkstemp(commissionedPath);
+    if(fd < 0 || !commission_calibrate(commissionedPath))
+    {
+      fprintf(stderr, "could not save the commissioned EEPROM image\n");
+      if(fd >= 0)
+      {
+        close(fd);
+        unlink(commissionedPath);
+      }
+      return false;
+    }
+    close(fd);
+    path = commissionedPath;
+  }
+
+  // Fresh power up restoring the calibration
+  hal_reset();
+  ok = hal_loadEeprom(path);
+  if(!ok)
+    fprintf(stderr, "could not read %s\n", path);
+  if(fd >= 0)
+    unlink(commissionedPath);
+  commission_attachModels();
+  return ok;
+}
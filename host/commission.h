@@ -0,0 +1,53 @@
+/**
+ * Name: commission.h
+ * Desc: Powers up the simulated board the way it runs in the tank: its
+ *       pots modeled on the servo pins setup() uses and a calibrated
+ *       EEPROM image, either loaded or made by commissioning from scratch
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Note: Simulator backend only, link commission.cpp with hal/hal_sim.cpp.
+ *       Booted on blank EEPROM the servos have no calibration and spin
+ *       away, so nothing a harness measures that way means much
+**/
+
+#ifndef COMMISSION_H
+#define COMMISSION_H
+
+#define LIGHT_AIN_PORT 12
+#define BRIGHT_LIGHT_VAL 800
+
+// Pot lines and servo pins used by setup() in aquariumlogic.ino
+#define NUM_MODELED_POTS 3
+extern const int modeledPotLines[NUM_MODELED_POTS];
+extern const int modeledServoPins[NUM_MODELED_POTS];
+
+/**
+ * Name: commission_attachModels()
+ * Desc: Lights the tank and attaches the modeled pots, all at mid travel
+**/
+void commission_attachModels();
+
+/**
+ * Name: commission_boot()
+ * Desc: Runs setup() and then loop() until the boot graph is done
+**/
+void commission_boot();
+
+/**
+ * Name: commission_calibrate(const char * path)
+ * Desc: Calibrates the servos from scratch, as on a new board, and saves
+ *       the EEPROM image
+ * Para: path, The file to save the image to
+ * Retr: False if the image could not be saved
+**/
+bool commission_calibrate(const char * path);
+
+/**
+ * Name: commission_powerUp(const char * path)
+ * Desc: Resets the simulator to a board powered up with a calibrated
+ *       EEPROM image and its models attached, ready for setup()
+ * Para: path, The image to load or NULL to commission a fresh one
+ * Retr: False if the image could not be read or made
+**/
+bool commission_powerUp(const char * path);
+
+#endif
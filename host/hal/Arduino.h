@@ -0,0 +1,105 @@
+/**
+ * Name: Arduino.h
+ * Desc: Host side stand in for the Arduino core so the sketch sources can
+ *       be compiled unchanged for Linux. Linked against one backend:
+ *       hal_host.cpp (wall clock) or hal_sim.cpp (simulated clock and
+ *       hardware), plus hal_common.cpp
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Note: long is 64 bits on the host, where it is 32 bits on the AVR
+**/
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+#define F_CPU 16000000UL
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define pgm_read_ptr(address) (*(void * const *)(address))
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// Uno hardware PWM pins
+#define digitalPinHasPWM(p) ((p) == 3 || (p) == 5 || (p) == 6 || (p) == 9 || (p) == 10 || (p) == 11)
+
+// Digital and analog I/O
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+// Time keeping
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Interrupt control (SREG bit 7 is the global interrupt flag)
+
+#define SREG_I 7
+
+extern volatile uint8_t SREG;
+void cli();
+void sei();
+void noInterrupts();
+void interrupts();
+
+// Random numbers
+
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+// Serial port
+
+class HardwareSerial
+{
+public:
+  void begin(unsigned long baud);
+  int available();
+  int read();
+  void flush();
+  size_t write(uint8_t value);
+  size_t print(const char * value);
+  size_t print(char value);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+  size_t println();
+  template <typename T> size_t println(T value)
+  {
+    size_t n = print(value);
+    return n + println();
+  }
+
+private:
+  size_t printNumber_(unsigned long value, int base);
+};
+
+extern HardwareSerial Serial;
+
+#endif
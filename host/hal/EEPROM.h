@@ -0,0 +1,24 @@
+/**
+ * Name: EEPROM.h
+ * Desc: Host side stand in for the Arduino EEPROM library, backed by RAM
+ *       and counting writes per address so wear can be measured
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#ifndef HOST_EEPROM_H
+#define HOST_EEPROM_H
+
+#include <Arduino.h>
+
+class EEPROMClass
+{
+public:
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value);
+  uint16_t length();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
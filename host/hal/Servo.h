@@ -0,0 +1,33 @@
+/**
+ * Name: Servo.h
+ * Desc: Host side stand in for the Arduino Servo library. Pulse widths are
+ *       recorded per pin so a backend can model the attached hardware
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#ifndef HOST_SERVO_H
+#define HOST_SERVO_H
+
+#include <Arduino.h>
+
+#define MIN_PULSE_WIDTH 544
+#define MAX_PULSE_WIDTH 2400
+#define DEFAULT_PULSE_WIDTH 1500
+
+class Servo
+{
+public:
+  Servo();
+  uint8_t attach(int pin);
+  void detach();
+  void write(int value);
+  void writeMicroseconds(int value);
+  int read();
+  int readMicroseconds();
+  bool attached();
+
+private:
+  int pin;
+};
+
+#endif
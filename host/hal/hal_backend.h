@@ -0,0 +1,241 @@
+/**
+ * Name: hal_backend.h
+ * Desc: Control interface for the host side hardware abstraction layer.
+ *       Tests, benchmarks and tools use it to drive inputs and inspect
+ *       outputs of the sketch running on the host
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#ifndef HAL_BACKEND_H
+#define HAL_BACKEND_H
+
+#include <Arduino.h>
+
+#define HAL_NUM_PINS 70
+#define HAL_NUM_ANALOG_LINES 16
+#define HAL_EEPROM_SIZE 1024
+#define HAL_SERIAL_RX_SIZE 256
+
+// Shared state and control (hal_common.cpp)
+
+/**
+ * Name: hal_reset()
+ * Desc: Returns every pin, servo, EEPROM byte and counter to power on state
+**/
+void hal_reset();
+
+/**
+ * Name: hal_setAnalogInput(int line, int value)
+ * Desc: Sets the value returned by analogRead for a line with no model
+ * Para: line, The analog line to drive
+ *       value, The raw reading (0 - 1023)
+**/
+void hal_setAnalogInput(int line, int value);
+
+/**
+ * Name: hal_getDigitalOutput(int pin)
+ * Desc: Get the last value written to a digital pin
+ * Para: pin, The pin to inspect
+ * Retr: HIGH or LOW
+**/
+int hal_getDigitalOutput(int pin);
+
+/**
+ * Name: hal_getPwmOutput(int pin)
+ * Desc: Get the last duty cycle written to a pin with analogWrite
+ * Para: pin, The pin to inspect
+ * Retr: Duty cycle (0 - 255), 255 / 0 for pins last set with digitalWrite
+**/
+int hal_getPwmOutput(int pin);
+
+/**
+ * Name: hal_getServoMicros(int pin)
+ * Desc: Get the pulse width being sent to the servo on the given pin
+ * Para: pin, The control pin of the servo
+ * Retr: Pulse width in microseconds or 0 if no servo is attached
+**/
+int hal_getServoMicros(int pin);
+
+/**
+ * Name: hal_getServoWrites(int pin)
+ * Desc: Get the number of pulse width updates sent to a servo pin
+ * Para: pin, The control pin of the servo
+ * Retr: Number of write / writeMicroseconds calls
+**/
+unsigned long hal_getServoWrites(int pin);
+
+/**
+ * Name: hal_getEepromWrites(int address)
+ * Desc: Get the number of write cycles an EEPROM cell has seen
+ * Para: address, The cell to inspect or -1 for the total over all cells
+ * Retr: Number of writes
+**/
+unsigned long hal_getEepromWrites(int address);
+
+/**
+ * Name: hal_loadEeprom(const char * path) / hal_saveEeprom(const char * path)
+ * Desc: Persist the EEPROM contents between host runs
+ * Para: path, The file holding the EEPROM image
+ * Retr: False if the file could not be read / written
+**/
+bool hal_loadEeprom(const char * path);
+bool hal_saveEeprom(const char * path);
+
+/**
+ * Name: hal_pushSerialInput(const char * data, int length)
+ * Desc: Queues bytes to be returned by Serial.read
+ * Para: data, The bytes to queue
+ *       length, The number of bytes to queue
+**/
+void hal_pushSerialInput(const char * data, int length);
+
+/**
+ * Name: hal_setSerialEcho(bool echo)
+ * Desc: Sets if Serial output should be copied to stdout
+ * Para: echo, True to echo output
+**/
+void hal_setSerialEcho(bool echo);
+
+/**
+ * Name: hal_attachSerialDevice(int fd)
+ * Desc: Connects Serial to a file descriptor (a tty or pseudo-terminal),
+ *       so the sketch talks to other processes as it would over USB
+ * Para: fd, Non-blocking descriptor to read and write, -1 to detach
+**/
+void hal_attachSerialDevice(int fd);
+
+// Backend specific (hal_host.cpp or hal_sim.cpp)
+
+/**
+ * Name: hal_getCycles()
+ * Desc: Get the number of CPU cycles the backend has accounted for
+ * Retr: Elapsed cycles at F_CPU since reset
+**/
+uint64_t hal_getCycles();
+
+/**
+ * Name: hal_advance(uint64_t us)
+ * Desc: Lets the given amount of time pass without running sketch code
+ * Para: us, Microseconds to let pass
+**/
+void hal_advance(uint64_t us);
+
+/**
+ * Name: hal_attachPot(int analogLine, int servoPin, int startReading)
+ * Desc: Models a continuous rotation servo with a pot on its output shaft.
+ *       Reads of analogLine follow the rotation caused by servoPin's pulses
+ * Para: analogLine, The line the pot is read on
+ *       servoPin, The control pin of the servo turning the pot
+ *       startReading, The pot reading at reset
+**/
+void hal_attachPot(int analogLine, int servoPin, int startReading);
+
+/**
+ * Name: hal_getPotTurns(int analogLine)
+ * Desc: Get the absolute modeled shaft position of a pot
+ * Para: analogLine, The line the pot is read on
+ * Retr: Shaft position in turns since reset
+**/
+double hal_getPotTurns(int analogLine);
+
+// Simulator backend only (hal_sim.cpp)
+
+#define HAL_NUM_ISR_VECTORS 8 // Lower vectors run first, as on the AVR
+#define HAL_ISR_OFF 0
+#define HAL_ISR_CYCLE 1 // Due by simulated time, run at the next interrupt point
+#define HAL_ISR_RANDOM 2 // At random host moments, between any two instructions
+
+typedef void (*HalIsr)();
+
+/**
+ * Name: hal_attachIsr(int vector, HalIsr handler, uint32_t periodCycles)
+ * Desc: Installs an emulated interrupt handler, eg. one standing in for a
+ *       pin change or timer interrupt that writes state the loop reads
+ * Para: vector, Which vector (0 - HAL_NUM_ISR_VECTORS - 1)
+ *       handler, Run with interrupts disabled, NULL to detach
+ *       periodCycles, How often the interrupt is raised in HAL_ISR_CYCLE mode
+**/
+void hal_attachIsr(int vector, HalIsr handler, uint32_t periodCycles);
+
+/**
+ * Name: hal_setIsrMode(int mode, unsigned long meanIntervalUs)
+ * Desc: Chooses when attached handlers run, nothing is run in HAL_ISR_OFF.
+ *       HAL_ISR_CYCLE is deterministic: an interrupt raised while the loop
+ *       runs is taken at the next interrupt point with SREG_I set, that is
+ *       the end of any core routine, a delay, or (if the sketch is built
+ *       with -finstrument-functions) the entry or exit of any sketch
+ *       function. HAL_ISR_RANDOM interrupts the loop from a timer signal
+ *       wherever it is, running every attached handler, and finds races a
+ *       cycle accurate order never lines up
+ * Para: mode, HAL_ISR_*
+ *       meanIntervalUs, Mean host time between HAL_ISR_RANDOM interrupts
+ * Note: Handlers run in HAL_ISR_RANDOM mode must not print or allocate,
+ *       they run in a signal handler. Raised while SREG_I is clear, they
+ *       wait for the next interrupt point after it is set again
+**/
+void hal_setIsrMode(int mode, unsigned long meanIntervalUs);
+
+/**
+ * Name: hal_getIsrCount(int vector)
+ * Desc: Get how many times a vector's handler has run since it was attached
+**/
+unsigned long hal_getIsrCount(int vector);
+
+// Host backend only (hal_host.cpp)
+
+/**
+ * Name: hal_setClockError(long offsetUs, double skewPpm)
+ * Desc: Makes millis / micros run off from the wall clock like a real
+ *       board's crystal, to test clock synchronization on one machine
+ * Para: offsetUs, Constant offset added to the clock
+ *       skewPpm, Rate error in parts per million
+**/
+void hal_setClockError(long offsetUs, double skewPpm);
+
+// Hooks the backend provides to hal_common.cpp
+
+/**
+ * Name: hal_resetBackend_()
+ * Desc: Returns backend state (clock, models) to power on state
+**/
+void hal_resetBackend_();
+
+/**
+ * Name: hal_charge_(uint32_t cycles)
+ * Desc: Accounts for the time an emulated core routine takes
+ * Para: cycles, The cost of the routine on the AVR
+**/
+void hal_charge_(uint32_t cycles);
+
+/**
+ * Name: hal_onServoChange_(int pin, int oldMicros)
+ * Desc: Notifies the backend a servo pulse width is about to change
+ * Para: pin, The control pin of the servo
+ *       oldMicros, The pulse width before the change
+**/
+void hal_onServoChange_(int pin, int oldMicros);
+
+/**
+ * Name: hal_onSerialByte_(uint8_t value)
+ * Desc: Lets the backend account for a byte sent over Serial, blocking
+ *       while the modeled transmit buffer is full
+ * Para: value, The byte written
+**/
+void hal_onSerialByte_(uint8_t value);
+
+/**
+ * Name: hal_onSerialFlush_()
+ * Desc: Blocks until every byte written has left the modeled transmit
+ *       buffer at the rate set by Serial.begin, as Serial.flush does
+**/
+void hal_onSerialFlush_();
+
+// Shared state (owned by hal_common.cpp, used by the backends)
+
+extern int halAnalogInputs[HAL_NUM_ANALOG_LINES];
+extern uint8_t halDigitalOutputs[HAL_NUM_PINS];
+extern uint8_t halPwmOutputs[HAL_NUM_PINS];
+extern int halServoMicros[HAL_NUM_PINS];
+extern unsigned long halSerialBaud;
+
+#endif
@@ -0,0 +1,500 @@
+/**
+ * Name: hal_common.cpp
+ * Desc: Backend independent parts of the host hardware abstraction layer:
+ *       pin state, Servo, EEPROM and Serial formatting
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#include <Arduino.h>
+#include <Servo.h>
+#include <EEPROM.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "hal_backend.h"
+
+// Approximate cost (cycles at 16MHz) of the AVR core routines
+#define HAL_CYCLES_PIN_MODE 60
+#define HAL_CYCLES_DIGITAL_WRITE 56
+#define HAL_CYCLES_DIGITAL_READ 52
+#define HAL_CYCLES_ANALOG_WRITE 80
+#define HAL_CYCLES_SERVO_WRITE_US 90
+#define HAL_CYCLES_SERVO_WRITE 210
+#define HAL_CYCLES_EEPROM_READ 30
+#define HAL_CYCLES_EEPROM_WRITE 54400 // 3.4ms programming time
+#define HAL_CYCLES_SERIAL_AVAILABLE 20
+#define HAL_CYCLES_SERIAL_READ 30
+
+int halAnalogInputs[HAL_NUM_ANALOG_LINES];
+uint8_t halDigitalOutputs[HAL_NUM_PINS];
+uint8_t halPwmOutputs[HAL_NUM_PINS];
+int halServoMicros[HAL_NUM_PINS];
+unsigned long halSerialBaud;
+volatile uint8_t SREG;
+
+uint8_t halPinModes[HAL_NUM_PINS];
+unsigned long halServoWrites[HAL_NUM_PINS];
+uint8_t halEeprom[HAL_EEPROM_SIZE];
+unsigned long halEepromWrites[HAL_EEPROM_SIZE];
+char halSerialRx[HAL_SERIAL_RX_SIZE];
+int halSerialRxHead;
+int halSerialRxTail;
+bool halSerialEcho;
+int halSerialDevice = -1;
+unsigned long halRandomState = 1;
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+void hal_reset()
+{
+  memset(halAnalogInputs, 0, sizeof(halAnalogInputs));
+  memset(halDigitalOutputs, 0, sizeof(halDigitalOutputs));
+  memset(halPwmOutputs, 0, sizeof(halPwmOutputs));
+  memset(halServoMicros, 0, sizeof(halServoMicros));
+  memset(halPinModes, 0, sizeof(halPinModes));
+  memset(halServoWrites, 0, sizeof(halServoWrites));
+  memset(halEeprom, 0xFF, sizeof(halEeprom));
+  memset(halEepromWrites, 0, sizeof(halEepromWrites));
+  halSerialRxHead = 0;
+  halSerialRxTail = 0;
+  halSerialBaud = 0;
+  halRandomState = 1;
+  SREG = 1 << SREG_I;
+  hal_resetBackend_();
+}
+
+void hal_setAnalogInput(int line, int value)
+{
+  if(0 <= line && line < HAL_NUM_ANALOG_LINES)
+    halAnalogInputs[line] = value;
+}
+
+int hal_getDigitalOutput(int pin)
+{
+  if(pin < 0 || pin >= HAL_NUM_PINS)
+    return LOW;
+  return halDigitalOutputs[pin];
+}
+
+int hal_getServoMicros(int pin)
+{
+  if(pin < 0 || pin >= HAL_NUM_PINS)
+    return 0;
+  return halServoMicros[pin];
+}
+
+int hal_getPwmOutput(int pin)
+{
+  if(pin < 0 || pin >= HAL_NUM_PINS)
+    return 0;
+  return halPwmOutputs[pin];
+}
+
+unsigned long hal_getServoWrites(int pin)
+{
+  if(pin < 0 || pin >= HAL_NUM_PINS)
+    return 0;
+  return halServoWrites[pin];
+}
+
+unsigned long hal_getEepromWrites(int address)
+{
+  int i;
+  unsigned long total;
+
+  if(address >= 0)
+    return address < HAL_EEPROM_SIZE ? halEepromWrites[address] : 0;
+
+  total = 0;
+  for(i = 0; i < HAL_EEPROM_SIZE; i++)
+    total += halEepromWrites[i];
+  return total;
+}
+
+bool hal_loadEeprom(const char * path)
+{
+  bool ok;
+  FILE * file = fopen(path, "rb");
+  if(file == NULL)
+    return false;
+  ok = fread(halEeprom, 1, HAL_EEPROM_SIZE, file) == HAL_EEPROM_SIZE;
+  fclose(file);
+  return ok;
+}
+
+bool hal_saveEeprom(const char * path)
+{
+  bool ok;
+  FILE * file = fopen(path, "wb");
+  if(file == NULL)
+    return false;
+  ok = fwrite(halEeprom, 1, HAL_EEPROM_SIZE, file) == HAL_EEPROM_SIZE;
+  ok = (fclose(file) == 0) && ok;
+  return ok;
+}
+
+void hal_pushSerialInput(const char * data, int length)
+{
+  int i;
+  int next;
+
+  for(i = 0; i < length; i++)
+  {
+    next = (halSerialRxHead + 1) % HAL_SERIAL_RX_SIZE;
+    if(next == halSerialRxTail)
+      return; // Overrun, the byte is dropped as on the board
+    halSerialRx[halSerialRxHead] = data[i];
+    halSerialRxHead = next;
+  }
+}
+
+void hal_setSerialEcho(bool echo)
+{
+  halSerialEcho = echo;
+}
+
+void hal_attachSerialDevice(int fd)
+{
+  halSerialDevice = fd;
+}
+
+/**
+ * Name: hal_pollSerialDevice_()
+ * Desc: Moves whatever the attached device has waiting into the receive
+ *       buffer, as the USART interrupt would
+**/
+void hal_pollSerialDevice_()
+{
+  char buffer[HAL_SERIAL_RX_SIZE];
+  ssize_t length;
+  int space;
+
+  if(halSerialDevice < 0)
+    return;
+
+  // Leave the rest in the device rather than overrunning
+  space = HAL_SERIAL_RX_SIZE - 1 -
+          (halSerialRxHead - halSerialRxTail + HAL_SERIAL_RX_SIZE) % HAL_SERIAL_RX_SIZE;
+  if(space <= 0)
+    return;
+  length = ::read(halSerialDevice, buffer, space);
+  if(length > 0)
+    hal_pushSerialInput(buffer, length);
+}
+
+// Digital I/O
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  hal_charge_(HAL_CYCLES_PIN_MODE);
+  if(pin < HAL_NUM_PINS)
+    halPinModes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  hal_charge_(HAL_CYCLES_DIGITAL_WRITE);
+  if(pin < HAL_NUM_PINS)
+  {
+    halDigitalOutputs[pin] = val ? HIGH : LOW;
+    halPwmOutputs[pin] = val ? 255 : 0;
+  }
+}
+
+void analogWrite(uint8_t pin, int val)
+{
+  hal_charge_(HAL_CYCLES_ANALOG_WRITE);
+  if(pin >= HAL_NUM_PINS)
+    return;
+  if(val < 0)
+    val = 0;
+  if(val > 255)
+    val = 255;
+  halPwmOutputs[pin] = val;
+  halDigitalOutputs[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin)
+{
+  hal_charge_(HAL_CYCLES_DIGITAL_READ);
+  if(pin >= HAL_NUM_PINS)
+    return LOW;
+  return halDigitalOutputs[pin];
+}
+
+// Interrupt control
+
+void cli()
+{
+  hal_charge_(1);
+  SREG &= ~(1 << SREG_I);
+}
+
+void sei()
+{
+  hal_charge_(1);
+  SREG |= 1 << SREG_I;
+}
+
+void noInterrupts()
+{
+  cli();
+}
+
+void interrupts()
+{
+  sei();
+}
+
+// Random numbers (same generator as avr-libc random())
+
+long random(long howBig)
+{
+  long hi;
+  long lo;
+  long x;
+
+  if(howBig == 0)
+    return 0;
+
+  // Park-Miller minimal standard, as used by avr-libc
+  x = (long)(halRandomState % 0x7ffffffeUL) + 1;
+  hi = x / 127773;
+  lo = x % 127773;
+  x = 16807 * lo - 2836 * hi;
+  if(x < 0)
+    x += 0x7fffffff;
+  halRandomState = x - 1;
+  return (x - 1) % howBig;
+}
+
+long random(long howSmall, long howBig)
+{
+  if(howSmall >= howBig)
+    return howSmall;
+  return random(howBig - howSmall) + howSmall;
+}
+
+void randomSeed(unsigned long seed)
+{
+  if(seed != 0)
+    halRandomState = seed;
+}
+
+// Servo
+
+Servo::Servo()
+{
+  pin = -1;
+}
+
+uint8_t Servo::attach(int newPin)
+{
+  if(newPin < 0 || newPin >= HAL_NUM_PINS)
+    return 0;
+  pin = newPin;
+  if(halServoMicros[pin] == 0)
+    writeMicroseconds(DEFAULT_PULSE_WIDTH);
+  return 1;
+}
+
+void Servo::detach()
+{
+  if(pin >= 0)
+  {
+    hal_onServoChange_(pin, halServoMicros[pin]);
+    halServoMicros[pin] = 0;
+  }
+  pin = -1;
+}
+
+void Servo::write(int value)
+{
+  // Values below the minimum pulse are angles, as in the real library
+  if(value < MIN_PULSE_WIDTH)
+  {
+    if(value < 0)
+      value = 0;
+    if(value > 180)
+      value = 180;
+    value = MIN_PULSE_WIDTH + (long)value * (MAX_PULSE_WIDTH - MIN_PULSE_WIDTH) / 180;
+  }
+  hal_charge_(HAL_CYCLES_SERVO_WRITE - HAL_CYCLES_SERVO_WRITE_US);
+  writeMicroseconds(value);
+}
+
+void Servo::writeMicroseconds(int value)
+{
+  hal_charge_(HAL_CYCLES_SERVO_WRITE_US);
+  if(pin < 0)
+    return;
+
+  if(value < MIN_PULSE_WIDTH)
+    value = MIN_PULSE_WIDTH;
+  if(value > MAX_PULSE_WIDTH)
+    value = MAX_PULSE_WIDTH;
+
+  hal_onServoChange_(pin, halServoMicros[pin]);
+  halServoMicros[pin] = value;
+  halServoWrites[pin]++;
+}
+
+int Servo::read()
+{
+  if(pin < 0)
+    return 0;
+  return ((long)halServoMicros[pin] - MIN_PULSE_WIDTH) * 180 / (MAX_PULSE_WIDTH - MIN_PULSE_WIDTH);
+}
+
+int Servo::readMicroseconds()
+{
+  if(pin < 0)
+    return 0;
+  return halServoMicros[pin];
+}
+
+bool Servo::attached()
+{
+  return pin >= 0;
+}
+
+// EEPROM
+
+uint8_t EEPROMClass::read(int address)
+{
+  hal_charge_(HAL_CYCLES_EEPROM_READ);
+  if(address < 0 || address >= HAL_EEPROM_SIZE)
+    return 0xFF;
+  return halEeprom[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+  hal_charge_(HAL_CYCLES_EEPROM_WRITE);
+  if(address < 0 || address >= HAL_EEPROM_SIZE)
+    return;
+  halEeprom[address] = value;
+  halEepromWrites[address]++;
+}
+
+void EEPROMClass::update(int address, uint8_t value)
+{
+  if(read(address) != value)
+    write(address, value);
+}
+
+uint16_t EEPROMClass::length()
+{
+  return HAL_EEPROM_SIZE;
+}
+
+// Serial
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  halSerialBaud = baud;
+}
+
+int HardwareSerial::available()
+{
+  hal_charge_(HAL_CYCLES_SERIAL_AVAILABLE);
+  hal_pollSerialDevice_();
+  return (halSerialRxHead - halSerialRxTail + HAL_SERIAL_RX_SIZE) % HAL_SERIAL_RX_SIZE;
+}
+
+int HardwareSerial::read()
+{
+  int value;
+
+  hal_charge_(HAL_CYCLES_SERIAL_READ);
+  if(halSerialRxHead == halSerialRxTail)
+    return -1;
+  value = (uint8_t)halSerialRx[halSerialRxTail];
+  halSerialRxTail = (halSerialRxTail + 1) % HAL_SERIAL_RX_SIZE;
+  return value;
+}
+
+void HardwareSerial::flush()
+{
+  hal_onSerialFlush_();
+  if(halSerialEcho)
+    fflush(stdout);
+}
+
+size_t HardwareSerial::write(uint8_t value)
+{
+  hal_onSerialByte_(value);
+  if(halSerialDevice >= 0)
+    ::write(halSerialDevice, &value, 1);
+  if(halSerialEcho)
+    putchar(value);
+  return 1;
+}
+
+size_t HardwareSerial::print(const char * value)
+{
+  size_t n = 0;
+  while(*value)
+    n += write(*value++);
+  return n;
+}
+
+size_t HardwareSerial::print(char value)
+{
+  return write(value);
+}
+
+size_t HardwareSerial::print(int value, int base)
+{
+  return print((long)value, base);
+}
+
+size_t HardwareSerial::print(unsigned int value, int base)
+{
+  return print((unsigned long)value, base);
+}
+
+size_t HardwareSerial::print(long value, int base)
+{
+  if(base == DEC && value < 0)
+    return write('-') + printNumber_(-(unsigned long)value, base);
+  return printNumber_(value, base);
+}
+
+size_t HardwareSerial::print(unsigned long value, int base)
+{
+  return printNumber_(value, base);
+}
+
+size_t HardwareSerial::print(double value, int digits)
+{
+  char buffer[48];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return print(buffer);
+}
+
+size_t HardwareSerial::println()
+{
+  return write('\r') + write('\n');
+}
+
+size_t HardwareSerial::printNumber_(unsigned long value, int base)
+{
+  char buffer[8 * sizeof(unsigned long) + 1];
+  char * digit = &buffer[sizeof(buffer) - 1];
+
+  if(base < 2)
+    base = DEC;
+
+  *digit = '\0';
+  do
+  {
+    int remainder = value % base;
+    value /= base;
+    *--digit = remainder < 10 ? '0' + remainder : 'A' + remainder - 10;
+  }
+  while(value);
+
+  return print(digit);
+}
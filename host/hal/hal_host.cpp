@@ -0,0 +1,166 @@
+/**
+ * Name: hal_host.cpp
+ * Desc: Linux host backend for the hardware abstraction layer. Time comes
+ *       from the monotonic wall clock and analog inputs hold whatever
+ *       value was last set through hal_setAnalogInput
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#include <Arduino.h>
+#include <time.h>
+
+#include "hal_backend.h"
+
+#define HOST_SERIAL_TX_BUFFER 64
+#define HOST_SERIAL_BITS_PER_BYTE 10
+
+struct timespec hostStart;
+long hostClockOffsetUs;
+double hostClockSkewPpm;
+uint64_t hostSerialFreeAtUs; // When the modeled UART has sent all it was given
+
+/**
+ * Name: host_elapsedUs_()
+ * Desc: Get the wall clock microseconds since the backend was reset
+**/
+uint64_t host_elapsedUs_()
+{
+  struct timespec now;
+
+  if(hostStart.tv_sec == 0 && hostStart.tv_nsec == 0)
+    clock_gettime(CLOCK_MONOTONIC, &hostStart);
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)(now.tv_sec - hostStart.tv_sec) * 1000000 +
+         (now.tv_nsec - hostStart.tv_nsec) / 1000;
+}
+
+/**
+ * Name: host_boardUs_()
+ * Desc: Get the time the sketch sees, the wall clock with the configured
+ *       offset and rate error applied
+**/
+uint64_t host_boardUs_()
+{
+  uint64_t elapsed = host_elapsedUs_();
+  return elapsed + hostClockOffsetUs + (int64_t)(elapsed * hostClockSkewPpm / 1000000);
+}
+
+/**
+ * Name: host_sleepUs_(uint64_t us)
+ * Desc: Sleeps the calling thread for the given time
+**/
+void host_sleepUs_(uint64_t us)
+{
+  struct timespec duration;
+
+  duration.tv_sec = us / 1000000;
+  duration.tv_nsec = (us % 1000000) * 1000;
+  while(nanosleep(&duration, &duration) != 0)
+    ;
+}
+
+void hal_resetBackend_()
+{
+  clock_gettime(CLOCK_MONOTONIC, &hostStart);
+  hostClockOffsetUs = 0;
+  hostClockSkewPpm = 0;
+  hostSerialFreeAtUs = 0;
+}
+
+void hal_setClockError(long offsetUs, double skewPpm)
+{
+  hostClockOffsetUs = offsetUs;
+  hostClockSkewPpm = skewPpm;
+}
+
+void hal_charge_(uint32_t cycles)
+{
+}
+
+void hal_onServoChange_(int pin, int oldMicros)
+{
+}
+
+void hal_onSerialByte_(uint8_t value)
+{
+  uint64_t byteUs;
+  uint64_t room;
+  uint64_t now;
+
+  if(halSerialBaud == 0)
+    return;
+
+  // A device written to takes bytes at once, the board's UART does not.
+  // Block while its transmit buffer would be full, as HardwareSerial does
+  byteUs = 1000000ULL * HOST_SERIAL_BITS_PER_BYTE / halSerialBaud;
+  room = (HOST_SERIAL_TX_BUFFER - 1) * byteUs;
+  now = host_elapsedUs_();
+  if(hostSerialFreeAtUs > now + room)
+  {
+    host_sleepUs_(hostSerialFreeAtUs - room - now);
+    now = hostSerialFreeAtUs - room;
+  }
+
+  if(hostSerialFreeAtUs < now)
+    hostSerialFreeAtUs = now;
+  hostSerialFreeAtUs += byteUs;
+}
+
+void hal_onSerialFlush_()
+{
+  uint64_t now = host_elapsedUs_();
+
+  if(hostSerialFreeAtUs > now)
+    host_sleepUs_(hostSerialFreeAtUs - now);
+}
+
+uint64_t hal_getCycles()
+{
+  return host_elapsedUs_() * (F_CPU / 1000000UL);
+}
+
+void hal_advance(uint64_t us)
+{
+  host_sleepUs_(us);
+}
+
+void hal_attachPot(int analogLine, int servoPin, int startReading)
+{
+  // No shaft model on the host, the pot simply holds its reading
+  hal_setAnalogInput(analogLine, startReading);
+}
+
+double hal_getPotTurns(int analogLine)
+{
+  if(analogLine < 0 || analogLine >= HAL_NUM_ANALOG_LINES)
+    return 0;
+  return halAnalogInputs[analogLine] / 1024.0;
+}
+
+int analogRead(uint8_t pin)
+{
+  if(pin >= HAL_NUM_ANALOG_LINES)
+    return 0;
+  return halAnalogInputs[pin];
+}
+
+unsigned long millis()
+{
+  return (uint32_t)(host_boardUs_() / 1000);
+}
+
+unsigned long micros()
+{
+  return (uint32_t)host_boardUs_();
+}
+
+void delay(unsigned long ms)
+{
+  host_sleepUs_((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  host_sleepUs_(us);
+}
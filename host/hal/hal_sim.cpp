@@ -0,0 +1,454 @@
+/**
+ * Name: hal_sim.cpp
+ * Desc: Simulator backend for the host hardware abstraction layer. Time is
+ *       a virtual cycle counter advanced by the modeled cost of every core
+ *       routine (and by delay), so runs are deterministic and can cover
+ *       days of operation in seconds. Continuous rotation servos with pots
+ *       on their shafts are modeled so calibration and correction see
+ *       realistic readings
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Note: Only core routines are charged, the sketch's own arithmetic is
+ *       not, so timings are a lower bound on the board's.
+ *       Emulated interrupts (hal_attachIsr) are taken where the sketch
+ *       calls into the core, or anywhere at all in HAL_ISR_RANDOM mode
+**/
+
+#include <Arduino.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "hal_backend.h"
+
+#define SIM_CYCLES_PER_US (F_CPU / 1000000UL)
+#define SIM_CYCLES_PER_MS (F_CPU / 1000UL)
+
+// Approximate cost (cycles at 16MHz) of the AVR core routines
+#define SIM_CYCLES_ANALOG_READ 1776 // 13 ADC clocks at /128 plus overhead
+#define SIM_CYCLES_MILLIS 22
+#define SIM_CYCLES_MICROS 36
+#define SIM_CYCLES_SERIAL_BYTE 40
+#define SIM_SERIAL_TX_BUFFER 64
+#define SIM_SERIAL_BITS_PER_BYTE 10
+
+// Continuous rotation servo with pot model
+#define SIM_SERVO_ZERO_US 1500
+#define SIM_SERVO_DEADBAND_US 4
+#define SIM_TURNS_PER_SEC_PER_US (1.0 / 400)
+#define SIM_MAX_TURNS_PER_SEC 1.0
+#define SIM_POT_ELECTRICAL_FRACTION 0.95 // Rest of the turn reads as the dead zone
+#define SIM_POT_MAX_READING 1023
+
+// Emulated interrupts
+#define SIM_CYCLES_ISR 10 // Vectoring in and reti, the handler's own work is charged as it goes
+#define SIM_ISR_SIGNAL SIGALRM
+
+typedef struct
+{
+  int servoPin;
+  double turns;
+  uint64_t lastUpdate;
+} SimPot;
+
+uint64_t simCycles;
+uint64_t simSerialFreeAt;
+SimPot simPots[HAL_NUM_ANALOG_LINES];
+
+typedef struct
+{
+  HalIsr handler;
+  uint32_t periodCycles;
+  uint64_t dueAt;
+  unsigned long count;
+} SimIsr;
+
+SimIsr simIsrs[HAL_NUM_ISR_VECTORS];
+int simIsrMode;
+volatile sig_atomic_t simInIsr;
+volatile sig_atomic_t simRandomPending; // Raised while SREG_I was clear
+unsigned long simIsrMeanUs;
+uint32_t simIsrRandomState;
+timer_t simIsrTimer;
+bool simIsrTimerCreated;
+
+/**
+ * Name: sim_turnsPerSec_(int micros)
+ * Desc: Get the shaft speed produced by a continuous rotation servo pulse
+ * Para: micros, The pulse width being sent to the servo
+ * Retr: Speed in turns per second
+**/
+double sim_turnsPerSec_(int micros)
+{
+  double speed;
+  int offset;
+
+  if(micros == 0)
+    return 0;
+
+  offset = micros - SIM_SERVO_ZERO_US;
+  if(-SIM_SERVO_DEADBAND_US <= offset && offset <= SIM_SERVO_DEADBAND_US)
+    return 0;
+
+  speed = offset * SIM_TURNS_PER_SEC_PER_US;
+  if(speed > SIM_MAX_TURNS_PER_SEC)
+    speed = SIM_MAX_TURNS_PER_SEC;
+  else if(speed < -SIM_MAX_TURNS_PER_SEC)
+    speed = -SIM_MAX_TURNS_PER_SEC;
+  return speed;
+}
+
+/**
+ * Name: sim_updatePot_(int line, int micros)
+ * Desc: Integrates a pot's shaft position up to the current cycle
+ * Para: line, The analog line of the pot
+ *       micros, The pulse width that has been driving it since last update
+**/
+void sim_updatePot_(int line, int micros)
+{
+  SimPot * pot = &(simPots[line]);
+  double seconds = (double)(simCycles - pot->lastUpdate) / F_CPU;
+
+  pot->turns += sim_turnsPerSec_(micros) * seconds;
+  pot->lastUpdate = simCycles;
+}
+
+/**
+ * Name: sim_readPot_(int line)
+ * Desc: Get the raw reading of a modeled pot, including its dead zone
+ * Para: line, The analog line of the pot
+**/
+int sim_readPot_(int line)
+{
+  double fraction;
+
+  sim_updatePot_(line, halServoMicros[simPots[line].servoPin]);
+  fraction = simPots[line].turns - floor(simPots[line].turns);
+  if(fraction >= SIM_POT_ELECTRICAL_FRACTION)
+    return SIM_POT_MAX_READING;
+  return (int)(fraction / SIM_POT_ELECTRICAL_FRACTION * SIM_POT_MAX_READING);
+}
+
+/**
+ * Name: sim_runIsr_(int vector)
+ * Desc: Runs a handler as the AVR would, interrupts off until it returns
+**/
+void sim_runIsr_(int vector)
+{
+  uint8_t oldSREG = SREG;
+
+  simInIsr = 1;
+  SREG = oldSREG & ~(1 << SREG_I);
+  simCycles += SIM_CYCLES_ISR;
+  simIsrs[vector].count++;
+  simIsrs[vector].handler();
+  SREG = oldSREG;
+  simInIsr = 0;
+}
+
+/**
+ * Name: sim_pollIsrs_()
+ * Desc: An interrupt point, takes whatever interrupts are due and enabled
+**/
+void sim_pollIsrs_() __attribute__((no_instrument_function));
+void sim_pollIsrs_()
+{
+  int i;
+
+  if(simIsrMode == HAL_ISR_OFF || simInIsr || !(SREG & (1 << SREG_I)))
+    return;
+
+  if(simIsrMode == HAL_ISR_RANDOM)
+  {
+    if(!simRandomPending)
+      return;
+    simRandomPending = 0;
+    for(i = 0; i < HAL_NUM_ISR_VECTORS; i++)
+    {
+      if(simIsrs[i].handler != NULL)
+        sim_runIsr_(i);
+    }
+    return;
+  }
+
+  // Each vector has one flag, so a late interrupt is taken once
+  for(i = 0; i < HAL_NUM_ISR_VECTORS; i++)
+  {
+    if(simIsrs[i].handler == NULL || simCycles < simIsrs[i].dueAt)
+      continue;
+    simIsrs[i].dueAt += ((simCycles - simIsrs[i].dueAt) / simIsrs[i].periodCycles + 1) * simIsrs[i].periodCycles;
+    sim_runIsr_(i);
+  }
+}
+
+/**
+ * Name: sim_advanceTo_(uint64_t cycles)
+ * Desc: Lets time pass without sketch code (delay), taking each cycle
+ *       accurate interrupt at the moment it is due
+**/
+void sim_advanceTo_(uint64_t cycles)
+{
+  int i;
+  uint64_t next;
+
+  while(simIsrMode == HAL_ISR_CYCLE && !simInIsr && (SREG & (1 << SREG_I)))
+  {
+    next = cycles;
+    for(i = 0; i < HAL_NUM_ISR_VECTORS; i++)
+    {
+      if(simIsrs[i].handler != NULL && simIsrs[i].dueAt < next)
+        next = simIsrs[i].dueAt;
+    }
+    if(next >= cycles)
+      break;
+    if(next > simCycles)
+      simCycles = next;
+    sim_pollIsrs_();
+  }
+  if(cycles > simCycles)
+    simCycles = cycles;
+  sim_pollIsrs_();
+}
+
+/**
+ * Name: sim_armRandomIsr_()
+ * Desc: Schedules the next HAL_ISR_RANDOM interrupt an exponentially
+ *       distributed time away
+**/
+void sim_armRandomIsr_()
+{
+  double uniform;
+  long long ns;
+  struct itimerspec when;
+
+  // Own generator, rand() is not safe in the signal handler
+  simIsrRandomState = simIsrRandomState * 1664525 + 1013904223;
+  uniform = ((simIsrRandomState >> 8) + 1) / 16777217.0;
+  ns = (long long)(-log(uniform) * simIsrMeanUs * 1000) + 1;
+
+  memset(&when, 0, sizeof(when));
+  when.it_value.tv_sec = ns / 1000000000;
+  when.it_value.tv_nsec = ns % 1000000000;
+  timer_settime(simIsrTimer, 0, &when, NULL);
+}
+
+/**
+ * Name: sim_onRandomIsr_(int signal)
+ * Desc: The loop has been interrupted, wherever it was
+**/
+void sim_onRandomIsr_(int signal)
+{
+  if(simIsrMode != HAL_ISR_RANDOM)
+    return;
+  sim_armRandomIsr_();
+  simRandomPending = 1;
+  sim_pollIsrs_();
+}
+
+/**
+ * Name: sim_stopRandomIsrs_()
+ * Desc: Disarms the HAL_ISR_RANDOM timer
+**/
+void sim_stopRandomIsrs_()
+{
+  struct itimerspec never;
+
+  if(!simIsrTimerCreated)
+    return;
+  memset(&never, 0, sizeof(never));
+  timer_settime(simIsrTimer, 0, &never, NULL);
+}
+
+void hal_resetBackend_()
+{
+  int i;
+
+  sim_stopRandomIsrs_();
+  simIsrMode = HAL_ISR_OFF;
+  simInIsr = 0;
+  simRandomPending = 0;
+  for(i = 0; i < HAL_NUM_ISR_VECTORS; i++)
+  {
+    simIsrs[i].handler = NULL;
+    simIsrs[i].count = 0;
+  }
+
+  simCycles = 0;
+  simSerialFreeAt = 0;
+  for(i = 0; i < HAL_NUM_ANALOG_LINES; i++)
+  {
+    simPots[i].servoPin = -1;
+    simPots[i].turns = 0;
+    simPots[i].lastUpdate = 0;
+  }
+}
+
+void hal_charge_(uint32_t cycles)
+{
+  simCycles += cycles;
+  if(simIsrMode != HAL_ISR_OFF)
+    sim_pollIsrs_();
+}
+
+void hal_onServoChange_(int pin, int oldMicros)
+{
+  int i;
+
+  // Bring any pot driven by this servo up to date at the old speed
+  for(i = 0; i < HAL_NUM_ANALOG_LINES; i++)
+  {
+    if(simPots[i].servoPin == pin)
+      sim_updatePot_(i, oldMicros);
+  }
+}
+
+void hal_onSerialByte_(uint8_t value)
+{
+  uint64_t byteCycles;
+  uint64_t room;
+
+  hal_charge_(SIM_CYCLES_SERIAL_BYTE);
+  if(halSerialBaud == 0)
+    return;
+
+  // Block while the transmit buffer is full, as HardwareSerial does
+  byteCycles = F_CPU * SIM_SERIAL_BITS_PER_BYTE / halSerialBaud;
+  room = (SIM_SERIAL_TX_BUFFER - 1) * byteCycles;
+  if(simSerialFreeAt > simCycles + room)
+    simCycles = simSerialFreeAt - room;
+
+  if(simSerialFreeAt < simCycles)
+    simSerialFreeAt = simCycles;
+  simSerialFreeAt += byteCycles;
+}
+
+void hal_onSerialFlush_()
+{
+  if(simSerialFreeAt > simCycles)
+    sim_advanceTo_(simSerialFreeAt);
+}
+
+uint64_t hal_getCycles()
+{
+  return simCycles;
+}
+
+void hal_advance(uint64_t us)
+{
+  sim_advanceTo_(simCycles + us * SIM_CYCLES_PER_US);
+}
+
+void hal_attachIsr(int vector, HalIsr handler, uint32_t periodCycles)
+{
+  if(vector < 0 || vector >= HAL_NUM_ISR_VECTORS)
+    return;
+  simIsrs[vector].periodCycles = periodCycles > 0 ? periodCycles : 1;
+  simIsrs[vector].dueAt = simCycles + simIsrs[vector].periodCycles;
+  simIsrs[vector].count = 0;
+  simIsrs[vector].handler = handler;
+}
+
+void hal_setIsrMode(int mode, unsigned long meanIntervalUs)
+{
+  struct sigaction action;
+  struct sigevent event;
+
+  sim_stopRandomIsrs_();
+  simRandomPending = 0;
+  simIsrMode = mode;
+  if(mode != HAL_ISR_RANDOM)
+    return;
+
+  if(!simIsrTimerCreated)
+  {
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sim_onRandomIsr_;
+    action.sa_flags = SA_RESTART;
+    sigaction(SIM_ISR_SIGNAL, &action, NULL);
+
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIM_ISR_SIGNAL;
+    if(timer_create(CLOCK_MONOTONIC, &event, &simIsrTimer) != 0)
+    {
+      simIsrMode = HAL_ISR_OFF;
+      return;
+    }
+    simIsrTimerCreated = true;
+  }
+  simIsrMeanUs = meanIntervalUs > 0 ? meanIntervalUs : 1;
+  simIsrRandomState = 1;
+  sim_armRandomIsr_();
+}
+
+unsigned long hal_getIsrCount(int vector)
+{
+  if(vector < 0 || vector >= HAL_NUM_ISR_VECTORS)
+    return 0;
+  return simIsrs[vector].count;
+}
+
+// Interrupt points between sketch functions, with -finstrument-functions
+
+extern "C" void __cyg_profile_func_enter(void * function, void * callSite) __attribute__((no_instrument_function));
+extern "C" void __cyg_profile_func_exit(void * function, void * callSite) __attribute__((no_instrument_function));
+
+extern "C" void __cyg_profile_func_enter(void * function, void * callSite)
+{
+  sim_pollIsrs_();
+}
+
+extern "C" void __cyg_profile_func_exit(void * function, void * callSite)
+{
+  sim_pollIsrs_();
+}
+
+void hal_attachPot(int analogLine, int servoPin, int startReading)
+{
+  if(analogLine < 0 || analogLine >= HAL_NUM_ANALOG_LINES)
+    return;
+  simPots[analogLine].servoPin = servoPin;
+  simPots[analogLine].turns = startReading * SIM_POT_ELECTRICAL_FRACTION / SIM_POT_MAX_READING;
+  simPots[analogLine].lastUpdate = simCycles;
+}
+
+double hal_getPotTurns(int analogLine)
+{
+  if(analogLine < 0 || analogLine >= HAL_NUM_ANALOG_LINES || simPots[analogLine].servoPin < 0)
+    return 0;
+  sim_updatePot_(analogLine, halServoMicros[simPots[analogLine].servoPin]);
+  return simPots[analogLine].turns;
+}
+
+int analogRead(uint8_t pin)
+{
+  hal_charge_(SIM_CYCLES_ANALOG_READ);
+  if(pin >= HAL_NUM_ANALOG_LINES)
+    return 0;
+  if(simPots[pin].servoPin >= 0)
+    return sim_readPot_(pin);
+  return halAnalogInputs[pin];
+}
+
+// millis and micros wrap at 32 bits as on the AVR
+
+unsigned long millis()
+{
+  hal_charge_(SIM_CYCLES_MILLIS);
+  return (uint32_t)(simCycles / SIM_CYCLES_PER_MS);
+}
+
+unsigned long micros()
+{
+  hal_charge_(SIM_CYCLES_MICROS);
+  return (uint32_t)(simCycles / SIM_CYCLES_PER_US) & ~(uint32_t)3;
+}
+
+void delay(unsigned long ms)
+{
+  sim_advanceTo_(simCycles + (uint64_t)ms * SIM_CYCLES_PER_MS);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  sim_advanceTo_(simCycles + (uint64_t)us * SIM_CYCLES_PER_US);
+}
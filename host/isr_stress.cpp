@@ -0,0 +1,149 @@
+/**
+ * Name: isr_stress.cpp
+ * Desc: Runs the aquarium with its piezo taps raised from an emulated
+ *       interrupt, as a comparator on the sensor would, and checks every
+ *       tap the interrupt raises reaches the aquarium. Taps lost between
+ *       the loop reading a sensor and clearing it are what this finds
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -finstrument-functions -I hal -I ../aquariumlogic \
+ *         -o isr_stress -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         isr_stress.cpp hal/hal_common.cpp hal/hal_sim.cpp
+ *       ./isr_stress [seconds] [meanIntervalUs]
+ *       (seconds of simulated time in the cycle accurate run, and of host
+ *       time in the random one)
+ * Note: -finstrument-functions gives the cycle accurate run an interrupt
+ *       point at every sketch function boundary, not just at core calls.
+ *       The random run interrupts the loop from a signal, so its results
+ *       differ from run to run
+**/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "aquariumlogic.h"
+#include "hal_backend.h"
+
+#define DEFAULT_RUN_SECONDS 10
+#define DEFAULT_MEAN_INTERVAL_US 20
+#define LIGHT_AIN_PORT 12
+#define BRIGHT_LIGHT_VAL 800
+#define TAP_VAL 600
+#define PIEZO_VECTOR 0
+#define PIEZO_PERIOD_CYCLES 15013 // Prime, so it drifts across the loop
+
+// The sensor the interrupt taps, alone so each consumed tap is one numTaps
+#define TAPPED_SENSOR 0
+
+extern PiezoSensor piezoSensors[];
+
+void setup();
+void loop();
+
+typedef struct
+{
+  unsigned long loops;
+  unsigned long interrupts;
+  unsigned long raised; // Taps the interrupt raised on an idle sensor
+  unsigned long merged; // Raised on a sensor still holding a tap
+  unsigned long consumed;
+  long lost;
+} StressResult;
+
+volatile unsigned long stressRaised;
+volatile unsigned long stressMerged;
+
+/**
+ * Name: stress_onPiezoIsr_()
+ * Desc: The emulated comparator interrupt, raises a tap on the sensor
+**/
+void stress_onPiezoIsr_()
+{
+  if(piezoSensors[TAPPED_SENSOR].fired == NO_TAP)
+    stressRaised++;
+  else
+    stressMerged++;
+  piezoSensors[TAPPED_SENSOR].fired = TAP_VAL;
+}
+
+/**
+ * Name: stress_nowUs_()
+ * Desc: Get CLOCK_MONOTONIC in microseconds
+**/
+uint64_t stress_nowUs_()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Name: stress_run_(int mode, double seconds, unsigned long meanUs, StressResult * result)
+ * Desc: Boots the sketch and runs it with the piezo interrupt in one mode
+**/
+void stress_run_(int mode, double seconds, unsigned long meanUs, StressResult * result)
+{
+  uint64_t endCycles;
+  uint64_t endUs;
+  unsigned long startTaps;
+
+  hal_reset();
+  hal_setAnalogInput(LIGHT_AIN_PORT, BRIGHT_LIGHT_VAL);
+  setup();
+  while(!boot_isReady())
+    loop();
+
+  stressRaised = 0;
+  stressMerged = 0;
+  startTaps = aquarium_getInstance(0)->numTaps;
+  piezoSensors[TAPPED_SENSOR].fired = NO_TAP;
+  hal_attachIsr(PIEZO_VECTOR, stress_onPiezoIsr_, PIEZO_PERIOD_CYCLES);
+  hal_setIsrMode(mode, meanUs);
+
+  result->loops = 0;
+  endCycles = hal_getCycles() + (uint64_t)(seconds * F_CPU);
+  endUs = stress_nowUs_() + (uint64_t)(seconds * 1000000);
+  while(mode == HAL_ISR_CYCLE ? hal_getCycles() < endCycles : stress_nowUs_() < endUs)
+  {
+    loop();
+    result->loops++;
+  }
+  hal_setIsrMode(HAL_ISR_OFF, 0);
+
+  result->interrupts = hal_getIsrCount(PIEZO_VECTOR);
+  result->raised = stressRaised;
+  result->merged = stressMerged;
+  result->consumed = aquarium_getInstance(0)->numTaps - startTaps;
+  result->lost = (long)result->raised - (long)result->consumed - (piezoSensors[TAPPED_SENSOR].fired != NO_TAP);
+}
+
+/**
+ * Name: stress_print_(const char * name, StressResult * result)
+ * Desc: Prints one run's counts
+**/
+void stress_print_(const char * name, StressResult * result)
+{
+  printf("%-6s %8lu loops %9lu interrupts %8lu taps raised %8lu merged %8lu consumed %6ld lost\n", name,
+         result->loops, result->interrupts, result->raised, result->merged, result->consumed, result->lost);
+}
+
+int main(int argc, char ** argv)
+{
+  double seconds = DEFAULT_RUN_SECONDS;
+  unsigned long meanUs = DEFAULT_MEAN_INTERVAL_US;
+  StressResult cycle;
+  StressResult random;
+
+  if(argc > 1)
+    seconds = atof(argv[1]);
+  if(argc > 2)
+    meanUs = atol(argv[2]);
+
+  stress_run_(HAL_ISR_CYCLE, seconds, meanUs, &cycle);
+  stress_run_(HAL_ISR_RANDOM, seconds, meanUs, &random);
+
+  stress_print_("cycle", &cycle);
+  stress_print_("random", &random);
+  return cycle.lost != 0 || random.lost != 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * Name: occupancy_bench.cpp
+ * Desc: Times the occupancy grid's segment test and detour planning on
+ *       random moves through the tank, next to the worst case number of
+ *       cell lookups either can make
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -I hal -I ../aquariumlogic -o occupancy_bench \
+ *         -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         occupancy_bench.cpp hal/hal_common.cpp hal/hal_sim.cpp
+ *       ./occupancy_bench [segments]
+ * Note: Times are host nanoseconds, they only compare runs on one machine.
+ *       The cell lookup bounds are what carries over to the board
+**/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "aquariumlogic.h"
+#include "hal_backend.h"
+
+#define DEFAULT_NUM_SEGMENTS 1000000
+
+// A segment crosses at most one boundary per cell along each axis
+#define MAX_CELLS_PER_SEGMENT (OG_CELLS_X + OG_CELLS_Y + OG_CELLS_Z - 2)
+#define MAX_DETOUR_WAYPOINTS (OG_MAX_DETOUR_CELLS * OG_NUM_DETOUR_DIRECTIONS)
+
+// Waypoint cell, then both halves, after the direct segment failed
+#define MAX_CELLS_PER_PLAN (MAX_CELLS_PER_SEGMENT + \
+                            MAX_DETOUR_WAYPOINTS * (1 + 2 * MAX_CELLS_PER_SEGMENT))
+
+struct BenchTimes {
+  double totalNs;
+  double worstNs;
+};
+
+/**
+ * Name: bench_nowNs_()
+ * Desc: Get CLOCK_MONOTONIC in nanoseconds
+**/
+int64_t bench_nowNs_()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Name: bench_randomPoint_(OgPoint * point)
+ * Desc: Picks a point anywhere in the tank
+**/
+void bench_randomPoint_(OgPoint * point)
+{
+  point->x = MIN_X_VAL + rand() % (MAX_X_VAL - MIN_X_VAL);
+  point->y = MIN_Y_VAL + rand() % (MAX_Y_VAL - MIN_Y_VAL);
+  point->z = MIN_Z_VAL + rand() % (MAX_Z_VAL - MIN_Z_VAL);
+}
+
+/**
+ * Name: bench_record_(BenchTimes * times, int64_t startNs)
+ * Desc: Adds the time since startNs to the totals
+**/
+void bench_record_(BenchTimes * times, int64_t startNs)
+{
+  double ns = bench_nowNs_() - startNs;
+
+  times->totalNs += ns;
+  if(ns > times->worstNs)
+    times->worstNs = ns;
+}
+
+int main(int argc, char ** argv)
+{
+  long i;
+  long numSegments = DEFAULT_NUM_SEGMENTS;
+  long numBlocked = 0;
+  long numDetours = 0;
+  long numEndsBlocked = 0;
+  boolean clear;
+  boolean found;
+  int64_t startNs;
+  OgPoint from;
+  OgPoint to;
+  OgPoint waypoint;
+  BenchTimes testTimes = {0, 0};
+  BenchTimes planTimes = {0, 0};
+
+  if(argc > 1)
+    numSegments = atol(argv[1]);
+  if(numSegments <= 0)
+  {
+    fprintf(stderr, "usage: %s [segments]\n", argv[0]);
+    return 1;
+  }
+
+  srand(1);
+  hal_reset();
+  for(i = 0; i < numSegments; i++)
+  {
+    bench_randomPoint_(&from);
+    bench_randomPoint_(&to);
+
+    startNs = bench_nowNs_();
+    clear = og_isSegmentClear(&from, &to);
+    bench_record_(&testTimes, startNs);
+    if(clear)
+      continue;
+
+    // Planning as fish_goTo does it, segment test included
+    numBlocked++;
+    startNs = bench_nowNs_();
+    found = !og_isSegmentClear(&from, &to) && og_findDetour(&from, &to, &waypoint);
+    bench_record_(&planTimes, startNs);
+    if(found)
+      numDetours++;
+    else if(og_isBlocked(&from) || og_isBlocked(&to))
+      numEndsBlocked++; // No way around starting or ending inside
+  }
+
+  printf("%ld segments, %ld blocked (%.1f%%)\n", numSegments, numBlocked, 100.0 * numBlocked / numSegments);
+  printf("  %ld detoured, %ld not (%ld of them start or end in a decoration)\n", numDetours,
+         numBlocked - numDetours, numEndsBlocked);
+  printf("segment test: %.0f ns mean, %.0f ns worst, at most %d cell lookups\n",
+         testTimes.totalNs / numSegments, testTimes.worstNs, MAX_CELLS_PER_SEGMENT);
+  if(numBlocked > 0)
+    printf("plan:         %.0f ns mean, %.0f ns worst, at most %d cell lookups (%d waypoints)\n",
+           planTimes.totalNs / numBlocked, planTimes.worstNs, MAX_CELLS_PER_PLAN, MAX_DETOUR_WAYPOINTS);
+  return 0;
+}
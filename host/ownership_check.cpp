@@ -0,0 +1,136 @@
+/**
+ * Name: ownership_check.cpp
+ * Desc: Hangs the jellyfish from fish 0's z axis on the simulator and
+ *       checks that lowering it preempts the fish and raising it hands
+ *       the axis back, with the fish sent on to its leg again
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -I hal -I ../aquariumlogic -o ownership_check \
+ *         -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         ownership_check.cpp commission.cpp hal/hal_common.cpp hal/hal_sim.cpp
+ *       ./ownership_check
+ * Note: Exits 1 if any check fails. The tank normally gives the jellyfish
+ *       its own servo, sharing one is how a tank short of servos would
+ *       show the jellyfish while the fish hide
+**/
+
+#include <Arduino.h>
+#include <stdio.h>
+
+#include "aquariumlogic.h"
+#include "commission.h"
+#include "hal_backend.h"
+
+#define SHOW_MS 3000 // Jellyfish in view
+#define RETURN_TIMEOUT_MS 10000 // Raising and handing back
+
+extern FlightRecorder flightRecorder;
+
+void setup();
+void loop();
+
+int numFailed;
+
+/**
+ * Name: check_expect_(bool passed, const char * what)
+ * Desc: Reports one check
+**/
+void check_expect_(bool passed, const char * what)
+{
+  printf("%s %s\n", passed ? "ok  " : "FAIL", what);
+  if(!passed)
+    numFailed++;
+}
+
+/**
+ * Name: check_run_(unsigned long ms)
+ * Desc: Runs the sketch's loop for a while of simulated time
+**/
+void check_run_(unsigned long ms)
+{
+  unsigned long startMS = millis();
+  while(millis() - startMS < ms)
+    loop();
+}
+
+/**
+ * Name: check_countPreempted_(int axis)
+ * Desc: Counts the jellyfish's preemptions of an axis in the recorder
+**/
+int check_countPreempted_(int axis)
+{
+  int i;
+  int count = 0;
+  FlightRecord * record;
+
+  for(i = 0; i < flightRecorder.count; i++)
+  {
+    record = &(flightRecorder.records[(flightRecorder.next - flightRecorder.count + i) & (FR_LENGTH - 1)]);
+    if(record->event == FR_EVENT_PREEMPTED && record->id == axis && record->arg == JELLYFISH_OWNER)
+      count++;
+  }
+  return count;
+}
+
+/**
+ * Name: check_awaitReturn_(int axis, const char * what)
+ * Desc: Runs the sketch until the fish holds the axis again and checks
+ *       the fish sent it on to its leg when it came back
+**/
+void check_awaitReturn_(int axis, const char * what)
+{
+  unsigned long startMS = millis();
+  Fish * fish = fish_getInstance(0);
+
+  while(!axis_isOwnedBy(axis, FISH_OWNER, 0) && millis() - startMS < RETURN_TIMEOUT_MS)
+    loop();
+  check_expect_(axis_isOwnedBy(axis, FISH_OWNER, 0), what);
+  check_expect_(axis_getOwnership_(axis)->preempted.type == NONE, "  nobody left waiting for it");
+  check_expect_(crs_getInstance(AXIS_SERVO(axis))->targetPosition == fish->legZ,
+                "  fish sent it on to its leg");
+}
+
+int main(int argc, char ** argv)
+{
+  int zAxis;
+  int numPreempted;
+  long target;
+  AxisOwnership * ownership;
+
+  if(!commission_powerUp(NULL))
+  {
+    fprintf(stderr, "could not commission the servos\n");
+    return 1;
+  }
+  // Straight after boot, while z is still near the jellyfish's angles, as
+  // the jellyfish winds it at only JELLYFISH_SLEW_RATE
+  commission_boot();
+
+  zAxis = fish_getInstance(0)->zAxis;
+  ownership = axis_getOwnership_(zAxis);
+  check_expect_(axis_isOwnedBy(zAxis, FISH_OWNER, 0), "fish holds its z axis after boot");
+
+  // Moving the jellyfish onto the axis raises it there, borrowing the axis
+  numPreempted = check_countPreempted_(zAxis);
+  jellyfish_init(0, zAxis, 0);
+  check_expect_(check_countPreempted_(zAxis) == numPreempted + 1, "jellyfish_init preempts the fish");
+  check_awaitReturn_(zAxis, "raised jellyfish hands the axis back");
+
+  // Shown while the fish patrols, the fish must keep off the axis
+  numPreempted = check_countPreempted_(zAxis);
+  jellyfish_lower(0);
+  check_expect_(axis_isOwnedBy(zAxis, JELLYFISH_OWNER, 0), "jellyfish_lower takes the axis");
+  check_expect_(ownership->preempted.type == FISH_OWNER && ownership->preempted.id == 0,
+                "  fish waits for it");
+  check_expect_(check_countPreempted_(zAxis) == numPreempted + 1, "  preemption recorded");
+  check_run_(SHOW_MS);
+  target = crs_getInstance(AXIS_SERVO(zAxis))->targetPosition;
+  check_expect_(axis_isOwnedBy(zAxis, JELLYFISH_OWNER, 0), "jellyfish keeps it while in view");
+  check_expect_(target >= JELLYFISH_LOWERED_ANGLE && target <= JELLYFISH_LOWERED_ANGLE + JELLYFISH_WAVE_BOB_ANGLE,
+                "  only the jellyfish's wave drives it");
+
+  jellyfish_raise(0);
+  check_awaitReturn_(zAxis, "jellyfish_raise hands the axis back once up");
+
+  printf("%d checks failed\n", numFailed);
+  return numFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,353 @@
+/**
+ * Name: pot_spectrogram.cpp
+ * Desc: Streaming short-time FFT over pot and piezo captures, writing one
+ *       spectrum per line so noise drift can be plotted over time
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O3 -march=native -o pot_spectrogram pot_spectrogram.cpp capture.cpp
+ *       ./pot_spectrogram [-n fftSize] [-s hop] [-r sampleRate] [-c channel] in out
+ * Note: in may be a text capture (one sample per line) or a binary capture
+ *       (see capture.h), in which case only the given channel is used
+**/
+
+#include "capture.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define DEFAULT_FFT_SIZE 1024
+#define DEFAULT_HOP 256
+#define DEFAULT_SAMPLE_RATE 1000.0
+#define DEFAULT_CHANNEL CAPTURE_CHANNEL_POT
+
+// Short time FFT state
+//
+// Real and imaginary parts are kept in separate contiguous arrays and the
+// twiddle factors are precomputed per stage so that the butterfly loops
+// are simple strided float arithmetic the compiler can vectorize.
+
+typedef struct
+{
+  int fftSize;
+  int hop;
+  int log2Size;
+  double sampleRate;
+  long samplesSeen;
+  long samplesUntilFrame;
+  int ringPos;
+  std::vector<float> ring;
+  std::vector<float> window;
+  std::vector<float> re;
+  std::vector<float> im;
+  std::vector<float> twiddleRe;
+  std::vector<float> twiddleIm;
+  std::vector<float> magnitudes;
+  std::vector<int> bitReversed;
+} Stft;
+
+/**
+ * Name: stft_init(Stft * target, int fftSize, int hop, double sampleRate)
+ * Desc: Prepares window, twiddle and bit reversal tables
+ * Para: target, The analyser to initialize
+ *       fftSize, Samples per frame (power of two)
+ *       hop, Samples between the starts of consecutive frames
+ *       sampleRate, Samples per second of the capture
+ * Retr: False if the sizes are unusable
+**/
+bool stft_init(Stft * target, int fftSize, int hop, double sampleRate)
+{
+  int i;
+  int bits;
+  int half;
+
+  if(fftSize < 2 || (fftSize & (fftSize - 1)) != 0 || hop < 1 || hop > fftSize)
+    return false;
+
+  target->fftSize = fftSize;
+  target->hop = hop;
+  target->sampleRate = sampleRate;
+  target->samplesSeen = 0;
+  target->samplesUntilFrame = fftSize;
+  target->ringPos = 0;
+
+  target->log2Size = 0;
+  while((1 << target->log2Size) < fftSize)
+    target->log2Size++;
+
+  target->ring.assign(fftSize, 0);
+  target->re.assign(fftSize, 0);
+  target->im.assign(fftSize, 0);
+  target->magnitudes.assign(fftSize / 2 + 1, 0);
+
+  // Hann window
+  target->window.resize(fftSize);
+  for(i = 0; i < fftSize; i++)
+    target->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / fftSize);
+
+  // Bit reversal permutation
+  target->bitReversed.resize(fftSize);
+  for(i = 0; i < fftSize; i++)
+  {
+    int reversed = 0;
+    for(bits = 0; bits < target->log2Size; bits++)
+      reversed |= ((i >> bits) & 1) << (target->log2Size - 1 - bits);
+    target->bitReversed[i] = reversed;
+  }
+
+  // One twiddle table shared by all stages (stage uses a stride into it)
+  half = fftSize / 2;
+  target->twiddleRe.resize(half);
+  target->twiddleIm.resize(half);
+  for(i = 0; i < half; i++)
+  {
+    target->twiddleRe[i] = cos(-2 * M_PI * i / fftSize);
+    target->twiddleIm[i] = sin(-2 * M_PI * i / fftSize);
+  }
+
+  return true;
+}
+
+/**
+ * Name: stft_transform_(Stft * target)
+ * Desc: In place radix-2 FFT of target->re / target->im
+ * Para: target, The analyser whose buffers should be transformed
+ * Note: Should be treated as private member of Stft
+**/
+void stft_transform_(Stft * target)
+{
+  int size = target->fftSize;
+  int span;
+  int start;
+  int k;
+  int stride;
+  float * re = &target->re[0];
+  float * im = &target->im[0];
+  const float * twRe = &target->twiddleRe[0];
+  const float * twIm = &target->twiddleIm[0];
+
+  for(span = 1, stride = size / 2; span < size; span <<= 1, stride >>= 1)
+  {
+    for(start = 0; start < size; start += span << 1)
+    {
+      float * aRe = re + start;
+      float * aIm = im + start;
+      float * bRe = re + start + span;
+      float * bIm = im + start + span;
+
+      for(k = 0; k < span; k++)
+      {
+        float wRe = twRe[k * stride];
+        float wIm = twIm[k * stride];
+        float tRe = bRe[k] * wRe - bIm[k] * wIm;
+        float tIm = bRe[k] * wIm + bIm[k] * wRe;
+        bRe[k] = aRe[k] - tRe;
+        bIm[k] = aIm[k] - tIm;
+        aRe[k] += tRe;
+        aIm[k] += tIm;
+      }
+    }
+  }
+}
+
+/**
+ * Name: stft_emitFrame_(Stft * target, FILE * out)
+ * Desc: Windows the last fftSize samples, transforms them and writes the
+ *       magnitude spectrum as one line
+ * Para: target, The analyser to operate on
+ *       out, Where the spectrum line should be written
+ * Note: Should be treated as private member of Stft
+**/
+void stft_emitFrame_(Stft * target, FILE * out)
+{
+  int i;
+  int size = target->fftSize;
+  int bins = size / 2 + 1;
+  double mean;
+  double frameTime;
+
+  // Remove DC, the pot sits far from zero and would swamp every other bin
+  mean = 0;
+  for(i = 0; i < size; i++)
+    mean += target->ring[i];
+  mean /= size;
+
+  // Window in time order (oldest sample sits at ringPos) into bit
+  // reversed positions so the butterflies can run in place
+  for(i = 0; i < size; i++)
+  {
+    int src = (target->ringPos + i) & (size - 1);
+    int dest = target->bitReversed[i];
+    target->re[dest] = (target->ring[src] - (float)mean) * target->window[i];
+    target->im[dest] = 0;
+  }
+
+  stft_transform_(target);
+
+  for(i = 0; i < bins; i++)
+    target->magnitudes[i] = sqrtf(target->re[i] * target->re[i] + target->im[i] * target->im[i]);
+
+  frameTime = (target->samplesSeen - size) / target->sampleRate;
+  fprintf(out, "%.6f", frameTime);
+  for(i = 0; i < bins; i++)
+    fprintf(out, " %.4f", target->magnitudes[i]);
+  fputc('\n', out);
+}
+
+/**
+ * Name: stft_push(Stft * target, float sample, FILE * out)
+ * Desc: Feeds one sample, writing a spectrum whenever a frame completes
+ * Para: target, The analyser to feed
+ *       sample, The raw sample value
+ *       out, Where completed spectra should be written
+**/
+void stft_push(Stft * target, float sample, FILE * out)
+{
+  target->ring[target->ringPos] = sample;
+  target->ringPos = (target->ringPos + 1) & (target->fftSize - 1);
+  target->samplesSeen++;
+  target->samplesUntilFrame--;
+
+  if(target->samplesUntilFrame == 0)
+  {
+    stft_emitFrame_(target, out);
+    target->samplesUntilFrame = target->hop;
+  }
+}
+
+/**
+ * Name: stft_writeHeader(Stft * target, FILE * out)
+ * Desc: Writes a comment line describing the columns of the output
+ * Para: target, The analyser whose settings should be described
+ *       out, The output file
+**/
+void stft_writeHeader(Stft * target, FILE * out)
+{
+  fprintf(out, "# fft_size %d hop %d sample_rate %g bin_hz %g\n",
+          target->fftSize, target->hop, target->sampleRate,
+          target->sampleRate / target->fftSize);
+}
+
+/**
+ * Name: stft_pushCapture(Stft * target, const char * path, int channel,
+ *                        FILE * out)
+ * Desc: Feeds every sample of one channel of a binary capture, reading the
+ *       value columns straight out of the mapping
+ * Para: target, The analyser to feed
+ *       path, The capture file
+ *       channel, Which channel's samples to analyse
+ *       out, Where completed spectra should be written
+ * Retr: False if the capture could not be opened
+**/
+bool stft_pushCapture(Stft * target, const char * path, int channel, FILE * out)
+{
+  uint32_t i;
+  uint32_t chunkID;
+  CaptureChunk chunk;
+  CaptureReader reader;
+
+  if(!capture_openReader(&reader, path))
+    return false;
+
+  for(chunkID = 0; chunkID < capture_getNumChunks(&reader); chunkID++)
+  {
+    chunk = capture_getChunk(&reader, chunkID);
+    for(i = 0; i < chunk.numRecords; i++)
+    {
+      if(chunk.channels[i] == channel)
+        stft_push(target, (float)chunk.values[i], out);
+    }
+  }
+
+  capture_closeReader(&reader);
+  return true;
+}
+
+void printUsage(const char * name)
+{
+  fprintf(stderr, "usage: %s [-n fftSize] [-s hop] [-r sampleRate] [-c channel] <capture> <spectrogram>\n", name);
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  int fftSize = DEFAULT_FFT_SIZE;
+  int hop = DEFAULT_HOP;
+  double sampleRate = DEFAULT_SAMPLE_RATE;
+  int channel = DEFAULT_CHANNEL;
+  const char * inName = NULL;
+  const char * outName = NULL;
+  FILE * in;
+  FILE * out;
+  long value;
+  Stft stft;
+
+  for(i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      fftSize = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      hop = atoi(argv[++i]);
+    else if(strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      sampleRate = atof(argv[++i]);
+    else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      channel = atoi(argv[++i]);
+    else if(inName == NULL)
+      inName = argv[i];
+    else if(outName == NULL)
+      outName = argv[i];
+    else
+    {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if(inName == NULL || outName == NULL)
+  {
+    printUsage(argv[0]);
+    return 1;
+  }
+
+  if(!stft_init(&stft, fftSize, hop, sampleRate))
+  {
+    fprintf(stderr, "fft size must be a power of two and 1 <= hop <= fft size\n");
+    return 1;
+  }
+
+  out = fopen(outName, "w");
+  if(out == NULL)
+  {
+    perror(outName);
+    return 1;
+  }
+  stft_writeHeader(&stft, out);
+
+  // Captures are streamed so they can be far larger than memory
+  if(capture_isCaptureFile(inName))
+  {
+    if(!stft_pushCapture(&stft, inName, channel, out))
+    {
+      fprintf(stderr, "%s: not a valid capture\n", inName);
+      fclose(out);
+      return 1;
+    }
+  }
+  else
+  {
+    in = fopen(inName, "r");
+    if(in == NULL)
+    {
+      perror(inName);
+      fclose(out);
+      return 1;
+    }
+    while(fscanf(in, "%ld", &value) == 1)
+      stft_push(&stft, (float)value, out);
+    fclose(in);
+  }
+
+  fclose(out);
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,446 @@
+/**
+ * Name: route_gen.cpp
+ * Desc: Works out the shortest collision free route between every pair of
+ *       route anchors with A* over the sketch's own occupancy grid, and
+ *       writes them out as the PROGMEM route table the fish follow
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -I hal -I ../aquariumlogic -o route_gen \
+ *         -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         route_gen.cpp hal/hal_common.cpp hal/hal_sim.cpp
+ *       ./route_gen ../aquariumlogic/aquarium_routes.h
+ * Note: Rerun (and rebuild it, it links the sketch for the grid and the
+ *       anchors) after changing occupancyGrid or routeAnchors. The search
+ *       moves between neighbouring cells, diagonals included, and the
+ *       route is then pulled tight: a waypoint is only kept where the
+ *       straight leg past it would fail og_isSegmentClear, the same test
+ *       the board plans with
+**/
+
+#include <Arduino.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "aquariumlogic.h"
+#include "hal_backend.h"
+
+#define NUM_CELLS (OG_CELLS_X * OG_CELLS_Y * OG_CELLS_Z)
+#define MAX_ROUTE_CELLS NUM_CELLS
+#define MAX_TABLE_WAYPOINTS 256 // routeOffsets is a byte
+
+// Anchor names for the table's comments, ROUTE_ANCHOR_* order
+const char * const anchorNames[ROUTE_NUM_ANCHORS] = {"centre", "hide", "north east", "south east", "south west",
+                                                     "north west"};
+
+typedef struct
+{
+  int x;
+  int y;
+  int z;
+} Cell;
+
+typedef struct
+{
+  double costs[NUM_CELLS]; // Steps travelled from the start, so far
+  int cameFrom[NUM_CELLS];
+  boolean closed[NUM_CELLS];
+  int heap[NUM_CELLS * 27]; // Open cells, may hold stale entries
+  double heapScores[NUM_CELLS * 27];
+  int heapLength;
+} Search;
+
+typedef struct
+{
+  int numWaypoints;
+  Cell waypoints[MAX_ROUTE_CELLS];
+  double steps; // Length of the legs
+} Route;
+
+Search search;
+Route routes[ROUTE_NUM_ANCHORS][ROUTE_NUM_ANCHORS];
+
+/**
+ * Name: gen_cellIndex_(int x, int y, int z)
+ * Desc: Get a cell's index into the Search arrays
+**/
+int gen_cellIndex_(int x, int y, int z)
+{
+  return (z * OG_CELLS_Y + y) * OG_CELLS_X + x;
+}
+
+/**
+ * Name: gen_indexCell_(int index)
+ * Desc: Get the cell at an index into the Search arrays
+**/
+Cell gen_indexCell_(int index)
+{
+  Cell cell;
+
+  cell.x = index % OG_CELLS_X;
+  cell.y = index / OG_CELLS_X % OG_CELLS_Y;
+  cell.z = index / (OG_CELLS_X * OG_CELLS_Y);
+  return cell;
+}
+
+/**
+ * Name: gen_steps_(Cell from, Cell to)
+ * Desc: Get the straight line distance between two cells' middles in
+ *       steps, the move cost and (never overestimating) the heuristic
+**/
+double gen_steps_(Cell from, Cell to)
+{
+  double dx = (double)(to.x - from.x) * OG_CELL_X_STEPS;
+  double dy = (double)(to.y - from.y) * OG_CELL_Y_STEPS;
+  double dz = (double)(to.z - from.z) * OG_CELL_Z_STEPS;
+
+  return sqrt(dx * dx + dy * dy + dz * dz);
+}
+
+/**
+ * Name: gen_isClear_(Cell from, Cell to)
+ * Desc: Determines if the fish can move straight between two cells' middles
+**/
+boolean gen_isClear_(Cell from, Cell to)
+{
+  OgPoint fromPoint;
+  OgPoint toPoint;
+
+  route_getCellCentre_(from.x, from.y, from.z, &fromPoint);
+  route_getCellCentre_(to.x, to.y, to.z, &toPoint);
+  return og_isSegmentClear(&fromPoint, &toPoint);
+}
+
+/**
+ * Name: gen_isBoxClear_(Cell from, Cell to)
+ * Desc: Determines if every cell in the box spanned by two neighbours is
+ *       free, so a diagonal move never cuts the corner of a decoration
+**/
+boolean gen_isBoxClear_(Cell from, Cell to)
+{
+  int x;
+  int y;
+  int z;
+
+  for(z = from.z < to.z ? from.z : to.z; z <= (from.z < to.z ? to.z : from.z); z++)
+    for(y = from.y < to.y ? from.y : to.y; y <= (from.y < to.y ? to.y : from.y); y++)
+      for(x = from.x < to.x ? from.x : to.x; x <= (from.x < to.x ? to.x : from.x); x++)
+        if(og_isCellBlocked_(x, y, z))
+          return false;
+  return true;
+}
+
+/**
+ * Name: gen_push_(int index, double score)
+ * Desc: Adds a cell to the open min heap
+**/
+void gen_push_(int index, double score)
+{
+  int child = search.heapLength++;
+  int parent;
+
+  while(child > 0)
+  {
+    parent = (child - 1) / 2;
+    if(search.heapScores[parent] <= score)
+      break;
+    search.heap[child] = search.heap[parent];
+    search.heapScores[child] = search.heapScores[parent];
+    child = parent;
+  }
+  search.heap[child] = index;
+  search.heapScores[child] = score;
+}
+
+/**
+ * Name: gen_pop_()
+ * Desc: Takes the lowest scoring cell off the open min heap
+**/
+int gen_pop_()
+{
+  int top = search.heap[0];
+  int last = search.heap[--search.heapLength];
+  double lastScore = search.heapScores[search.heapLength];
+  int parent = 0;
+  int child;
+
+  while((child = parent * 2 + 1) < search.heapLength)
+  {
+    if(child + 1 < search.heapLength && search.heapScores[child + 1] < search.heapScores[child])
+      child++;
+    if(lastScore <= search.heapScores[child])
+      break;
+    search.heap[parent] = search.heap[child];
+    search.heapScores[parent] = search.heapScores[child];
+    parent = child;
+  }
+  search.heap[parent] = last;
+  search.heapScores[parent] = lastScore;
+  return top;
+}
+
+/**
+ * Name: gen_findPath_(Cell start, Cell goal, Cell * path)
+ * Desc: A* from one cell to another over the free cells
+ * Para: path, Set to the cells visited, start and goal included
+ * Retr: Number of cells in path, 0 if the goal cannot be reached
+**/
+int gen_findPath_(Cell start, Cell goal, Cell * path)
+{
+  int i;
+  int index;
+  int neighbourIndex;
+  int length;
+  int dx;
+  int dy;
+  int dz;
+  double cost;
+  Cell cell;
+  Cell neighbour;
+
+  for(i = 0; i < NUM_CELLS; i++)
+  {
+    search.costs[i] = HUGE_VAL;
+    search.cameFrom[i] = NONE;
+    search.closed[i] = false;
+  }
+  search.heapLength = 0;
+
+  index = gen_cellIndex_(start.x, start.y, start.z);
+  search.costs[index] = 0;
+  gen_push_(index, gen_steps_(start, goal));
+  while(search.heapLength > 0)
+  {
+    index = gen_pop_();
+    if(search.closed[index])
+      continue; // Stale, reached more cheaply since
+    search.closed[index] = true;
+
+    cell = gen_indexCell_(index);
+    if(cell.x == goal.x && cell.y == goal.y && cell.z == goal.z)
+      break;
+
+    for(dz = -1; dz <= 1; dz++)
+      for(dy = -1; dy <= 1; dy++)
+        for(dx = -1; dx <= 1; dx++)
+        {
+          neighbour.x = cell.x + dx;
+          neighbour.y = cell.y + dy;
+          neighbour.z = cell.z + dz;
+          if(neighbour.x < 0 || neighbour.x >= OG_CELLS_X || neighbour.y < 0 || neighbour.y >= OG_CELLS_Y ||
+             neighbour.z < 0 || neighbour.z >= OG_CELLS_Z)
+            continue;
+          neighbourIndex = gen_cellIndex_(neighbour.x, neighbour.y, neighbour.z);
+          if(search.closed[neighbourIndex] || !gen_isBoxClear_(cell, neighbour))
+            continue;
+
+          cost = search.costs[index] + gen_steps_(cell, neighbour);
+          if(cost < search.costs[neighbourIndex])
+          {
+            search.costs[neighbourIndex] = cost;
+            search.cameFrom[neighbourIndex] = index;
+            gen_push_(neighbourIndex, cost + gen_steps_(neighbour, goal));
+          }
+        }
+  }
+
+  index = gen_cellIndex_(goal.x, goal.y, goal.z);
+  if(!search.closed[index])
+    return 0;
+
+  // Walk back from the goal, then put the path the right way round
+  for(length = 0; index != NONE; index = search.cameFrom[index])
+    path[length++] = gen_indexCell_(index);
+  for(i = 0; i < length / 2; i++)
+  {
+    cell = path[i];
+    path[i] = path[length - 1 - i];
+    path[length - 1 - i] = cell;
+  }
+  return length;
+}
+
+/**
+ * Name: gen_pullTight_(const Cell * path, int length, Route * route)
+ * Desc: Keeps only the cells of a path the fish has to turn at, going as
+ *       far along the path as a straight leg reaches each time
+ * Retr: False if some step of the path itself is not a clear leg
+**/
+boolean gen_pullTight_(const Cell * path, int length, Route * route)
+{
+  int from = 0;
+  int to;
+
+  route->numWaypoints = 0;
+  route->steps = 0;
+  while(from < length - 1)
+  {
+    for(to = length - 1; to > from && !gen_isClear_(path[from], path[to]); to--)
+      ;
+    if(to == from)
+      return false;
+    if(to < length - 1)
+      route->waypoints[route->numWaypoints++] = path[to];
+    route->steps += gen_steps_(path[from], path[to]);
+    from = to;
+  }
+  return true;
+}
+
+/**
+ * Name: gen_getAnchorCell_(int anchor)
+ * Desc: Get the cell an anchor sits in
+**/
+Cell gen_getAnchorCell_(int anchor)
+{
+  long fixed[3];
+  OgPoint point;
+  Cell cell;
+
+  route_getAnchor(anchor, &point);
+  og_toGrid_(&point, fixed);
+  cell.x = fixed[0] / OG_SUBCELLS;
+  cell.y = fixed[1] / OG_SUBCELLS;
+  cell.z = fixed[2] / OG_SUBCELLS;
+  return cell;
+}
+
+/**
+ * Name: gen_write_(FILE * out, int numWaypoints)
+ * Desc: Writes the route table header
+**/
+void gen_write_(FILE * out, int numWaypoints)
+{
+  int from;
+  int to;
+  int i;
+  int offset;
+  const Route * route;
+
+  fprintf(out, "/**\n"
+               " * Name: aquarium_routes.h\n"
+               " * Desc: Route table between the route anchors, the waypoint cells a fish\n"
+               " *       turns at on the shortest way round the decorations\n"
+               " * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton\n"
+               " * Note: Made by host/route_gen.cpp from occupancyGrid and routeAnchors,\n"
+               " *       do not edit. Read through route_getLength and route_getWaypoint\n"
+               "**/\n\n"
+               "#ifndef AQUARIUM_ROUTES_H\n"
+               "#define AQUARIUM_ROUTES_H\n\n"
+               "#define ROUTE_NUM_WAYPOINTS %d\n\n", numWaypoints);
+
+  fprintf(out, "// Where each route's waypoints start in routeWaypoints, [from][to]\n"
+               "const uint8_t routeOffsets[ROUTE_NUM_ANCHORS][ROUTE_NUM_ANCHORS] PROGMEM = {\n");
+  offset = 0;
+  for(from = 0; from < ROUTE_NUM_ANCHORS; from++)
+  {
+    fprintf(out, "  {");
+    for(to = 0; to < ROUTE_NUM_ANCHORS; to++)
+    {
+      fprintf(out, "%s%d", to == 0 ? "" : ", ", offset);
+      offset += routes[from][to].numWaypoints;
+    }
+    fprintf(out, "}%s // From %s\n", from + 1 < ROUTE_NUM_ANCHORS ? "," : "", anchorNames[from]);
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "// How many waypoints each route has, [from][to]\n"
+               "const uint8_t routeLengths[ROUTE_NUM_ANCHORS][ROUTE_NUM_ANCHORS] PROGMEM = {\n");
+  for(from = 0; from < ROUTE_NUM_ANCHORS; from++)
+  {
+    fprintf(out, "  {");
+    for(to = 0; to < ROUTE_NUM_ANCHORS; to++)
+      fprintf(out, "%s%d", to == 0 ? "" : ", ", routes[from][to].numWaypoints);
+    fprintf(out, "}%s // From %s\n", from + 1 < ROUTE_NUM_ANCHORS ? "," : "", anchorNames[from]);
+  }
+  fprintf(out, "};\n\n");
+
+  // An empty array is not allowed, so there is always at least one entry
+  fprintf(out, "// Waypoint cells, ROUTE_PACK(x, y, z)\n"
+               "const uint16_t routeWaypoints[ROUTE_NUM_WAYPOINTS > 0 ? ROUTE_NUM_WAYPOINTS : 1] PROGMEM = {\n");
+  offset = 0;
+  for(from = 0; from < ROUTE_NUM_ANCHORS; from++)
+  {
+    for(to = 0; to < ROUTE_NUM_ANCHORS; to++)
+    {
+      route = &(routes[from][to]);
+      for(i = 0; i < route->numWaypoints; i++)
+      {
+        offset++;
+        fprintf(out, "  ROUTE_PACK(%d, %d, %d)%s", route->waypoints[i].x, route->waypoints[i].y,
+                route->waypoints[i].z, offset < numWaypoints ? "," : "");
+        if(i == 0)
+          fprintf(out, " // %s to %s", anchorNames[from], anchorNames[to]);
+        fprintf(out, "\n");
+      }
+    }
+  }
+  if(numWaypoints == 0)
+    fprintf(out, "  0\n");
+  fprintf(out, "};\n\n"
+               "#endif\n");
+}
+
+int main(int argc, char ** argv)
+{
+  int from;
+  int to;
+  int length;
+  int numWaypoints = 0;
+  Cell fromCell;
+  Cell toCell;
+  FILE * out = stdout;
+  static Cell path[MAX_ROUTE_CELLS];
+
+  hal_reset();
+  for(from = 0; from < ROUTE_NUM_ANCHORS; from++)
+  {
+    fromCell = gen_getAnchorCell_(from);
+    if(og_isCellBlocked_(fromCell.x, fromCell.y, fromCell.z))
+    {
+      fprintf(stderr, "%s anchor is inside a decoration\n", anchorNames[from]);
+      return 1;
+    }
+  }
+
+  for(from = 0; from < ROUTE_NUM_ANCHORS; from++)
+  {
+    for(to = 0; to < ROUTE_NUM_ANCHORS; to++)
+    {
+      fromCell = gen_getAnchorCell_(from);
+      toCell = gen_getAnchorCell_(to);
+      length = gen_findPath_(fromCell, toCell, path);
+      if(length == 0 || !gen_pullTight_(path, length, &(routes[from][to])))
+      {
+        fprintf(stderr, "no clear route from %s to %s\n", anchorNames[from], anchorNames[to]);
+        return 1;
+      }
+      numWaypoints += routes[from][to].numWaypoints;
+      if(routes[from][to].numWaypoints > 0)
+        fprintf(stderr, "%s to %s: %d waypoints, %.0f steps (%.0f straight)\n", anchorNames[from],
+                anchorNames[to], routes[from][to].numWaypoints, routes[from][to].steps,
+                gen_steps_(fromCell, toCell));
+    }
+  }
+
+  if(numWaypoints > MAX_TABLE_WAYPOINTS)
+  {
+    fprintf(stderr, "%d waypoints, routeOffsets only reaches %d\n", numWaypoints, MAX_TABLE_WAYPOINTS);
+    return 1;
+  }
+
+  if(argc > 1)
+  {
+    out = fopen(argv[1], "w");
+    if(out == NULL)
+    {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+  gen_write_(out, numWaypoints);
+  if(out != stdout)
+    fclose(out);
+  fprintf(stderr, "%d waypoints, %d bytes of flash\n", numWaypoints,
+          (int)(2 * ROUTE_NUM_ANCHORS * ROUTE_NUM_ANCHORS + numWaypoints * sizeof(uint16_t)));
+  return 0;
+}
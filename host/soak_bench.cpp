@@ -0,0 +1,349 @@
+/**
+ * Name: soak_bench.cpp
+ * Desc: Runs the aquarium for a day or more of simulated time (random
+ *       taps, lights going on and off) in a few seconds, reporting hour
+ *       by hour what only shows up after long runs: position drift,
+ *       estimates running away from their shafts, servos that never
+ *       reach their goal, EEPROM wear and the slowest pass through loop()
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -I hal -I ../aquariumlogic -o soak_bench \
+ *         -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         soak_bench.cpp commission.cpp hal/hal_common.cpp hal/hal_sim.cpp
+ *       ./soak_bench [hours] [-e eeprom.bin]
+ *       (-e starts from a saved EEPROM image instead of commissioning)
+ *       Exits 1 if a position estimate ran away from its shaft or goals
+ *       were reached by the estimate only
+ * Note: Without -e the servos are first commissioned: a boot from a blank
+ *       calibration record runs the sketch's own calibration, and the
+ *       soak then starts from a fresh boot restoring what it saved.
+ *       long is 64 bit on the host, so positions and millis arithmetic do
+ *       not wrap as they do on the board. The bench flags positions that
+ *       leave the range of a 32 bit long, and stops short of millis
+ *       wrapping (49.7 days) since the sketch would misbehave there on the
+ *       host only
+**/
+
+#include <Arduino.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aquariumlogic.h"
+#include "commission.h"
+#include "hal_backend.h"
+
+#define DEFAULT_RUN_HOURS 24
+#define MS_PER_HOUR 3600000UL
+#define DARK_LIGHT_VAL 100
+
+// Workload
+#define TAP_MEAN_MS 45000 // Exponential gaps between taps
+#define TAP_VAL 600
+#define LIGHT_ON_MIN_MS 1200000 // Lights stay on 20 to 90 minutes
+#define LIGHT_ON_MAX_MS 5400000
+#define LIGHT_OFF_MIN_MS 120000 // and go off for 2 to 15
+#define LIGHT_OFF_MAX_MS 900000
+
+// Health checks
+#define GOAL_OVERDUE_MS 300000 // Driven this long without stopping
+#define GOAL_MISS_STEPS (NUM_STEPS_ROT / 4) // Shaft this far off when the estimate arrives
+#define RUNAWAY_DRIFT_STEPS NUM_STEPS_ROT // Drift added in an hour
+#define RUNAWAY_TRAVEL_RATIO 4 // Estimate covering this many times the shaft's travel
+#define SLOW_LOOP_MS 50
+#define EEPROM_RATED_WRITES 100000 // Per cell, from the ATmega datasheet
+#define MAX_RUN_HOURS 1193 // millis wraps 2^32 ms in, 49.7 days
+
+// Pot model of hal_sim.cpp, to read the true shaft without an analogRead
+#define SIM_POT_ELECTRICAL_FRACTION 0.95
+#define SIM_POT_MAX_READING 1023
+
+extern PiezoSensor piezoSensors[];
+
+void setup();
+void loop();
+
+typedef struct
+{
+  unsigned long loops;
+  unsigned long worstLoopUs;
+  unsigned long slowLoops;
+  unsigned long taps;
+  unsigned long lightChanges;
+  unsigned long goalsReached;
+  unsigned long goalsMissed; // Reached by the estimate, not by the shaft
+  unsigned long goalsOverdue;
+} SoakHour;
+
+typedef struct
+{
+  bool driving;
+  uint64_t drivingSince; // Cycles
+  bool overdue;
+  long startError; // Estimate minus truth once boot was ready
+  long worstDrift;
+  long lastDrift; // At the end of the previous hour
+  long lastEstimate;
+  long lastTrue;
+  long estimateTravel; // Steps covered this hour
+  long trueTravel;
+  int runawayHour; // First hour the estimate ran away, 0 if it has not
+  long runawayEstimateTravel;
+  long runawayTrueTravel;
+  bool overflowed;
+} SoakAxis;
+
+/**
+ * Name: soak_trueSteps_(int line)
+ * Desc: Get where the sketch's position model says a modeled shaft is:
+ *       whole turns of NUM_STEPS_ROT plus the pot reading
+**/
+long soak_trueSteps_(int line)
+{
+  double turns = hal_getPotTurns(line);
+  double whole = floor(turns);
+  double fraction = turns - whole;
+  int reading;
+
+  if(fraction >= SIM_POT_ELECTRICAL_FRACTION)
+    reading = SIM_POT_MAX_READING;
+  else
+    reading = (int)(fraction / SIM_POT_ELECTRICAL_FRACTION * SIM_POT_MAX_READING);
+  return (long)whole * NUM_STEPS_ROT + reading;
+}
+
+/**
+ * Name: soak_uniform_(long min, long max)
+ * Desc: Get a random duration in [min, max]
+**/
+long soak_uniform_(long min, long max)
+{
+  return min + (long)((double)rand() / RAND_MAX * (max - min));
+}
+
+/**
+ * Name: soak_checkAxes_(SoakAxis * axes, SoakHour * hour)
+ * Desc: Tracks goals reached, missed and overdue, how far the estimates
+ *       and shafts travel, and 32 bit overflow, per servo
+ * Note: Overdue alone misses a runaway estimate. It passes its goal
+ *       within a step, so the servo stops and is sent off again before
+ *       it is ever driven for long
+**/
+void soak_checkAxes_(SoakAxis * axes, SoakHour * hour)
+{
+  int i;
+  bool driving;
+  long trueSteps;
+  ContinuousRotationServo * servo;
+  SoakAxis * axis;
+
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+  {
+    servo = crs_getInstance(i);
+    axis = &(axes[i]);
+
+    trueSteps = soak_trueSteps_(modeledPotLines[i]);
+    axis->estimateTravel += labs(servo->position - axis->lastEstimate);
+    axis->trueTravel += labs(trueSteps - axis->lastTrue);
+    axis->lastEstimate = servo->position;
+    axis->lastTrue = trueSteps;
+
+    driving = axis_isMoving(AXIS_CRS(i));
+    if(axis->driving && !driving)
+    {
+      hour->goalsReached++;
+      if(labs(servo->targetPosition - (trueSteps + axis->startError)) > GOAL_MISS_STEPS)
+        hour->goalsMissed++;
+    }
+    if(!axis->driving && driving)
+    {
+      axis->drivingSince = hal_getCycles();
+      axis->overdue = false;
+    }
+    axis->driving = driving;
+
+    if(driving && !axis->overdue && hal_getCycles() - axis->drivingSince > (uint64_t)GOAL_OVERDUE_MS * (F_CPU / 1000))
+    {
+      axis->overdue = true;
+      hour->goalsOverdue++;
+    }
+
+    if(servo->position > INT32_MAX || servo->position < INT32_MIN ||
+       servo->targetPosition > INT32_MAX || servo->targetPosition < INT32_MIN)
+      axis->overflowed = true;
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  int line;
+  int sensor;
+  double hours = DEFAULT_RUN_HOURS;
+  const char * eepromPath = NULL;
+  bool isLight;
+  int hourNum;
+  int numHours;
+  uint64_t loopStart;
+  uint64_t loopUs;
+  uint64_t hourEnd;
+  unsigned long nowMS;
+  unsigned long nextTapMS;
+  unsigned long nextLightMS;
+  unsigned long worstLoopUs = 0;
+  unsigned long totalOverdue = 0;
+  unsigned long totalMissed = 0;
+  bool runaway;
+  bool failed = false;
+  unsigned long eepromWrites;
+  unsigned long worstCell;
+  int worstCellAddress;
+  long drift;
+  clock_t wallStart = clock();
+  SoakHour hour;
+  SoakAxis axes[NUM_MODELED_POTS];
+
+  for(i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+      eepromPath = argv[++i];
+    else
+      hours = atof(argv[i]);
+  }
+  if(hours > MAX_RUN_HOURS)
+  {
+    fprintf(stderr, "running %d hours, millis wraps after that\n", MAX_RUN_HOURS);
+    hours = MAX_RUN_HOURS;
+  }
+  numHours = (int)ceil(hours);
+
+  if(!commission_powerUp(eepromPath))
+    return 1;
+  commission_boot();
+
+  srand(1);
+  memset(axes, 0, sizeof(axes));
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+  {
+    axes[i].lastEstimate = crs_getPos(i);
+    axes[i].lastTrue = soak_trueSteps_(modeledPotLines[i]);
+    axes[i].startError = axes[i].lastEstimate - axes[i].lastTrue;
+  }
+
+  isLight = true;
+  nowMS = millis();
+  nextTapMS = nowMS + (unsigned long)(-log((rand() + 1.0) / (RAND_MAX + 2.0)) * TAP_MEAN_MS);
+  nextLightMS = nowMS + soak_uniform_(LIGHT_ON_MIN_MS, LIGHT_ON_MAX_MS);
+
+  printf("hour  loops  worst ms  slow  taps  light  goals  missed  overdue  drift x/y/z (steps, ! runaway)  EEPROM\n");
+  hourEnd = hal_getCycles();
+  for(hourNum = 1; hourNum <= numHours; hourNum++)
+  {
+    memset(&hour, 0, sizeof(hour));
+    for(i = 0; i < NUM_MODELED_POTS; i++)
+    {
+      axes[i].estimateTravel = 0;
+      axes[i].trueTravel = 0;
+    }
+    hourEnd += (uint64_t)((hourNum <= hours ? 1 : hours - (hourNum - 1)) * MS_PER_HOUR) * (F_CPU / 1000);
+    while(hal_getCycles() < hourEnd)
+    {
+      nowMS = millis();
+
+      if((long)(nowMS - nextTapMS) >= 0)
+      {
+        sensor = rand() % NUM_PIEZO_SENSORS;
+        piezoSensors[sensor].fired = TAP_VAL;
+        hour.taps++;
+        nextTapMS += (unsigned long)(-log((rand() + 1.0) / (RAND_MAX + 2.0)) * TAP_MEAN_MS) + 1;
+      }
+
+      if((long)(nowMS - nextLightMS) >= 0)
+      {
+        isLight = !isLight;
+        hal_setAnalogInput(LIGHT_AIN_PORT, isLight ? BRIGHT_LIGHT_VAL : DARK_LIGHT_VAL);
+        hour.lightChanges++;
+        if(isLight)
+          nextLightMS += soak_uniform_(LIGHT_ON_MIN_MS, LIGHT_ON_MAX_MS);
+        else
+          nextLightMS += soak_uniform_(LIGHT_OFF_MIN_MS, LIGHT_OFF_MAX_MS);
+      }
+
+      loopStart = hal_getCycles();
+      loop();
+      loopUs = (hal_getCycles() - loopStart) / (F_CPU / 1000000);
+      hour.loops++;
+      if(loopUs > hour.worstLoopUs)
+        hour.worstLoopUs = loopUs;
+      if(loopUs > SLOW_LOOP_MS * 1000UL)
+        hour.slowLoops++;
+
+      soak_checkAxes_(axes, &hour);
+    }
+
+    if(hour.worstLoopUs > worstLoopUs)
+      worstLoopUs = hour.worstLoopUs;
+    totalOverdue += hour.goalsOverdue;
+    totalMissed += hour.goalsMissed;
+
+    printf("%4d %6lu %9.1f %5lu %5lu %6lu %6lu %7lu %8lu ", hourNum, hour.loops, hour.worstLoopUs / 1000.0,
+           hour.slowLoops, hour.taps, hour.lightChanges, hour.goalsReached, hour.goalsMissed, hour.goalsOverdue);
+    for(i = 0; i < NUM_MODELED_POTS; i++)
+    {
+      line = modeledPotLines[i];
+      drift = crs_getPos(i) - soak_trueSteps_(line) - axes[i].startError;
+      if(labs(drift) > labs(axes[i].worstDrift))
+        axes[i].worstDrift = drift;
+
+      // Pot correction should hold the estimate to the shaft, hour after hour
+      runaway = labs(drift - axes[i].lastDrift) > RUNAWAY_DRIFT_STEPS ||
+                axes[i].estimateTravel > RUNAWAY_TRAVEL_RATIO * axes[i].trueTravel + NUM_STEPS_ROT;
+      if(runaway && axes[i].runawayHour == 0)
+      {
+        axes[i].runawayHour = hourNum;
+        axes[i].runawayEstimateTravel = axes[i].estimateTravel;
+        axes[i].runawayTrueTravel = axes[i].trueTravel;
+      }
+      axes[i].lastDrift = drift;
+      printf(i == 0 ? " %8ld%s" : "/%ld%s", drift, runaway ? "!" : "");
+    }
+    printf("   %7lu\n", hal_getEepromWrites(-1));
+  }
+
+  // Wear is per cell, so the busiest one is what ages the board
+  eepromWrites = hal_getEepromWrites(-1);
+  worstCell = 0;
+  worstCellAddress = 0;
+  for(i = 0; i < HAL_EEPROM_SIZE; i++)
+  {
+    if(hal_getEepromWrites(i) > worstCell)
+    {
+      worstCell = hal_getEepromWrites(i);
+      worstCellAddress = i;
+    }
+  }
+
+  printf("\n%.1f simulated hours in %.1f s\n", hours, (double)(clock() - wallStart) / CLOCKS_PER_SEC);
+  printf("worst loop %.1f ms, %lu goals overdue (driven over %d s), %lu missed (shaft over %d steps off)\n",
+         worstLoopUs / 1000.0, totalOverdue, GOAL_OVERDUE_MS / 1000, totalMissed, GOAL_MISS_STEPS);
+  failed = totalMissed > 0;
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+  {
+    printf("servo %d: worst drift %ld steps%s", i, axes[i].worstDrift,
+           axes[i].overflowed ? ", position overflowed a 32 bit long" : "");
+    if(axes[i].runawayHour != 0)
+    {
+      printf(", RUNAWAY estimate from hour %d (moved %ld steps while the shaft moved %ld)", axes[i].runawayHour,
+             axes[i].runawayEstimateTravel, axes[i].runawayTrueTravel);
+      failed = true;
+    }
+    printf("\n");
+  }
+  printf("%lu EEPROM writes, busiest cell %d with %lu", eepromWrites, worstCellAddress, worstCell);
+  if(worstCell > 0)
+    printf(" (rated life reached in %.0f days)", EEPROM_RATED_WRITES / (worstCell / (hours / 24)));
+  printf("\n");
+  return failed ? 1 : 0;
+}
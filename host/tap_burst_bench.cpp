@@ -0,0 +1,142 @@
+/**
+ * Name: tap_burst_bench.cpp
+ * Desc: Hammers the aquarium with bursts of piezo taps on the simulator
+ *       and counts the servo writes they cause, with tap filtering turned
+ *       on and off. Commands the servo cache skipped are counted apart
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -I hal -I ../aquariumlogic -o tap_burst_bench \
+ *         -x c++ ../aquariumlogic/aquariumlogic.ino -x none \
+ *         tap_burst_bench.cpp commission.cpp hal/hal_common.cpp hal/hal_sim.cpp
+ *       ./tap_burst_bench [seconds]
+ * Note: Taps are injected straight into the piezo sensor records since
+ *       piezo_onTick does not detect them on its own. Each run boots on
+ *       freshly commissioned servos (see commission.h)
+**/
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "aquariumlogic.h"
+#include "commission.h"
+#include "hal_backend.h"
+
+#define DEFAULT_RUN_SECONDS 60
+
+// Burst workload: a burst every BURST_PERIOD_MS, BURST_TAPS taps long
+#define BURST_PERIOD_MS 2000
+#define BURST_TAPS 8
+#define BURST_TAP_SPACING_MS 40
+#define BURST_TAP_VAL 600
+#define OPPOSITE_SIDE_ODDS 4 // One tap in this many hits the other side
+
+// Piezo sensor ids from setup(), grouped by the side of the tank they are on
+const int westSensors[2] = {0, 1};
+const int eastSensors[2] = {2, 3};
+
+extern PiezoSensor piezoSensors[];
+
+void setup();
+void loop();
+
+struct BenchResult {
+  unsigned long loops;
+  unsigned long servoCommands; // Issued by the sketch, repeats included
+  unsigned long servoWrites; // Reached the servo
+  unsigned long taps;
+  unsigned long tapsDropped;
+};
+
+bool bench_run_(double seconds, boolean filtering, BenchResult * result)
+{
+  int i;
+  int sensor;
+  int burstTap;
+  unsigned long burstNum;
+  unsigned long nextTapMS;
+  uint64_t endCycles;
+
+  if(!commission_powerUp(NULL))
+    return false;
+
+  // The boot graph's aquarium_init resets filtering, so only set it after
+  srand(1);
+  commission_boot();
+  aquarium_setTapFiltering(0, filtering);
+
+  result->loops = 0;
+  burstNum = 0;
+  burstTap = 0;
+  nextTapMS = millis() + BURST_PERIOD_MS;
+  endCycles = hal_getCycles() + (uint64_t)(seconds * F_CPU);
+  while(hal_getCycles() < endCycles)
+  {
+    if((long)(millis() - nextTapMS) >= 0)
+    {
+      // Each burst picks a side, with the odd stray tap on the other one
+      if(((burstNum & 1) == 0) == (rand() % OPPOSITE_SIDE_ODDS != 0))
+        sensor = westSensors[rand() & 1];
+      else
+        sensor = eastSensors[rand() & 1];
+      piezoSensors[sensor].fired = BURST_TAP_VAL;
+
+      burstTap++;
+      if(burstTap == BURST_TAPS)
+      {
+        burstTap = 0;
+        burstNum++;
+        nextTapMS += BURST_PERIOD_MS - (BURST_TAPS - 1) * BURST_TAP_SPACING_MS;
+      }
+      else
+      {
+        nextTapMS += BURST_TAP_SPACING_MS;
+      }
+    }
+
+    loop();
+    result->loops++;
+  }
+
+  result->servoWrites = 0;
+  result->servoCommands = 0;
+  for(i = 0; i < NUM_MODELED_POTS; i++)
+  {
+    result->servoWrites += hal_getServoWrites(modeledServoPins[i]);
+    result->servoCommands += hal_getServoWrites(modeledServoPins[i]) + crs_getNumSkippedWrites(i);
+  }
+  result->taps = aquarium_getInstance(0)->numTaps;
+  result->tapsDropped = aquarium_getInstance(0)->numTapsDropped;
+  return true;
+}
+
+void bench_print_(const char * name, double seconds, BenchResult * result)
+{
+  printf("%-10s %6lu loops %5lu taps %5lu dropped %6lu servo writes (%.2f/s) %6lu servo commands\n",
+         name, result->loops, result->taps, result->tapsDropped,
+         result->servoWrites, result->servoWrites / seconds, result->servoCommands);
+}
+
+int main(int argc, char ** argv)
+{
+  double seconds = DEFAULT_RUN_SECONDS;
+  BenchResult unfiltered;
+  BenchResult filtered;
+
+  if(argc > 1)
+    seconds = atof(argv[1]);
+
+  if(!bench_run_(seconds, false, &unfiltered) || !bench_run_(seconds, true, &filtered))
+    return 1;
+
+  bench_print_("unfiltered", seconds, &unfiltered);
+  bench_print_("filtered", seconds, &filtered);
+
+  // Skipped commands never reached a servo, so the writes are what counts
+  if(unfiltered.servoWrites > 0 && unfiltered.servoCommands > 0)
+  {
+    printf("servo writes cut by %.1f%% (commands, skipped ones included, by %.1f%%)\n",
+           100.0 * (1.0 - (double)filtered.servoWrites / unfiltered.servoWrites),
+           100.0 * (1.0 - (double)filtered.servoCommands / unfiltered.servoCommands));
+  }
+  return 0;
+}
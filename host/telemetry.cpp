@@ -0,0 +1,179 @@
+/**
+ * Name: telemetry.cpp
+ * Desc: Writer and zero copy reader for the shared memory telemetry ring
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+**/
+
+#include "telemetry.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Name: telemetry_size_(uint32_t capacity)
+ * Desc: Get the number of bytes a ring of the given capacity occupies
+**/
+static size_t telemetry_size_(uint32_t capacity)
+{
+  return sizeof(TelemetryRingHeader) + (size_t)capacity * sizeof(TelemetryRecord);
+}
+
+/**
+ * Name: telemetry_map_(TelemetryRing * target, const char * name, bool owner)
+ * Desc: Maps the ring's shared memory object and fills in the pointers
+ * Para: owner, True to map it for writing
+**/
+static bool telemetry_map_(TelemetryRing * target, const char * name, bool owner)
+{
+  void * base;
+
+  base = mmap(NULL, target->size, owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, target->fd, 0);
+  if(base == MAP_FAILED)
+  {
+    close(target->fd);
+    return false;
+  }
+
+  target->owner = owner;
+  strncpy(target->name, name, TELEMETRY_NAME_LENGTH - 1);
+  target->name[TELEMETRY_NAME_LENGTH - 1] = '\0';
+  target->header = (TelemetryRingHeader *)base;
+  target->records = (TelemetryRecord *)((uint8_t *)base + sizeof(TelemetryRingHeader));
+  return true;
+}
+
+bool telemetry_create(TelemetryRing * target, const char * name, uint32_t capacity)
+{
+  TelemetryRingHeader * header;
+
+  if(capacity == 0 || (capacity & (capacity - 1)) != 0)
+    return false;
+
+  target->fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(target->fd < 0)
+    return false;
+
+  target->size = telemetry_size_(capacity);
+  if(ftruncate(target->fd, target->size) != 0)
+  {
+    close(target->fd);
+    shm_unlink(name);
+    return false;
+  }
+
+  if(!telemetry_map_(target, name, true))
+  {
+    shm_unlink(name);
+    return false;
+  }
+  target->mask = capacity - 1;
+
+  // Readers check the magic, so it goes in last
+  header = target->header;
+  header->version = TELEMETRY_VERSION;
+  header->capacity = capacity;
+  header->claimed = 0;
+  header->published = 0;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header->magic, TELEMETRY_MAGIC, sizeof(header->magic));
+  return true;
+}
+
+bool telemetry_open(TelemetryRing * target, const char * name)
+{
+  struct stat info;
+  const TelemetryRingHeader * header;
+
+  target->fd = shm_open(name, O_RDONLY, 0);
+  if(target->fd < 0)
+    return false;
+
+  if(fstat(target->fd, &info) != 0 || (size_t)info.st_size < sizeof(TelemetryRingHeader))
+  {
+    close(target->fd);
+    return false;
+  }
+
+  target->size = info.st_size;
+  if(!telemetry_map_(target, name, false))
+    return false;
+
+  header = target->header;
+  if(memcmp(header->magic, TELEMETRY_MAGIC, sizeof(header->magic)) != 0 ||
+     header->version != TELEMETRY_VERSION || header->capacity == 0 ||
+     (header->capacity & (header->capacity - 1)) != 0 ||
+     telemetry_size_(header->capacity) > target->size)
+  {
+    telemetry_close(target);
+    return false;
+  }
+  target->mask = header->capacity - 1;
+  return true;
+}
+
+void telemetry_close(TelemetryRing * target)
+{
+  munmap(target->header, target->size);
+  close(target->fd);
+  if(target->owner)
+    shm_unlink(target->name);
+}
+
+void telemetry_publish(TelemetryRing * target, const TelemetryRecord * record)
+{
+  TelemetryRingHeader * header = target->header;
+  uint64_t n = header->published; // Only this process writes it
+
+  // Readers must see the slot claimed before any of it changes
+  __atomic_store_n(&header->claimed, n + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  target->records[n & target->mask] = *record;
+  __atomic_store_n(&header->published, n + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t telemetry_getPublished(const TelemetryRing * target)
+{
+  return __atomic_load_n(&target->header->published, __ATOMIC_ACQUIRE);
+}
+
+TelemetrySpan telemetry_peek(const TelemetryRing * target, uint64_t cursor)
+{
+  TelemetrySpan span;
+  uint64_t published;
+  uint64_t oldest;
+  uint64_t toEnd;
+  uint64_t capacity = target->mask + 1;
+
+  published = telemetry_getPublished(target);
+
+  // The slot after the newest record may already be getting overwritten
+  oldest = published + 1 > capacity ? published + 1 - capacity : 0;
+  span.numLost = 0;
+  if(cursor < oldest)
+  {
+    span.numLost = oldest - cursor;
+    cursor = oldest;
+  }
+  if(cursor > published)
+    cursor = published; // Ring was recreated under the reader
+
+  span.first = cursor;
+  span.numRecords = published - cursor;
+  toEnd = capacity - (cursor & target->mask);
+  if(span.numRecords > toEnd)
+    span.numRecords = toEnd;
+  span.records = &(target->records[cursor & target->mask]);
+  return span;
+}
+
+bool telemetry_isIntact(const TelemetryRing * target, const TelemetrySpan * span)
+{
+  uint64_t claimed;
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  claimed = __atomic_load_n(&target->header->claimed, __ATOMIC_RELAXED);
+  return claimed <= span->first + target->mask + 1;
+}
@@ -0,0 +1,145 @@
+/**
+ * Name: telemetry.h
+ * Desc: Lock-free shared memory ring that one bridge process publishes
+ *       decoded telemetry into and any number of local readers consume in
+ *       place, without copying and without the writer ever waiting on them
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Note: Readers never write to the ring, so a slow reader only loses the
+ *       records the writer laps it on, and is told how many
+**/
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Shared memory layout (native endian, the ring never leaves the machine)
+//
+//   TelemetryRingHeader (one cache line)
+//   TelemetryRecord[capacity]
+//
+// Record n (counting from 0 since the ring was created) lives in slot
+// n & (capacity - 1). The writer bumps claimed before it starts on a slot
+// and published once the record is complete, so a reader that finds
+// claimed <= n + capacity after reading record n knows it read it whole.
+
+#define TELEMETRY_MAGIC "AQTEL01"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_DEFAULT_NAME "/aquarium_telemetry"
+#define TELEMETRY_DEFAULT_CAPACITY 65536 // Records, must be a power of two
+#define TELEMETRY_NAME_LENGTH 64
+
+#define TELEMETRY_FLAG_BOARD_MS 1 // boardMs is when the board recorded it
+
+// Same record as a capture (see capture.h), so readers can keep it as is
+typedef struct
+{
+  int64_t timestamp; // CLOCK_MONOTONIC microseconds when the line arrived
+  int32_t value;
+  int32_t eventArg;
+  uint8_t channel; // CAPTURE_CHANNEL_*
+  uint8_t event; // CAPTURE_EVENT_* or CAPTURE_EVENT_NONE
+  uint8_t id; // Which sensor or servo, 0 if the source does not say
+  uint8_t flags; // TELEMETRY_FLAG_*
+  uint16_t boardMs; // Low 16 bits of the board's millis, if flagged
+  uint8_t reserved[2];
+} TelemetryRecord;
+
+typedef struct
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t capacity;
+  uint64_t claimed; // Records the writer has started on
+  uint64_t published; // Records the writer has finished
+  uint8_t reserved[32];
+} TelemetryRingHeader;
+
+typedef struct
+{
+  int fd;
+  size_t size;
+  bool owner;
+  char name[TELEMETRY_NAME_LENGTH];
+  TelemetryRingHeader * header;
+  TelemetryRecord * records;
+  uint64_t mask;
+} TelemetryRing;
+
+// Zero copy view of consecutive records (pointers into the mapping)
+
+typedef struct
+{
+  uint64_t first; // Number of records[0]
+  uint32_t numRecords;
+  uint64_t numLost; // Records the writer lapped the reader on before first
+  const TelemetryRecord * records;
+} TelemetrySpan;
+
+/**
+ * Name: telemetry_create(TelemetryRing * target, const char * name,
+ *                        uint32_t capacity)
+ * Desc: Creates (or replaces) a ring and maps it for writing
+ * Para: target, The ring to initialize
+ *       name, Shared memory object name, eg. TELEMETRY_DEFAULT_NAME
+ *       capacity, Records held, a power of two
+ * Retr: False if the ring could not be created
+**/
+bool telemetry_create(TelemetryRing * target, const char * name, uint32_t capacity);
+
+/**
+ * Name: telemetry_open(TelemetryRing * target, const char * name)
+ * Desc: Maps an existing ring read only and validates its header
+ * Para: target, The ring to initialize
+ *       name, Shared memory object name the bridge created
+ * Retr: False if there is no such ring or it is not a telemetry ring
+**/
+bool telemetry_open(TelemetryRing * target, const char * name);
+
+/**
+ * Name: telemetry_close(TelemetryRing * target)
+ * Desc: Unmaps the ring, removing its name if this process created it
+ *       (readers that still have it mapped keep reading)
+ * Para: target, The ring to close
+**/
+void telemetry_close(TelemetryRing * target);
+
+/**
+ * Name: telemetry_publish(TelemetryRing * target, const TelemetryRecord * record)
+ * Desc: Appends a record, overwriting the oldest. Never blocks
+ * Para: target, A ring opened with telemetry_create
+ *       record, The record to publish
+**/
+void telemetry_publish(TelemetryRing * target, const TelemetryRecord * record);
+
+/**
+ * Name: telemetry_getPublished(const TelemetryRing * target)
+ * Desc: Get the number of records published since the ring was created
+ * Para: target, The ring to query
+ * Retr: Number of the next record the writer will publish
+**/
+uint64_t telemetry_getPublished(const TelemetryRing * target);
+
+/**
+ * Name: telemetry_peek(const TelemetryRing * target, uint64_t cursor)
+ * Desc: Get the published records from cursor on, up to the end of the
+ *       ring's storage (call again for the part that wraps)
+ * Para: target, The ring to read
+ *       cursor, Number of the next record the reader wants
+ * Retr: View of the records, numRecords is 0 if none are waiting. Records
+ *       the writer has already lapped are skipped and counted in numLost
+**/
+TelemetrySpan telemetry_peek(const TelemetryRing * target, uint64_t cursor);
+
+/**
+ * Name: telemetry_isIntact(const TelemetryRing * target, const TelemetrySpan * span)
+ * Desc: Determines if the writer left the span alone while it was read
+ * Para: target, The ring the span came from
+ *       span, The span, after the reader is done with it
+ * Retr: False if some of the span may have been overwritten mid read, in
+ *       which case its values must be dropped
+**/
+bool telemetry_isIntact(const TelemetryRing * target, const TelemetrySpan * span);
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ * Name: telemetry_bridge.cpp
+ * Desc: The one process that reads a controller's Serial stream. Lines the
+ *       sketches print are decoded into capture style records and published
+ *       in the shared memory telemetry ring (see telemetry.h), where
+ *       plotters, the calibration fitter and dashboards read them instead
+ *       of each opening and parsing the port themselves
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -o telemetry_bridge telemetry_bridge.cpp telemetry.cpp
+ *       ./telemetry_bridge [-n name] [-c capacity] [-b baud] device
+ *       ./aquarium_sim 600 -v -d 10000 | ./telemetry_bridge -
+ *       (from the simulator, dumping its flight recorder every 10 s)
+ * Note: Decoded lines, anything else is skipped:
+ *         "<reading>"                  pot feedback, CAPTURE_CHANNEL_POT
+ *         "<a> => <b> in <t> at <v>"   dj_speed_test revolution,
+ *                                      CAPTURE_CHANNEL_SPEED value v,
+ *                                      CAPTURE_EVENT_REVOLUTION arg t
+ *         "<ms> <event> <id> <arg>"    fr_dump record, taps, light changes,
+ *                                      goals and servo velocities, with the
+ *                                      board's ms in boardMs
+ *       Records are stamped with when their line arrived. Every dump
+ *       repeats the whole flight recorder, so only records newer than the
+ *       previous dumps' are published. The board's ms wraps every 65 s,
+ *       so that needs dumps less than half of that apart
+**/
+
+#include "capture.h"
+#include "telemetry.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINE_LENGTH 128
+#define READ_LENGTH 4096
+#define DEFAULT_BAUD 9600
+#define DUMP_HEADER "Flight recorder"
+#define MAX_SAME_MS 16 // Records remembered for the newest published ms
+
+// Flight recorder events, FR_EVENT_* in aquariumlogic.h
+#define FR_EVENT_TAP 2
+#define FR_EVENT_LIGHT 4
+#define FR_EVENT_GOAL_REACHED 6
+#define FR_EVENT_VELOCITY 7
+
+// Flight recorder record as a dump prints it
+
+typedef struct
+{
+  uint16_t ms;
+  long event;
+  long id;
+  long arg;
+} DumpedRecord;
+
+// Newest records published from flight recorder dumps
+
+typedef struct
+{
+  bool any;
+  uint16_t ms;
+  int numAtMs;
+  DumpedRecord atMs[MAX_SAME_MS]; // Published records with that ms
+} DumpMark;
+
+typedef struct
+{
+  char line[LINE_LENGTH];
+  int lineLength;
+  bool overlong; // Rest of the current line is dropped
+  DumpMark published; // Up to the end of the previous dump
+  DumpMark dump; // Newest of the dump being read
+  unsigned long numLines;
+  unsigned long numSkipped;
+  unsigned long numRepeated;
+} Bridge;
+
+volatile sig_atomic_t bridgeStopping;
+
+/**
+ * Name: bridge_nowUs()
+ * Desc: Get CLOCK_MONOTONIC in microseconds, the records' timeline
+**/
+int64_t bridge_nowUs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Name: bridge_onSignal(int signal)
+ * Desc: Stops the read loop so the ring's name is removed on the way out
+**/
+void bridge_onSignal(int signal)
+{
+  bridgeStopping = 1;
+}
+
+/**
+ * Name: bridge_speed(long baud)
+ * Desc: Get the termios speed for a baud rate
+ * Retr: The speed or B0 if unsupported
+**/
+speed_t bridge_speed(long baud)
+{
+  switch(baud)
+  {
+  case 9600:
+    return B9600;
+  case 19200:
+    return B19200;
+  case 38400:
+    return B38400;
+  case 57600:
+    return B57600;
+  case 115200:
+    return B115200;
+  }
+  return B0;
+}
+
+/**
+ * Name: bridge_open(const char * device, long baud)
+ * Desc: Opens the stream, configuring it as a raw serial port if it is one
+ * Retr: The descriptor or -1 on failure
+**/
+int bridge_open(const char * device, long baud)
+{
+  int fd;
+  struct termios attrs;
+
+  if(strcmp(device, "-") == 0)
+    return STDIN_FILENO;
+
+  fd = open(device, O_RDONLY | O_NOCTTY);
+  if(fd < 0)
+    return -1;
+  if(tcgetattr(fd, &attrs) == 0)
+  {
+    cfmakeraw(&attrs);
+    cfsetispeed(&attrs, bridge_speed(baud));
+    cfsetospeed(&attrs, bridge_speed(baud));
+    tcsetattr(fd, TCSANOW, &attrs);
+  }
+  return fd;
+}
+
+/**
+ * Name: bridge_markDumped(DumpMark * mark, const DumpedRecord * dumped)
+ * Desc: Moves a mark up to a record, records arrive oldest first
+**/
+void bridge_markDumped(DumpMark * mark, const DumpedRecord * dumped)
+{
+  if(!mark->any || mark->ms != dumped->ms)
+  {
+    mark->any = true;
+    mark->ms = dumped->ms;
+    mark->numAtMs = 0;
+  }
+  if(mark->numAtMs < MAX_SAME_MS)
+    mark->atMs[mark->numAtMs++] = *dumped;
+}
+
+/**
+ * Name: bridge_isRepeated(const DumpMark * mark, const DumpedRecord * dumped)
+ * Desc: Determines if a dump record was already published before the mark
+ * Retr: True if the record is older than the mark or one of those at it
+**/
+bool bridge_isRepeated(const DumpMark * mark, const DumpedRecord * dumped)
+{
+  int i;
+  const DumpedRecord * seen;
+
+  if(!mark->any)
+    return false;
+  if((int16_t)(dumped->ms - mark->ms) != 0)
+    return (int16_t)(dumped->ms - mark->ms) < 0;
+
+  for(i = 0; i < mark->numAtMs; i++)
+  {
+    seen = &(mark->atMs[i]);
+    if(seen->event == dumped->event && seen->id == dumped->id && seen->arg == dumped->arg)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * Name: bridge_decodeRecord(long event, long id, long arg, TelemetryRecord * record)
+ * Desc: Maps a flight recorder record onto the capture channels and events
+ * Retr: False if the event has no capture equivalent
+**/
+bool bridge_decodeRecord(long event, long id, long arg, TelemetryRecord * record)
+{
+  record->id = id;
+  switch(event)
+  {
+  case FR_EVENT_TAP:
+    record->channel = CAPTURE_CHANNEL_PIEZO;
+    record->event = CAPTURE_EVENT_TAP;
+    record->eventArg = arg; // High level sensor id
+    return true;
+  case FR_EVENT_LIGHT:
+    record->channel = CAPTURE_CHANNEL_LIGHT;
+    record->value = arg;
+    record->event = CAPTURE_EVENT_LIGHT_CHANGE;
+    return true;
+  case FR_EVENT_GOAL_REACHED:
+    record->channel = CAPTURE_CHANNEL_POT;
+    record->event = CAPTURE_EVENT_GOAL_REACHED;
+    record->eventArg = arg; // Fish
+    return true;
+  case FR_EVENT_VELOCITY:
+    record->channel = CAPTURE_CHANNEL_SPEED;
+    record->value = arg;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Name: bridge_decodeLine(Bridge * bridge, const char * line, TelemetryRecord * record)
+ * Desc: Decodes one line of the stream
+ * Para: bridge, Keeps track of what earlier dumps published
+ *       line, The line without its terminator
+ *       record, Filled in (apart from the timestamp) if the line decodes
+ * Retr: False if the line is not one of the decoded formats or repeats a
+ *       record an earlier dump published
+**/
+bool bridge_decodeLine(Bridge * bridge, const char * line, TelemetryRecord * record)
+{
+  long fields[4];
+  int numFields;
+  const char * cursor = line;
+  char * end;
+  DumpedRecord dumped;
+
+  memset(record, 0, sizeof(TelemetryRecord));
+
+  if(sscanf(line, "%ld => %ld in %ld at %ld", &fields[0], &fields[1], &fields[2], &fields[3]) == 4)
+  {
+    record->channel = CAPTURE_CHANNEL_SPEED;
+    record->value = fields[3];
+    record->event = CAPTURE_EVENT_REVOLUTION;
+    record->eventArg = fields[2];
+    return true;
+  }
+
+  // Otherwise only whole lines of one or four integers
+  for(numFields = 0; numFields < 4; numFields++)
+  {
+    fields[numFields] = strtol(cursor, &end, 10);
+    if(end == cursor)
+      break;
+    cursor = end;
+  }
+  while(*cursor == ' ' || *cursor == '\r')
+    cursor++;
+  if(*cursor != '\0')
+    return false;
+
+  if(numFields == 1)
+  {
+    record->channel = CAPTURE_CHANNEL_POT;
+    record->value = fields[0];
+    return true;
+  }
+  if(numFields != 4)
+    return false;
+
+  dumped.ms = fields[0] & 0xFFFF;
+  dumped.event = fields[1];
+  dumped.id = fields[2];
+  dumped.arg = fields[3];
+  if(bridge_isRepeated(&(bridge->published), &dumped))
+  {
+    bridge->numRepeated++;
+    return false;
+  }
+  bridge_markDumped(&(bridge->dump), &dumped);
+
+  record->flags = TELEMETRY_FLAG_BOARD_MS;
+  record->boardMs = dumped.ms;
+  return bridge_decodeRecord(dumped.event, dumped.id, dumped.arg, record);
+}
+
+/**
+ * Name: bridge_onBytes(Bridge * bridge, TelemetryRing * ring,
+ *                      const char * data, int length)
+ * Desc: Splits newly read bytes into lines, publishing those that decode
+**/
+void bridge_onBytes(Bridge * bridge, TelemetryRing * ring, const char * data, int length)
+{
+  int i;
+  int64_t nowUs = bridge_nowUs();
+  TelemetryRecord record;
+
+  for(i = 0; i < length; i++)
+  {
+    if(data[i] != '\n')
+    {
+      if(bridge->lineLength < LINE_LENGTH - 1)
+        bridge->line[bridge->lineLength++] = data[i];
+      else
+        bridge->overlong = true;
+      continue;
+    }
+
+    bridge->line[bridge->lineLength] = '\0';
+    bridge->numLines++;
+
+    // A new dump starts, everything the last one printed is now published
+    if(strncmp(bridge->line, DUMP_HEADER, strlen(DUMP_HEADER)) == 0 && bridge->dump.any)
+      bridge->published = bridge->dump;
+
+    if(!bridge->overlong && bridge_decodeLine(bridge, bridge->line, &record))
+    {
+      record.timestamp = nowUs;
+      telemetry_publish(ring, &record);
+    }
+    else
+    {
+      bridge->numSkipped++;
+    }
+    bridge->lineLength = 0;
+    bridge->overlong = false;
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  int fd;
+  ssize_t n;
+  const char * name = TELEMETRY_DEFAULT_NAME;
+  uint32_t capacity = TELEMETRY_DEFAULT_CAPACITY;
+  long baud = DEFAULT_BAUD;
+  const char * device = NULL;
+  char data[READ_LENGTH];
+  Bridge bridge;
+  TelemetryRing ring;
+
+  for(i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      name = argv[++i];
+    else if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+      capacity = strtoul(argv[++i], NULL, 10);
+    else if(strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+      baud = atol(argv[++i]);
+    else
+      device = argv[i];
+  }
+
+  if(device == NULL || bridge_speed(baud) == B0)
+  {
+    fprintf(stderr, "usage: %s [-n name] [-c capacity] [-b baud] device|-\n", argv[0]);
+    return 1;
+  }
+
+  fd = bridge_open(device, baud);
+  if(fd < 0)
+  {
+    perror(device);
+    return 1;
+  }
+
+  if(!telemetry_create(&ring, name, capacity))
+  {
+    fprintf(stderr, "could not create ring %s (capacity must be a power of two)\n", name);
+    return 1;
+  }
+
+  memset(&bridge, 0, sizeof(bridge));
+  signal(SIGINT, bridge_onSignal);
+  signal(SIGTERM, bridge_onSignal);
+
+  while(!bridgeStopping)
+  {
+    n = read(fd, data, sizeof(data));
+    if(n > 0)
+      bridge_onBytes(&bridge, &ring, data, n);
+    else if(n == 0 || errno != EINTR)
+      break;
+  }
+
+  fprintf(stderr, "%lu lines, %llu records published, %lu skipped (%lu repeated by dumps)\n",
+          bridge.numLines, (unsigned long long)telemetry_getPublished(&ring), bridge.numSkipped,
+          bridge.numRepeated);
+  telemetry_close(&ring);
+  return 0;
+}
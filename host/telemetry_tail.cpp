@@ -0,0 +1,131 @@
+/**
+ * Name: telemetry_tail.cpp
+ * Desc: Minimal telemetry ring reader: prints records as they are
+ *       published, or counts them to check a reader keeps up
+ * Auth: Jessica Ebert, Sam Pottinger, DJ Sutton
+ * Use:  g++ -O2 -o telemetry_tail telemetry_tail.cpp telemetry.cpp
+ *       ./telemetry_tail [-n name] [-c]
+ *       (-c prints records per second and losses instead of the records)
+ * Note: Start telemetry_bridge first. Any number of these (or other
+ *       readers) can run at once, none of them slows the bridge down
+**/
+
+#include "telemetry.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IDLE_SLEEP_US 1000
+#define REPORT_PERIOD_US 1000000
+#define PRINT_BATCH 256 // Records copied out per read when printing
+
+volatile sig_atomic_t tailStopping;
+
+/**
+ * Name: tail_nowUs()
+ * Desc: Get CLOCK_MONOTONIC in microseconds
+**/
+int64_t tail_nowUs()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**
+ * Name: tail_onSignal(int signal)
+ * Desc: Stops the read loop
+**/
+void tail_onSignal(int signal)
+{
+  tailStopping = 1;
+}
+
+int main(int argc, char ** argv)
+{
+  int i;
+  const char * name = TELEMETRY_DEFAULT_NAME;
+  bool counting = false;
+  uint64_t cursor;
+  uint64_t numRead = 0;
+  uint64_t numLost = 0;
+  uint64_t lastNumRead = 0;
+  int64_t nextReportUs;
+  uint32_t j;
+  int64_t checksum = 0;
+  int64_t spanSum;
+  TelemetrySpan span;
+  static TelemetryRecord batch[PRINT_BATCH];
+  TelemetryRing ring;
+
+  for(i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      name = argv[++i];
+    else if(strcmp(argv[i], "-c") == 0)
+      counting = true;
+  }
+
+  if(!telemetry_open(&ring, name))
+  {
+    fprintf(stderr, "no telemetry ring %s, is telemetry_bridge running?\n", name);
+    return 1;
+  }
+
+  signal(SIGINT, tail_onSignal);
+  signal(SIGTERM, tail_onSignal);
+
+  cursor = telemetry_getPublished(&ring);
+  nextReportUs = tail_nowUs() + REPORT_PERIOD_US;
+  while(!tailStopping)
+  {
+    span = telemetry_peek(&ring, cursor);
+    numLost += span.numLost;
+    if(span.numRecords == 0)
+      usleep(IDLE_SLEEP_US);
+
+    // Counting sums in place and keeps the sum only if the span was intact.
+    // Printing copies the records out first, as a line can't be taken back
+    if(!counting && span.numRecords > PRINT_BATCH)
+      span.numRecords = PRINT_BATCH;
+    spanSum = 0;
+    for(j = 0; j < span.numRecords; j++)
+    {
+      if(counting)
+        spanSum += span.records[j].value;
+      else
+        batch[j] = span.records[j];
+    }
+
+    if(!telemetry_isIntact(&ring, &span))
+      numLost += span.numRecords; // Lapped mid read, values may be torn
+    else
+    {
+      numRead += span.numRecords;
+      checksum += spanSum;
+      for(j = 0; !counting && j < span.numRecords; j++)
+      {
+        const TelemetryRecord * record = &(batch[j]);
+        printf("%lld %u %u %d %u %d\n", (long long)record->timestamp, record->channel, record->id,
+               record->value, record->event, record->eventArg);
+      }
+    }
+    cursor = span.first + span.numRecords;
+
+    if(counting && tail_nowUs() >= nextReportUs)
+    {
+      nextReportUs += REPORT_PERIOD_US;
+      fprintf(stderr, "%llu records/s, %llu read, %llu lost\n", (unsigned long long)(numRead - lastNumRead),
+              (unsigned long long)numRead, (unsigned long long)numLost);
+      lastNumRead = numRead;
+    }
+  }
+
+  fprintf(stderr, "%llu read, %llu lost (checksum %lld)\n", (unsigned long long)numRead,
+          (unsigned long long)numLost, (long long)checksum);
+  telemetry_close(&ring);
+  return 0;
+}
@@ -81,7 +81,7 @@ def load_speed(filename='dj_speed_data'):
             data.append(map(int,[line[0],line[2],line[4],line[6]]))
     return data
 
-def process_speed(data):
+def process_speed(data, units_per_sec=1000):
     counts = {}
     times = {}
     for start,end,time,speed in data:
@@ -92,7 +92,7 @@ def process_speed(data):
             counts[speed] = 1
             times[speed] = time
        
-    points = [(speed,float(1000*counts[speed])/times[speed]) for speed in counts.keys()]
+    points = [(speed,float(units_per_sec*counts[speed])/times[speed]) for speed in counts.keys()]
     
     fst = lambda x:x[0]
     snd = lambda x:x[1]
@@ -102,13 +102,15 @@ def process_speed(data):
     ys=map(snd,points)
     return xs,ys        
 
-def plot_speed(filename):
-    plot(*process_speed(load_speed(filename)))
+def plot_speed(filename, units_per_sec=1000):
+    plot(*process_speed(load_speed(filename), units_per_sec))
 
 import sys
 
 if __name__ == '__main__':
-    if len(sys.argv) > 1:
+    if len(sys.argv) > 2 and sys.argv[2] == 'us':
+        plot_speed(sys.argv[1], 1000000)
+    elif len(sys.argv) > 1:
         plot_speed(sys.argv[1])
     else:
-        print 'usage:',sys.argv[0],'<filename of speed data>'
+        print 'usage:',sys.argv[0],'<filename of speed data> [us]'